@@ -5,13 +5,25 @@
 
 #include "helpers.h"
 #include "auth.h"
+#include "cryptopool.h"
 #include "log.h"
 
+typedef struct password_hash_job {
+    const char* password;
+    unsigned char* salt;
+    int salt_size;
+    unsigned char* hash;
+    int result;
+} password_hash_job_t;
+
+static void __password_hash(void* arg);
+
 /**
  * @brief Hashes a password with a given salt and number of iterations.
  *
  * Uses the PBKDF2 algorithm with the HMAC-SHA256 digest function to hash the password.
- * This is a blocking function and will wait until random bytes are available if necessary.
+ * The hashing runs on a crypto pool worker, the calling thread waits for it,
+ * also while the pool queue is full.
  *
  * @param[in] password The password to hash.
  * @param[in] salt The salt to use for the hash.
@@ -21,12 +33,21 @@
  * @return 1 on success, 0 on failure.
  */
 int password_hash(const char* password, unsigned char* salt, int salt_size, unsigned char* hash) {
-    if (!PKCS5_PBKDF2_HMAC(password, strlen(password), salt, salt_size, ITERATIONS, EVP_sha256(), HASH_SIZE, hash)) {
-        log_error("Error hashing password\n");
+    password_hash_job_t job = {
+        .password = password,
+        .salt = salt,
+        .salt_size = salt_size,
+        .hash = hash,
+        .result = 0
+    };
+
+    if (!cryptopool_run(__password_hash, &job))
         return 0;
-    }
 
-    return 1;
+    if (!job.result)
+        log_error("Error hashing password\n");
+
+    return job.result;
 }
 
 /**
@@ -176,3 +197,9 @@ user_t* authenticate_by_cookie(httpctx_t* ctx) {
 
     return user;
 }
+
+void __password_hash(void* arg) {
+    password_hash_job_t* job = arg;
+
+    job->result = PKCS5_PBKDF2_HMAC(job->password, strlen(job->password), job->salt, job->salt_size, ITERATIONS, EVP_sha256(), HASH_SIZE, job->hash);
+}
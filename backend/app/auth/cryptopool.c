@@ -0,0 +1,142 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "log.h"
+#include "appconfig.h"
+#include "cryptopool.h"
+
+typedef struct cryptopool_job {
+    cryptopool_fn fn;
+    void* arg;
+    sem_t done;
+} cryptopool_job_t;
+
+static cryptopool_job_t* __queue[CRYPTOPOOL_QUEUE_SIZE];
+static size_t __head = 0;
+static size_t __count = 0;
+static int __workers = 0;
+static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t __space = PTHREAD_COND_INITIALIZER;
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+
+static atomic_int __active[CRYPTOPOOL_ROUTES];
+static int __limits[CRYPTOPOOL_ROUTES];
+static atomic_int __active_total = 0;
+static int __limit_total = 1;
+
+static void __init(void);
+static int __limit(int threads, int share);
+static void* __worker(void* arg);
+
+int cryptopool_run(cryptopool_fn fn, void* arg) {
+    pthread_once(&__once, __init);
+
+    // Without workers the caller hashes by itself, as before the pool
+    if (__workers == 0) {
+        fn(arg);
+        return 1;
+    }
+
+    cryptopool_job_t job = {
+        .fn = fn,
+        .arg = arg
+    };
+    sem_init(&job.done, 0, 0);
+
+    pthread_mutex_lock(&__mutex);
+
+    while (__count == CRYPTOPOOL_QUEUE_SIZE)
+        pthread_cond_wait(&__space, &__mutex);
+
+    __queue[(__head + __count) % CRYPTOPOOL_QUEUE_SIZE] = &job;
+    __count++;
+
+    pthread_cond_signal(&__cond);
+    pthread_mutex_unlock(&__mutex);
+
+    while (sem_wait(&job.done) != 0);
+
+    sem_destroy(&job.done);
+
+    return 1;
+}
+
+int cryptopool_acquire(cryptopool_route_e route) {
+    if (route < 0 || route >= CRYPTOPOOL_ROUTES) return 0;
+
+    pthread_once(&__once, __init);
+
+    if (atomic_fetch_add(&__active[route], 1) >= __limits[route]) {
+        atomic_fetch_sub(&__active[route], 1);
+        return 0;
+    }
+
+    if (atomic_fetch_add(&__active_total, 1) >= __limit_total) {
+        atomic_fetch_sub(&__active_total, 1);
+        atomic_fetch_sub(&__active[route], 1);
+        return 0;
+    }
+
+    return 1;
+}
+
+void cryptopool_release(cryptopool_route_e route) {
+    if (route < 0 || route >= CRYPTOPOOL_ROUTES) return;
+
+    atomic_fetch_sub(&__active_total, 1);
+    atomic_fetch_sub(&__active[route], 1);
+}
+
+void __init(void) {
+    const int threads = env()->main.threads;
+
+    __limits[CRYPTOPOOL_ROUTE_LOGIN] = __limit(threads, CRYPTOPOOL_LOGIN_SHARE);
+    __limits[CRYPTOPOOL_ROUTE_REGISTRATION] = __limit(threads, CRYPTOPOOL_REGISTRATION_SHARE);
+    // The floors of one slot per route could add up to every thread
+    __limit_total = __limit(threads, 100);
+
+    for (int i = 0; i < CRYPTOPOOL_WORKERS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, __worker, NULL) != 0) {
+            log_error("cryptopool: can't start worker\n");
+            break;
+        }
+
+        pthread_detach(thread);
+        __workers++;
+    }
+}
+
+/**
+ * @brief Share of the request threads but one, at least one slot so a single thread can still hash.
+ */
+int __limit(int threads, int share) {
+    const int limit = (threads - 1) * share / 100;
+
+    return limit > 0 ? limit : 1;
+}
+
+void* __worker(void* arg) {
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&__mutex);
+
+        while (__count == 0)
+            pthread_cond_wait(&__cond, &__mutex);
+
+        cryptopool_job_t* job = __queue[__head];
+        __head = (__head + 1) % CRYPTOPOOL_QUEUE_SIZE;
+        __count--;
+
+        pthread_cond_signal(&__space);
+        pthread_mutex_unlock(&__mutex);
+
+        job->fn(job->arg);
+        sem_post(&job->done);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef __CRYPTOPOOL__
+#define __CRYPTOPOOL__
+
+// Threads that run password hashing, the rest of the cores stay with the request threads
+#define CRYPTOPOOL_WORKERS 4
+#define CRYPTOPOOL_QUEUE_SIZE 64
+// Percent of main.threads - 1 a route may hold waiting for hashing at once, the rest get 503.
+// All routes together hold at most main.threads - 1, so with two or more request threads
+// one is never taken by hashing. With a single thread that thread may hash.
+#define CRYPTOPOOL_LOGIN_SHARE 50
+#define CRYPTOPOOL_REGISTRATION_SHARE 25
+// Seconds sent in Retry-After with 503
+#define CRYPTOPOOL_RETRY_AFTER "1"
+
+typedef enum {
+    CRYPTOPOOL_ROUTE_LOGIN = 0,
+    CRYPTOPOOL_ROUTE_REGISTRATION,
+    CRYPTOPOOL_ROUTES
+} cryptopool_route_e;
+
+typedef void(*cryptopool_fn)(void* arg);
+
+/**
+ * Runs the function on a crypto worker and waits for it to finish.
+ * The request thread is blocked meanwhile, so the pool does not free request threads:
+ * it caps how many hashes run at once, and cryptopool_acquire bounds how many threads wait.
+ * Waits for room when the queue is full.
+ * @param fn   Function to run
+ * @param arg  Argument of the function
+ * @return 1 after the function has run
+ */
+int cryptopool_run(cryptopool_fn fn, void* arg);
+
+/**
+ * Takes a slot of the route before a request starts hashing.
+ * Keeps a login storm from holding every request thread: a route has
+ * its share of main.threads - 1 slots, at least one, and all routes
+ * together at most main.threads - 1, at least one.
+ * @param route  Route
+ * @return 1 if the slot is taken, 0 if the route is saturated
+ */
+int cryptopool_acquire(cryptopool_route_e route);
+
+/**
+ * Gives back the slot taken by cryptopool_acquire.
+ * @param route  Route
+ */
+void cryptopool_release(cryptopool_route_e route);
+
+#endif
@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#include "log.h"
+#include "json.h"
+#include "appconfig.h"
+#include "jwt.h"
+
+#define JWT_HASH_SIZE 32
+#define JWT_BLOCK_SIZE 64
+#define JWT_HEADERS_MAX 8
+
+// base64url of {"alg":"HS256","typ":"JWT"}
+static const char* __header = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9";
+
+typedef struct jwt_key {
+    // SHA-256 states after the ipad and opad blocks, copied for every signature
+    EVP_MD_CTX* inner;
+    EVP_MD_CTX* outer;
+} jwt_key_t;
+
+typedef struct jwt_entry {
+    struct jwt_entry* hash_next;
+    struct jwt_entry* prev;
+    struct jwt_entry* next;
+    uint64_t hash;
+    long long expires_at;
+    jwt_claims_t claims;
+    char token[];
+} jwt_entry_t;
+
+typedef struct jwt_shard {
+    pthread_mutex_t mutex;
+    jwt_entry_t* buckets[JWT_CACHE_SHARD_BUCKETS];
+    jwt_entry_t* head;
+    jwt_entry_t* tail;
+    size_t count;
+} jwt_shard_t;
+
+static jwt_key_t __keys[2];
+static int __keys_count = 0;
+static jwt_shard_t __shards[JWT_CACHE_SHARDS];
+// Header segments that already passed the algorithm check
+static char* __headers[JWT_HEADERS_MAX];
+static int __headers_count = 0;
+static pthread_mutex_t __headers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+
+static void __init(void);
+static int __key_init(jwt_key_t* key, const char* secret);
+static int __hmac(const jwt_key_t* key, const char* data, size_t size, unsigned char* mac);
+static int __verify(const char* token, size_t size, jwt_claims_t* claims);
+static int __header_ok(const char* header, size_t size);
+static int __claims_parse(const char* payload, size_t size, jwt_claims_t* claims);
+static int __sub_parse(const char* sub, int* user_id);
+static int __secret_usable(const char* name, const char* secret);
+static char* __base64url_decode(const char* data, size_t size, size_t* decoded_size);
+static int __base64url_append(str_t* str, const unsigned char* data, size_t size);
+static uint64_t __hash(const char* token, size_t size);
+static jwt_shard_t* __shard(uint64_t hash);
+static jwt_entry_t** __bucket(jwt_shard_t* shard, uint64_t hash);
+static jwt_entry_t* __find(jwt_shard_t* shard, uint64_t hash, const char* token);
+static void __lru_unlink(jwt_shard_t* shard, jwt_entry_t* entry);
+static void __lru_push(jwt_shard_t* shard, jwt_entry_t* entry);
+static void __remove(jwt_shard_t* shard, jwt_entry_t* entry);
+static void __put(const char* token, size_t size, uint64_t hash, const jwt_claims_t* claims);
+
+str_t* jwt_create(int user_id, long ttl) {
+    pthread_once(&__once, __init);
+
+    if (__keys_count == 0) {
+        log_error("jwt: %s is not set in main.env\n", JWT_SECRET_ENV);
+        return NULL;
+    }
+
+    char payload[64];
+    const int payload_size = snprintf(payload, sizeof(payload), "{\"sub\":\"%d\",\"exp\":%lld}", user_id, (long long)time(NULL) + ttl);
+    if (payload_size < 0 || payload_size >= (int)sizeof(payload)) return NULL;
+
+    str_t* token = str_create_empty(256);
+    if (token == NULL) return NULL;
+
+    str_append(token, __header, strlen(__header));
+    str_appendc(token, '.');
+    if (!__base64url_append(token, (const unsigned char*)payload, payload_size)) goto failed;
+
+    unsigned char mac[JWT_HASH_SIZE];
+    if (!__hmac(&__keys[0], str_get(token), str_size(token), mac)) goto failed;
+
+    str_appendc(token, '.');
+    if (!__base64url_append(token, mac, sizeof(mac))) goto failed;
+
+    return token;
+
+    failed:
+
+    str_free(token);
+
+    return NULL;
+}
+
+int jwt_verify(const char* token, jwt_claims_t* claims) {
+    if (token == NULL || claims == NULL) return 0;
+
+    const size_t size = strlen(token);
+    if (size == 0 || size > JWT_TOKEN_MAX) return 0;
+
+    pthread_once(&__once, __init);
+
+    const uint64_t hash = __hash(token, size);
+    jwt_shard_t* shard = __shard(hash);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    jwt_entry_t* entry = __find(shard, hash, token);
+    if (entry != NULL && entry->expires_at > (long long)time(NULL)) {
+        *claims = entry->claims;
+
+        __lru_unlink(shard, entry);
+        __lru_push(shard, entry);
+        pthread_mutex_unlock(&shard->mutex);
+
+        return 1;
+    }
+
+    if (entry != NULL)
+        __remove(shard, entry);
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    jwt_claims_t parsed;
+    if (!__verify(token, size, &parsed)) return 0;
+
+    __put(token, size, hash, &parsed);
+    *claims = parsed;
+
+    return 1;
+}
+
+void __init(void) {
+    for (int i = 0; i < JWT_CACHE_SHARDS; i++)
+        pthread_mutex_init(&__shards[i].mutex, NULL);
+
+    const char* names[] = {JWT_SECRET_ENV, JWT_SECRET_PREVIOUS_ENV};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const char* secret = env_get_string(names[i], NULL);
+        if (secret == NULL || secret[0] == 0) continue;
+        if (!__secret_usable(names[i], secret)) continue;
+
+        if (__key_init(&__keys[__keys_count], secret))
+            __keys_count++;
+    }
+}
+
+/**
+ * @brief Refuses the config placeholder and secrets too short to resist brute force.
+ */
+int __secret_usable(const char* name, const char* secret) {
+    const size_t size = strlen(secret);
+    if (secret[0] == '<' && secret[size - 1] == '>') {
+        log_error("jwt: %s in main.env is a placeholder, tokens are disabled\n", name);
+        return 0;
+    }
+
+    if (size < JWT_SECRET_MIN) {
+        log_error("jwt: %s in main.env is shorter than %d characters, tokens are disabled\n", name, JWT_SECRET_MIN);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Hashes the key blocks once, every signature then starts from copies of these states.
+ */
+int __key_init(jwt_key_t* key, const char* secret) {
+    unsigned char block[JWT_BLOCK_SIZE] = {0};
+    unsigned char pad[JWT_BLOCK_SIZE];
+    const size_t secret_size = strlen(secret);
+    int result = 0;
+
+    if (secret_size > JWT_BLOCK_SIZE) {
+        if (!EVP_Digest(secret, secret_size, block, NULL, EVP_sha256(), NULL)) goto failed;
+    }
+    else
+        memcpy(block, secret, secret_size);
+
+    key->inner = EVP_MD_CTX_new();
+    key->outer = EVP_MD_CTX_new();
+    if (key->inner == NULL || key->outer == NULL) goto failed;
+
+    for (int i = 0; i < JWT_BLOCK_SIZE; i++)
+        pad[i] = block[i] ^ 0x36;
+
+    if (!EVP_DigestInit_ex(key->inner, EVP_sha256(), NULL)) goto failed;
+    if (!EVP_DigestUpdate(key->inner, pad, sizeof(pad))) goto failed;
+
+    for (int i = 0; i < JWT_BLOCK_SIZE; i++)
+        pad[i] = block[i] ^ 0x5c;
+
+    if (!EVP_DigestInit_ex(key->outer, EVP_sha256(), NULL)) goto failed;
+    if (!EVP_DigestUpdate(key->outer, pad, sizeof(pad))) goto failed;
+
+    result = 1;
+
+    failed:
+
+    OPENSSL_cleanse(block, sizeof(block));
+    OPENSSL_cleanse(pad, sizeof(pad));
+
+    if (!result) {
+        log_error("jwt: can't initialize key\n");
+        EVP_MD_CTX_free(key->inner);
+        EVP_MD_CTX_free(key->outer);
+        key->inner = NULL;
+        key->outer = NULL;
+    }
+
+    return result;
+}
+
+int __hmac(const jwt_key_t* key, const char* data, size_t size, unsigned char* mac) {
+    unsigned char inner_hash[JWT_HASH_SIZE];
+    int result = 0;
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (ctx == NULL) return 0;
+
+    if (!EVP_MD_CTX_copy_ex(ctx, key->inner)) goto failed;
+    if (!EVP_DigestUpdate(ctx, data, size)) goto failed;
+    if (!EVP_DigestFinal_ex(ctx, inner_hash, NULL)) goto failed;
+
+    if (!EVP_MD_CTX_copy_ex(ctx, key->outer)) goto failed;
+    if (!EVP_DigestUpdate(ctx, inner_hash, sizeof(inner_hash))) goto failed;
+    if (!EVP_DigestFinal_ex(ctx, mac, NULL)) goto failed;
+
+    result = 1;
+
+    failed:
+
+    EVP_MD_CTX_free(ctx);
+
+    return result;
+}
+
+int __verify(const char* token, size_t size, jwt_claims_t* claims) {
+    const char* end = token + size;
+    const char* payload = memchr(token, '.', size);
+    if (payload == NULL) return 0;
+
+    payload++;
+    const char* signature = memchr(payload, '.', end - payload);
+    if (signature == NULL) return 0;
+
+    signature++;
+    if (memchr(signature, '.', end - signature) != NULL) return 0;
+
+    if (!__header_ok(token, payload - 1 - token)) return 0;
+
+    size_t mac_size = 0;
+    unsigned char* mac = (unsigned char*)__base64url_decode(signature, end - signature, &mac_size);
+    if (mac == NULL) return 0;
+
+    int valid = 0;
+    if (mac_size == JWT_HASH_SIZE) {
+        for (int i = 0; i < __keys_count && !valid; i++) {
+            unsigned char expected[JWT_HASH_SIZE];
+            valid = __hmac(&__keys[i], token, signature - 1 - token, expected)
+                && CRYPTO_memcmp(expected, mac, JWT_HASH_SIZE) == 0;
+        }
+    }
+
+    free(mac);
+
+    if (!valid) return 0;
+
+    return __claims_parse(payload, signature - 1 - payload, claims);
+}
+
+/**
+ * @brief Accepts only HS256 headers.
+ * A header segment is parsed once, later tokens with the same segment skip the JSON.
+ */
+int __header_ok(const char* header, size_t size) {
+    if (size == strlen(__header) && memcmp(header, __header, size) == 0) return 1;
+
+    pthread_mutex_lock(&__headers_mutex);
+    for (int i = 0; i < __headers_count; i++)
+        if (strlen(__headers[i]) == size && memcmp(__headers[i], header, size) == 0) {
+            pthread_mutex_unlock(&__headers_mutex);
+            return 1;
+        }
+    pthread_mutex_unlock(&__headers_mutex);
+
+    size_t decoded_size = 0;
+    char* decoded = __base64url_decode(header, size, &decoded_size);
+    if (decoded == NULL) return 0;
+
+    json_doc_t* document = json_parse(decoded);
+    free(decoded);
+
+    int ok = 0;
+    if (document != NULL) {
+        json_token_t* object = json_root(document);
+        const char* alg = json_is_object(object) ? json_string(json_object_get(object, "alg")) : NULL;
+        const char* typ = json_is_object(object) ? json_string(json_object_get(object, "typ")) : NULL;
+
+        ok = alg != NULL && strcmp(alg, "HS256") == 0 && (typ == NULL || strcmp(typ, "JWT") == 0);
+
+        json_free(document);
+    }
+
+    if (!ok) return 0;
+
+    pthread_mutex_lock(&__headers_mutex);
+    if (__headers_count < JWT_HEADERS_MAX) {
+        char* copy = malloc(size + 1);
+        if (copy != NULL) {
+            memcpy(copy, header, size);
+            copy[size] = 0;
+            __headers[__headers_count++] = copy;
+        }
+    }
+    pthread_mutex_unlock(&__headers_mutex);
+
+    return 1;
+}
+
+int __claims_parse(const char* payload, size_t size, jwt_claims_t* claims) {
+    size_t decoded_size = 0;
+    char* decoded = __base64url_decode(payload, size, &decoded_size);
+    if (decoded == NULL) return 0;
+
+    json_doc_t* document = json_parse(decoded);
+    free(decoded);
+
+    if (document == NULL) return 0;
+
+    int result = 0;
+    json_token_t* object = json_root(document);
+    if (!json_is_object(object)) goto failed;
+
+    if (!__sub_parse(json_string(json_object_get(object, "sub")), &claims->user_id)) goto failed;
+
+    int ok = 0;
+    claims->exp = json_llong(json_object_get(object, "exp"), &ok);
+    if (!ok) goto failed;
+
+    const long long now = time(NULL);
+    if (claims->exp <= now) goto failed;
+
+    json_token_t* nbf = json_object_get(object, "nbf");
+    if (nbf != NULL) {
+        const long long not_before = json_llong(nbf, &ok);
+        if (!ok || not_before > now) goto failed;
+    }
+
+    result = 1;
+
+    failed:
+
+    json_free(document);
+
+    return result;
+}
+
+/**
+ * @brief Reads the "sub" string claim (RFC 7519) as a user id: digits only, no sign or leading zeros.
+ */
+int __sub_parse(const char* sub, int* user_id) {
+    if (sub == NULL || sub[0] < '1' || sub[0] > '9') return 0;
+
+    long long value = 0;
+    for (const char* c = sub; *c; c++) {
+        if (*c < '0' || *c > '9') return 0;
+
+        value = value * 10 + (*c - '0');
+        if (value > INT_MAX) return 0;
+    }
+
+    *user_id = (int)value;
+
+    return 1;
+}
+
+/**
+ * @brief Decodes unpadded canonical base64url.
+ * @return NUL-terminated buffer, free with free(), NULL on invalid input
+ */
+char* __base64url_decode(const char* data, size_t size, size_t* decoded_size) {
+    if (size % 4 == 1) return NULL;
+
+    char* decoded = malloc(size * 3 / 4 + 1);
+    if (decoded == NULL) return NULL;
+
+    uint32_t accumulator = 0;
+    int bits = 0;
+    size_t length = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        const char c = data[i];
+        int value = -1;
+        if (c >= 'A' && c <= 'Z') value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '-') value = 62;
+        else if (c == '_') value = 63;
+
+        if (value < 0) {
+            free(decoded);
+            return NULL;
+        }
+
+        accumulator = (accumulator << 6) | value;
+        bits += 6;
+
+        if (bits >= 8) {
+            bits -= 8;
+            decoded[length++] = (accumulator >> bits) & 0xFF;
+        }
+    }
+
+    // The unused bits of the last character are zero in the canonical encoding,
+    // otherwise several strings would decode to the same bytes
+    if (accumulator & ((1u << bits) - 1)) {
+        free(decoded);
+        return NULL;
+    }
+
+    decoded[length] = 0;
+    *decoded_size = length;
+
+    return decoded;
+}
+
+int __base64url_append(str_t* str, const unsigned char* data, size_t size) {
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    uint32_t accumulator = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        accumulator = (accumulator << 8) | data[i];
+        bits += 8;
+
+        while (bits >= 6) {
+            bits -= 6;
+            if (!str_appendc(str, alphabet[(accumulator >> bits) & 0x3F])) return 0;
+        }
+    }
+
+    if (bits > 0 && !str_appendc(str, alphabet[(accumulator << (6 - bits)) & 0x3F]))
+        return 0;
+
+    return 1;
+}
+
+uint64_t __hash(const char* token, size_t size) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)token[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+jwt_shard_t* __shard(uint64_t hash) {
+    return &__shards[hash % JWT_CACHE_SHARDS];
+}
+
+jwt_entry_t** __bucket(jwt_shard_t* shard, uint64_t hash) {
+    return &shard->buckets[(hash / JWT_CACHE_SHARDS) % JWT_CACHE_SHARD_BUCKETS];
+}
+
+jwt_entry_t* __find(jwt_shard_t* shard, uint64_t hash, const char* token) {
+    for (jwt_entry_t* entry = *__bucket(shard, hash); entry; entry = entry->hash_next)
+        if (entry->hash == hash && strcmp(entry->token, token) == 0)
+            return entry;
+
+    return NULL;
+}
+
+void __lru_unlink(jwt_shard_t* shard, jwt_entry_t* entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else shard->head = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+    else shard->tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+void __lru_push(jwt_shard_t* shard, jwt_entry_t* entry) {
+    entry->prev = NULL;
+    entry->next = shard->head;
+
+    if (shard->head) shard->head->prev = entry;
+    else shard->tail = entry;
+
+    shard->head = entry;
+}
+
+void __remove(jwt_shard_t* shard, jwt_entry_t* entry) {
+    jwt_entry_t** link = __bucket(shard, entry->hash);
+    while (*link != entry)
+        link = &(*link)->hash_next;
+
+    *link = entry->hash_next;
+
+    __lru_unlink(shard, entry);
+    shard->count--;
+
+    free(entry);
+}
+
+void __put(const char* token, size_t size, uint64_t hash, const jwt_claims_t* claims) {
+    jwt_entry_t* entry = malloc(sizeof * entry + size + 1);
+    if (entry == NULL) return;
+
+    const long long limit = (long long)time(NULL) + JWT_CACHE_TTL;
+
+    memcpy(entry->token, token, size + 1);
+    entry->hash_next = NULL;
+    entry->prev = NULL;
+    entry->next = NULL;
+    entry->hash = hash;
+    entry->expires_at = claims->exp < limit ? claims->exp : limit;
+    entry->claims = *claims;
+
+    jwt_shard_t* shard = __shard(hash);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    jwt_entry_t* existing = __find(shard, hash, token);
+    if (existing != NULL)
+        __remove(shard, existing);
+
+    while (shard->count >= JWT_CACHE_SHARD_CAPACITY && shard->tail != NULL)
+        __remove(shard, shard->tail);
+
+    jwt_entry_t** bucket = __bucket(shard, hash);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    __lru_push(shard, entry);
+    shard->count++;
+
+    pthread_mutex_unlock(&shard->mutex);
+}
@@ -0,0 +1,41 @@
+#ifndef __JWT__
+#define __JWT__
+
+#include "str.h"
+
+// Keys of main.env with the HS256 secrets: tokens are signed with the first, verified with both
+#define JWT_SECRET_ENV "jwt_secret"
+#define JWT_SECRET_PREVIOUS_ENV "jwt_secret_previous"
+// Shorter secrets, and <placeholders> from the shipped config, leave tokens disabled
+#define JWT_SECRET_MIN 32
+#define JWT_CACHE_SHARDS 16
+#define JWT_CACHE_SHARD_BUCKETS 512
+#define JWT_CACHE_SHARD_CAPACITY 2048
+// Upper bound of a verified token lifetime in the cache, seconds, exp still applies
+#define JWT_CACHE_TTL 300
+#define JWT_TOKEN_MAX 4096
+
+typedef struct jwt_claims {
+    int user_id;
+    long long exp;
+} jwt_claims_t;
+
+/**
+ * Creates an HS256 token with "sub" and "exp" claims.
+ * @param user_id  Value of the "sub" claim, written as a decimal string
+ * @param ttl      Lifetime in seconds
+ * @return Token or NULL on failure, free with str_free
+ */
+str_t* jwt_create(int user_id, long ttl);
+
+/**
+ * Verifies signature and expiration of an HS256 token.
+ * Verified tokens are cached by hash until exp, so a repeated token
+ * costs one lookup instead of HMAC and JSON parsing.
+ * @param token   Token in compact serialization
+ * @param claims  Claims of the token, filled on success
+ * @return 1 if the token is valid, 0 otherwise
+ */
+int jwt_verify(const char* token, jwt_claims_t* claims);
+
+#endif
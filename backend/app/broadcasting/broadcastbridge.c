@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/random.h>
+
+#include "log.h"
+#include "redispipe.h"
+#include "broadcastbridge.h"
+
+enum {
+    BRIDGE_MESSAGE = 0,
+    BRIDGE_HELLO
+};
+
+typedef struct bridge_filter {
+    char name[64];
+    int(*compare)(void*, void*);
+    size_t size;
+    void(*free)(void*);
+    size_t fields[BROADCAST_BRIDGE_FIELDS_MAX];
+    int fields_count;
+} bridge_filter_t;
+
+typedef struct bridge_message {
+    struct bridge_message* next;
+    char* channel;
+    size_t channel_size;
+    char* payload;
+    size_t payload_size;
+} bridge_message_t;
+
+static bridge_filter_t __filters[BROADCAST_BRIDGE_FILTERS_MAX];
+static atomic_int __filters_count = 0;
+static pthread_mutex_t __filters_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t __node_id = 0;
+static pthread_once_t __publisher_once = PTHREAD_ONCE_INIT;
+static pthread_once_t __subscriber_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t __queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __queue_cond = PTHREAD_COND_INITIALIZER;
+static bridge_message_t* __queue_head = NULL;
+static bridge_message_t* __queue_tail = NULL;
+static size_t __queue_size = 0;
+
+// Local-only fast path: while PUBLISH reports no receivers besides this node,
+// messages are not sent to Redis until the next probe or a hello from another node.
+// Every node that sends also subscribes, so every node hears the hellos.
+// Without a Redis connection the bridge stays local-only for good.
+static atomic_int __subscribed = 0;
+static atomic_int __remote = 1;
+static atomic_llong __probe_at = 0;
+// Set when this node receives its own hello, so its subscription is active
+static atomic_int __hello_received = 0;
+// Counts hellos from other nodes, the publisher leaves the remote mode only if none came during PUBLISH
+static unsigned int __hellos = 0;
+static pthread_mutex_t __mode_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void __publisher_start(void);
+static void __subscriber_start(void);
+static void* __publisher_run(void* arg);
+static void* __subscriber_run(void* arg);
+static long long __now(void);
+static int __remote_possible(void);
+static const bridge_filter_t* __filter_by_compare(int(*compare)(void*, void*));
+static const bridge_filter_t* __filter_by_name(const char* name, size_t size);
+static bridge_message_t* __message_create(int type, const char* channel, const char* data, size_t size, const bridge_filter_t* filter, const void* id);
+static void __message_free(bridge_message_t* message);
+static void __enqueue(bridge_message_t* message);
+static bridge_message_t* __queue_wait(void);
+static void __remote_hello(void);
+static void __receive(const char* channel, size_t channel_size, const char* data, size_t size, void* arg);
+
+int broadcast_bridge_filter_register(const char* name, int(*compare)(void*, void*), size_t size, void(*free)(void*), const size_t* fields, int fields_count) {
+    if (name == NULL || compare == NULL || size < sizeof(broadcast_id_t)) return 0;
+    if (strlen(name) >= sizeof(__filters[0].name)) return 0;
+    if (fields_count < 0 || fields_count > BROADCAST_BRIDGE_FIELDS_MAX) return 0;
+    if (fields_count > 0 && fields == NULL) return 0;
+
+    for (int i = 0; i < fields_count; i++)
+        if (fields[i] < sizeof(broadcast_id_t) || fields[i] + sizeof(int32_t) > size)
+            return 0;
+
+    int result = 0;
+
+    pthread_mutex_lock(&__filters_mutex);
+
+    const int count = atomic_load(&__filters_count);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(__filters[i].name, name) == 0) {
+            result = __filters[i].compare == compare;
+            goto done;
+        }
+    }
+
+    if (count == BROADCAST_BRIDGE_FILTERS_MAX) {
+        log_error("broadcast_bridge_filter_register: too many filters\n");
+        goto done;
+    }
+
+    bridge_filter_t* filter = &__filters[count];
+    strcpy(filter->name, name);
+    filter->compare = compare;
+    filter->size = size;
+    filter->free = free;
+    filter->fields_count = fields_count;
+    for (int i = 0; i < fields_count; i++)
+        filter->fields[i] = fields[i];
+
+    // Readers walk the registry without the mutex up to the published count
+    atomic_store(&__filters_count, count + 1);
+    result = 1;
+
+    done:
+
+    pthread_mutex_unlock(&__filters_mutex);
+
+    return result;
+}
+
+int broadcast_bridge_add(const char* channel, connection_t* connection, void* id, void(*handler)(response_t*, const char*, size_t)) {
+    pthread_once(&__subscriber_once, __subscriber_start);
+
+    return broadcast_add(channel, connection, id, handler);
+}
+
+void broadcast_bridge_send_all(const char* channel, connection_t* sender, const char* data, size_t size) {
+    broadcast_bridge_send(channel, sender, data, size, NULL, NULL);
+}
+
+void broadcast_bridge_send(const char* channel, connection_t* sender, const char* data, size_t size, void* filter, int(*compare)(void*, void*)) {
+    pthread_once(&__subscriber_once, __subscriber_start);
+
+    // The filter is serialized before broadcast_send takes ownership of it
+    if (__remote_possible()) {
+        const bridge_filter_t* registered = NULL;
+        if (filter != NULL && compare != NULL)
+            registered = __filter_by_compare(compare);
+
+        if (filter != NULL && compare != NULL && registered == NULL)
+            log_error("broadcast_bridge_send: filter is not registered, delivered locally only\n");
+        else
+            __enqueue(__message_create(BRIDGE_MESSAGE, channel, data, size, registered, filter));
+    }
+
+    broadcast_send(channel, sender, data, size, filter, compare);
+}
+
+void __publisher_start(void) {
+    if (getrandom(&__node_id, sizeof(__node_id), 0) != sizeof(__node_id))
+        __node_id = ((uint64_t)getpid() << 32) ^ (uint64_t)__now();
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, __publisher_run, NULL) != 0) {
+        log_error("broadcast bridge: can't start publisher\n");
+        return;
+    }
+
+    pthread_detach(thread);
+}
+
+void __subscriber_start(void) {
+    if (redisconn_default() == NULL) {
+        atomic_store(&__probe_at, LLONG_MAX);
+        atomic_store(&__remote, 0);
+        return;
+    }
+
+    pthread_once(&__publisher_once, __publisher_start);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, __subscriber_run, NULL) != 0) {
+        log_error("broadcast bridge: can't start subscriber\n");
+        return;
+    }
+
+    pthread_detach(thread);
+}
+
+void* __publisher_run(void* arg) {
+    (void)arg;
+
+    while (1) {
+        bridge_message_t* batch = __queue_wait();
+        if (batch == NULL) continue;
+
+        redispipe_t* pipe = redispipe_create();
+        if (pipe == NULL) goto next;
+
+        for (bridge_message_t* message = batch; message; message = message->next) {
+            const char* argv[] = {"PUBLISH", message->channel, message->payload};
+            const size_t argvlen[] = {7, message->channel_size, message->payload_size};
+            redispipe_commandv(pipe, 3, argv, argvlen);
+        }
+
+        pthread_mutex_lock(&__mode_mutex);
+        const unsigned int hellos = __hellos;
+        pthread_mutex_unlock(&__mode_mutex);
+
+        if (!redispipe_exec(redisconn_default(), pipe)) {
+            log_error("broadcast bridge: %s\n", redispipe_error(pipe));
+            goto next;
+        }
+
+        long long receivers = 0;
+        for (size_t i = 0; i < redispipe_count(pipe); i++) {
+            const redisreply_t* reply = redispipe_reply(pipe, i);
+            if (reply != NULL && reply->type == REDISREPLY_INTEGER && reply->integer > receivers)
+                receivers = reply->integer;
+        }
+
+        // A hello that came while PUBLISH was in flight is from a node the receivers did not count
+        pthread_mutex_lock(&__mode_mutex);
+        if (receivers <= atomic_load(&__subscribed) && hellos == __hellos) {
+            atomic_store(&__probe_at, __now() + BROADCAST_BRIDGE_PROBE_INTERVAL * 1000LL);
+            atomic_store(&__remote, 0);
+        }
+        pthread_mutex_unlock(&__mode_mutex);
+
+        next:
+
+        redispipe_free(pipe);
+
+        while (batch != NULL) {
+            bridge_message_t* next = batch->next;
+            __message_free(batch);
+            batch = next;
+        }
+    }
+
+    return NULL;
+}
+
+void* __subscriber_run(void* arg) {
+    (void)arg;
+
+    redisconn_t* conn = redisconn_config();
+    if (conn == NULL) {
+        log_error("broadcast bridge: can't create redis connection\n");
+        return NULL;
+    }
+
+    atomic_store(&__subscribed, 1);
+
+    // Other nodes may be in the local-only mode, tell them to start publishing.
+    // The publisher repeats the hello until it comes back, a hello sent before
+    // PSUBSCRIBE is active could make the others skip this node again.
+    __enqueue(__message_create(BRIDGE_HELLO, "", NULL, 0, NULL, NULL));
+
+    redisconn_psubscribe(conn, BROADCAST_BRIDGE_PREFIX "*", __receive, NULL);
+    redisconn_free(conn);
+
+    return NULL;
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int __remote_possible(void) {
+    if (atomic_load(&__remote)) return 1;
+    if (__now() < atomic_load(&__probe_at)) return 0;
+
+    atomic_store(&__remote, 1);
+
+    return 1;
+}
+
+const bridge_filter_t* __filter_by_compare(int(*compare)(void*, void*)) {
+    const int count = atomic_load(&__filters_count);
+    for (int i = 0; i < count; i++)
+        if (__filters[i].compare == compare)
+            return &__filters[i];
+
+    return NULL;
+}
+
+const bridge_filter_t* __filter_by_name(const char* name, size_t size) {
+    const int count = atomic_load(&__filters_count);
+    for (int i = 0; i < count; i++)
+        if (strlen(__filters[i].name) == size && memcmp(__filters[i].name, name, size) == 0)
+            return &__filters[i];
+
+    return NULL;
+}
+
+/**
+ * @brief Builds a PUBLISH payload, integers are little-endian:
+ * node id (8) | type (1) | filter name length (1) | filter name | fields count (1) | fields (4 each) | data
+ */
+bridge_message_t* __message_create(int type, const char* channel, const char* data, size_t size, const bridge_filter_t* filter, const void* id) {
+    const size_t name_size = filter ? strlen(filter->name) : 0;
+    const int fields_count = filter ? filter->fields_count : 0;
+    const size_t prefix_size = sizeof(BROADCAST_BRIDGE_PREFIX) - 1;
+    const size_t channel_size = strlen(channel);
+
+    bridge_message_t* message = malloc(sizeof * message);
+    if (message == NULL) return NULL;
+
+    message->next = NULL;
+    message->channel_size = prefix_size + channel_size;
+    message->payload_size = 8 + 1 + 1 + name_size + 1 + fields_count * 4 + size;
+    message->channel = malloc(message->channel_size + 1);
+    message->payload = malloc(message->payload_size);
+    if (message->channel == NULL || message->payload == NULL) {
+        __message_free(message);
+        return NULL;
+    }
+
+    memcpy(message->channel, BROADCAST_BRIDGE_PREFIX, prefix_size);
+    memcpy(message->channel + prefix_size, channel, channel_size + 1);
+
+    unsigned char* p = (unsigned char*)message->payload;
+    for (int i = 0; i < 8; i++)
+        *p++ = (__node_id >> (i * 8)) & 0xFF;
+
+    *p++ = type;
+    *p++ = name_size;
+    memcpy(p, filter ? filter->name : "", name_size);
+    p += name_size;
+
+    *p++ = fields_count;
+    for (int i = 0; i < fields_count; i++) {
+        int32_t value = 0;
+        memcpy(&value, (const char*)id + filter->fields[i], sizeof(value));
+
+        const uint32_t bits = (uint32_t)value;
+        for (int j = 0; j < 4; j++)
+            *p++ = (bits >> (j * 8)) & 0xFF;
+    }
+
+    if (size > 0)
+        memcpy(p, data, size);
+
+    return message;
+}
+
+void __message_free(bridge_message_t* message) {
+    if (message == NULL) return;
+
+    free(message->channel);
+    free(message->payload);
+    free(message);
+}
+
+void __enqueue(bridge_message_t* message) {
+    if (message == NULL) {
+        log_error("broadcast bridge: out of memory\n");
+        return;
+    }
+
+    pthread_mutex_lock(&__queue_mutex);
+
+    if (__queue_size >= BROADCAST_BRIDGE_QUEUE_MAX) {
+        pthread_mutex_unlock(&__queue_mutex);
+        log_error("broadcast bridge: queue is full, message dropped\n");
+        __message_free(message);
+        return;
+    }
+
+    if (__queue_tail) __queue_tail->next = message;
+    else __queue_head = message;
+    __queue_tail = message;
+    __queue_size++;
+
+    pthread_cond_signal(&__queue_cond);
+    pthread_mutex_unlock(&__queue_mutex);
+}
+
+/**
+ * @brief Takes up to BROADCAST_BRIDGE_BATCH_MAX messages from the queue.
+ * Returns NULL after BROADCAST_BRIDGE_HELLO_INTERVAL without messages, queueing a hello if this node has not received its own yet.
+ */
+bridge_message_t* __queue_wait(void) {
+    pthread_mutex_lock(&__queue_mutex);
+
+    while (__queue_head == NULL) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += BROADCAST_BRIDGE_HELLO_INTERVAL;
+
+        if (pthread_cond_timedwait(&__queue_cond, &__queue_mutex, &deadline) != 0 && __queue_head == NULL) {
+            pthread_mutex_unlock(&__queue_mutex);
+
+            if (atomic_load(&__subscribed) && !atomic_load(&__hello_received))
+                __enqueue(__message_create(BRIDGE_HELLO, "", NULL, 0, NULL, NULL));
+
+            return NULL;
+        }
+    }
+
+    bridge_message_t* batch = __queue_head;
+    bridge_message_t* last = batch;
+    size_t count = 1;
+    while (last->next != NULL && count < BROADCAST_BRIDGE_BATCH_MAX) {
+        last = last->next;
+        count++;
+    }
+
+    __queue_head = last->next;
+    if (__queue_head == NULL) __queue_tail = NULL;
+    __queue_size -= count;
+    last->next = NULL;
+
+    pthread_mutex_unlock(&__queue_mutex);
+
+    return batch;
+}
+
+void __remote_hello(void) {
+    pthread_mutex_lock(&__mode_mutex);
+    __hellos++;
+    atomic_store(&__remote, 1);
+    pthread_mutex_unlock(&__mode_mutex);
+}
+
+void __receive(const char* channel, size_t channel_size, const char* data, size_t size, void* arg) {
+    (void)arg;
+
+    const size_t prefix_size = sizeof(BROADCAST_BRIDGE_PREFIX) - 1;
+    if (channel_size < prefix_size || size < 10) return;
+
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+
+    uint64_t node_id = 0;
+    for (int i = 0; i < 8; i++)
+        node_id |= (uint64_t)*p++ << (i * 8);
+
+    const int type = *p++;
+    if (node_id == __node_id) {
+        if (type == BRIDGE_HELLO)
+            atomic_store(&__hello_received, 1);
+
+        return;
+    }
+
+    if (type == BRIDGE_HELLO) {
+        __remote_hello();
+        return;
+    }
+
+    const size_t name_size = *p++;
+    if ((size_t)(end - p) < name_size + 1) return;
+
+    const char* name = (const char*)p;
+    p += name_size;
+
+    const int fields_count = *p++;
+    if ((size_t)(end - p) < (size_t)fields_count * 4) return;
+
+    // Receiving a message means another node listens, so this node publishes to Redis again
+    atomic_store(&__remote, 1);
+
+    const unsigned char* fields = p;
+    p += fields_count * 4;
+
+    const char* target = channel + prefix_size;
+    const char* payload = (const char*)p;
+    const size_t payload_size = end - p;
+
+    if (name_size == 0) {
+        broadcast_send(target, NULL, payload, payload_size, NULL, NULL);
+        return;
+    }
+
+    const bridge_filter_t* filter = __filter_by_name(name, name_size);
+    if (filter == NULL || filter->fields_count != fields_count) {
+        log_error("broadcast bridge: unknown filter %.*s\n", (int)name_size, name);
+        return;
+    }
+
+    broadcast_id_t* id = calloc(1, filter->size);
+    if (id == NULL) return;
+
+    id->free = filter->free;
+    for (int i = 0; i < fields_count; i++) {
+        uint32_t bits = 0;
+        for (int j = 0; j < 4; j++)
+            bits |= (uint32_t)*fields++ << (j * 8);
+
+        const int32_t value = (int32_t)bits;
+        memcpy((char*)id + filter->fields[i], &value, sizeof(value));
+    }
+
+    broadcast_send(target, NULL, payload, payload_size, id, filter->compare);
+}
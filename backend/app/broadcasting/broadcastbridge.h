@@ -0,0 +1,49 @@
+#ifndef __BROADCASTBRIDGE__
+#define __BROADCASTBRIDGE__
+
+#include "broadcast.h"
+
+#define BROADCAST_BRIDGE_PREFIX "broadcast:"
+#define BROADCAST_BRIDGE_FILTERS_MAX 32
+#define BROADCAST_BRIDGE_FIELDS_MAX 8
+#define BROADCAST_BRIDGE_QUEUE_MAX 65536
+#define BROADCAST_BRIDGE_BATCH_MAX 256
+// Seconds between PUBLISH probes while no other node is subscribed
+#define BROADCAST_BRIDGE_PROBE_INTERVAL 5
+// Seconds between hello retries until this node receives its own hello
+#define BROADCAST_BRIDGE_HELLO_INTERVAL 1
+
+/**
+ * Makes filters of a broadcast_id_t subtype transferable between nodes.
+ * Only the listed int fields are sent, as 32-bit little-endian values in the given order,
+ * the other bytes of a received filter are zero.
+ * Must be called with the same name and fields on every node before sending.
+ * @param name          Unique filter name
+ * @param compare       Comparison function passed to broadcast_bridge_send
+ * @param size          sizeof of the subtype
+ * @param free          Destructor assigned to received filters
+ * @param fields        offsetof of the int fields read by compare
+ * @param fields_count  Number of fields, up to BROADCAST_BRIDGE_FIELDS_MAX
+ * @return 1 on success, 0 on invalid arguments or if the registry is full
+ */
+int broadcast_bridge_filter_register(const char* name, int(*compare)(void*, void*), size_t size, void(*free)(void*), const size_t* fields, int fields_count);
+
+/**
+ * Same as broadcast_add. Also starts listening for messages from other nodes.
+ */
+int broadcast_bridge_add(const char* channel, connection_t* connection, void* id, void(*handler)(response_t*, const char*, size_t));
+
+/**
+ * Same as broadcast_send_all, delivered to subscribers on every node.
+ */
+void broadcast_bridge_send_all(const char* channel, connection_t* sender, const char* data, size_t size);
+
+/**
+ * Same as broadcast_send, delivered to subscribers on every node.
+ * Local subscribers are served immediately, remote nodes receive the message
+ * through Redis Pub/Sub in batched PUBLISH pipelines.
+ * Takes ownership of filter, as broadcast_send does.
+ */
+void broadcast_bridge_send(const char* channel, connection_t* sender, const char* data, size_t size, void* filter, int(*compare)(void*, void*));
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "broadcastbridge.h"
+#include "broadcastindex.h"
+
+#define BROADCAST_INDEX_CHANNEL_SIZE (BROADCAST_INDEX_NAME_SIZE * 2 + 16)
+
+typedef struct broadcast_index {
+    char channel[BROADCAST_INDEX_NAME_SIZE];
+    char keys[BROADCAST_INDEX_KEYS_MAX][BROADCAST_INDEX_NAME_SIZE];
+    size_t offsets[BROADCAST_INDEX_KEYS_MAX];
+    int keys_count;
+} broadcast_index_t;
+
+// Sub-channels a connection was added to, kept for broadcast_index_remove.
+// The record lives as long as the id of the subscription: the free handler of the id
+// is replaced, so broadcast_clear on close also drops the record
+typedef struct broadcast_index_record {
+    struct broadcast_index_record* next;
+    struct broadcast_index_record* id_next;
+    connection_t* connection;
+    broadcast_id_t* id;
+    void(*free)(void*);
+    char channel[BROADCAST_INDEX_NAME_SIZE];
+    char subchannels[BROADCAST_INDEX_KEYS_MAX][BROADCAST_INDEX_CHANNEL_SIZE];
+    int subchannels_count;
+} broadcast_index_record_t;
+
+static broadcast_index_t __indexes[BROADCAST_INDEX_MAX];
+static int __indexes_count = 0;
+static pthread_rwlock_t __indexes_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static broadcast_index_record_t* __records[BROADCAST_INDEX_BUCKETS];
+static broadcast_index_record_t* __records_by_id[BROADCAST_INDEX_BUCKETS];
+static pthread_mutex_t __records_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t __bucket(const char* channel, const connection_t* connection);
+static size_t __id_bucket(const void* id);
+static void __record_link(broadcast_index_record_t* record);
+static broadcast_index_record_t* __record_unlink_id(const void* id);
+static int __record_subchannels(const char* channel, connection_t* connection, char subchannels[][BROADCAST_INDEX_CHANNEL_SIZE]);
+static void __id_free(void* id);
+static void __subchannel(char* buffer, const char* channel, const char* key, int value);
+
+int broadcast_index_register(const char* channel, const char* key, size_t offset) {
+    if (channel == NULL || key == NULL || offset < sizeof(broadcast_id_t)) return 0;
+    if (strlen(channel) >= BROADCAST_INDEX_NAME_SIZE || strlen(key) >= BROADCAST_INDEX_NAME_SIZE) return 0;
+
+    int result = 0;
+
+    pthread_rwlock_wrlock(&__indexes_lock);
+
+    broadcast_index_t* index = NULL;
+    for (int i = 0; i < __indexes_count && index == NULL; i++)
+        if (strcmp(__indexes[i].channel, channel) == 0)
+            index = &__indexes[i];
+
+    if (index == NULL) {
+        if (__indexes_count == BROADCAST_INDEX_MAX) {
+            log_error("broadcast_index_register: too many channels\n");
+            goto done;
+        }
+
+        index = &__indexes[__indexes_count++];
+        strcpy(index->channel, channel);
+        index->keys_count = 0;
+    }
+
+    for (int i = 0; i < index->keys_count; i++)
+        if (strcmp(index->keys[i], key) == 0) {
+            result = index->offsets[i] == offset;
+            goto done;
+        }
+
+    if (index->keys_count == BROADCAST_INDEX_KEYS_MAX) {
+        log_error("broadcast_index_register: too many keys of %s\n", channel);
+        goto done;
+    }
+
+    strcpy(index->keys[index->keys_count], key);
+    index->offsets[index->keys_count] = offset;
+    index->keys_count++;
+    result = 1;
+
+    done:
+
+    pthread_rwlock_unlock(&__indexes_lock);
+
+    return result;
+}
+
+int broadcast_index_add(const char* channel, connection_t* connection, void* id, void(*handler)(response_t*, const char*, size_t)) {
+    if (channel == NULL || strlen(channel) >= BROADCAST_INDEX_NAME_SIZE) return 0;
+
+    // A repeated join replaces the previous subscription with its sub-channels
+    char subchannels[BROADCAST_INDEX_KEYS_MAX][BROADCAST_INDEX_CHANNEL_SIZE];
+    if (__record_subchannels(channel, connection, subchannels) >= 0)
+        broadcast_index_remove(channel, connection);
+
+    broadcast_index_record_t* record = NULL;
+    if (id != NULL) {
+        record = calloc(1, sizeof * record);
+        if (record == NULL) {
+            broadcast_id_t* base = id;
+            if (base->free != NULL) base->free(id);
+            return 0;
+        }
+
+        record->connection = connection;
+        record->id = id;
+        strcpy(record->channel, channel);
+
+        pthread_rwlock_rdlock(&__indexes_lock);
+
+        for (int i = 0; i < __indexes_count; i++) {
+            const broadcast_index_t* index = &__indexes[i];
+            if (strcmp(index->channel, channel) != 0) continue;
+
+            for (int j = 0; j < index->keys_count; j++) {
+                int value = 0;
+                memcpy(&value, (const char*)id + index->offsets[j], sizeof(value));
+                __subchannel(record->subchannels[record->subchannels_count++], channel, index->keys[j], value);
+            }
+
+            break;
+        }
+
+        pthread_rwlock_unlock(&__indexes_lock);
+
+        // Nothing to clean up for a channel without keys
+        if (record->subchannels_count == 0) {
+            free(record);
+            record = NULL;
+        }
+        else {
+            record->free = record->id->free;
+            record->id->free = __id_free;
+            __record_link(record);
+        }
+    }
+
+    // broadcast_add takes ownership of id even when it fails, __id_free drops the record then
+    if (!broadcast_bridge_add(channel, connection, id, handler))
+        return 0;
+
+    // Sub-channel subscribers carry no id, the key has already selected them.
+    // The record is copied again, a close may have freed it already
+    const int subchannels_count = record != NULL ? __record_subchannels(channel, connection, subchannels) : 0;
+    for (int i = 0; i < subchannels_count; i++)
+        broadcast_bridge_add(subchannels[i], connection, NULL, handler);
+
+    return 1;
+}
+
+void broadcast_index_remove(const char* channel, connection_t* connection) {
+    if (channel == NULL) return;
+
+    // Copied first: removing the channel frees the id and with it the record
+    char subchannels[BROADCAST_INDEX_KEYS_MAX][BROADCAST_INDEX_CHANNEL_SIZE];
+    const int subchannels_count = __record_subchannels(channel, connection, subchannels);
+
+    for (int i = 0; i < subchannels_count; i++)
+        broadcast_remove(subchannels[i], connection);
+
+    broadcast_remove(channel, connection);
+}
+
+void broadcast_index_send(const char* channel, connection_t* sender, const char* data, size_t size, const char* key, int value) {
+    if (channel == NULL || key == NULL) return;
+    if (strlen(channel) >= BROADCAST_INDEX_NAME_SIZE || strlen(key) >= BROADCAST_INDEX_NAME_SIZE) return;
+
+    char subchannel[BROADCAST_INDEX_CHANNEL_SIZE];
+    __subchannel(subchannel, channel, key, value);
+
+    broadcast_bridge_send_all(subchannel, sender, data, size);
+}
+
+size_t __bucket(const char* channel, const connection_t* connection) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char* p = (const unsigned char*)channel; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= (uintptr_t)connection;
+    hash *= 1099511628211ULL;
+
+    return (hash ^ (hash >> 32)) % BROADCAST_INDEX_BUCKETS;
+}
+
+size_t __id_bucket(const void* id) {
+    uint64_t hash = (uintptr_t)id;
+    hash *= 11400714819323198485ULL;
+
+    return (hash >> 32) % BROADCAST_INDEX_BUCKETS;
+}
+
+void __record_link(broadcast_index_record_t* record) {
+    pthread_mutex_lock(&__records_mutex);
+
+    const size_t bucket = __bucket(record->channel, record->connection);
+    record->next = __records[bucket];
+    __records[bucket] = record;
+
+    const size_t id_bucket = __id_bucket(record->id);
+    record->id_next = __records_by_id[id_bucket];
+    __records_by_id[id_bucket] = record;
+
+    pthread_mutex_unlock(&__records_mutex);
+}
+
+/**
+ * @brief Unlinks the record of the subscription id from both tables.
+ */
+broadcast_index_record_t* __record_unlink_id(const void* id) {
+    broadcast_index_record_t* record = NULL;
+
+    pthread_mutex_lock(&__records_mutex);
+
+    for (broadcast_index_record_t** item = &__records_by_id[__id_bucket(id)]; *item != NULL; item = &(*item)->id_next)
+        if ((*item)->id == id) {
+            record = *item;
+            *item = record->id_next;
+            break;
+        }
+
+    if (record != NULL) {
+        for (broadcast_index_record_t** item = &__records[__bucket(record->channel, record->connection)]; *item != NULL; item = &(*item)->next)
+            if (*item == record) {
+                *item = record->next;
+                break;
+            }
+    }
+
+    pthread_mutex_unlock(&__records_mutex);
+
+    return record;
+}
+
+/**
+ * @brief Copies the sub-channels of the connection in the channel.
+ * @return Number of sub-channels, -1 if the connection has no record
+ */
+int __record_subchannels(const char* channel, connection_t* connection, char subchannels[][BROADCAST_INDEX_CHANNEL_SIZE]) {
+    int count = -1;
+
+    pthread_mutex_lock(&__records_mutex);
+
+    for (broadcast_index_record_t* record = __records[__bucket(channel, connection)]; record != NULL; record = record->next)
+        if (record->connection == connection && strcmp(record->channel, channel) == 0) {
+            count = record->subchannels_count;
+            memcpy(subchannels, record->subchannels, sizeof(record->subchannels));
+            break;
+        }
+
+    pthread_mutex_unlock(&__records_mutex);
+
+    return count;
+}
+
+/**
+ * @brief Free handler of indexed ids. Runs on broadcast_remove and on broadcast_clear when the
+ * connection closes; broadcast_clear removes the sub-channel subscriptions itself.
+ */
+void __id_free(void* id) {
+    broadcast_index_record_t* record = __record_unlink_id(id);
+    if (record == NULL) {
+        log_error("broadcast_index: id without a record is not freed\n");
+        return;
+    }
+
+    if (record->free != NULL)
+        record->free(id);
+
+    free(record);
+}
+
+void __subchannel(char* buffer, const char* channel, const char* key, int value) {
+    snprintf(buffer, BROADCAST_INDEX_CHANNEL_SIZE, "%s#%s=%d", channel, key, value);
+}
@@ -0,0 +1,42 @@
+#ifndef __BROADCASTINDEX__
+#define __BROADCASTINDEX__
+
+#include "broadcast.h"
+
+#define BROADCAST_INDEX_MAX 32
+#define BROADCAST_INDEX_KEYS_MAX 4
+#define BROADCAST_INDEX_NAME_SIZE 64
+#define BROADCAST_INDEX_BUCKETS 4096
+
+/**
+ * Declares an int field of the identification structure as an index key of the channel.
+ * Every subscriber is also placed into the sub-channel "<channel>#<key>=<value>", so
+ * broadcast_index_send reaches the subscribers with the value without comparing the others.
+ * Must be called before subscribers are added, with the same arguments on every node.
+ * @param channel  Channel name
+ * @param key      Key name, e.g. "user_id"
+ * @param offset   offsetof of the int field in the identification structure
+ * @return 1 on success, 0 if the registry or the keys of the channel are full
+ */
+int broadcast_index_register(const char* channel, const char* key, size_t offset);
+
+/**
+ * Same as broadcast_bridge_add, also subscribes the connection to the sub-channel of every index key.
+ * @param id  Identification structure, the indexed fields are read once here
+ */
+int broadcast_index_add(const char* channel, connection_t* connection, void* id, void(*handler)(response_t*, const char*, size_t));
+
+/**
+ * Same as broadcast_remove, also removes the connection from its sub-channels.
+ */
+void broadcast_index_remove(const char* channel, connection_t* connection);
+
+/**
+ * Sends to the subscribers whose key equals the value, except the sender, on every node.
+ * Replaces broadcast_send with a compare function that tests the key for equality.
+ * @param key    Registered key name
+ * @param value  Key value
+ */
+void broadcast_index_send(const char* channel, connection_t* sender, const char* data, size_t size, const char* key, int value);
+
+#endif
@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "log.h"
+#include "redispipe.h"
+#include "eventstream.h"
+
+#define EVENTSTREAM_KEY_SIZE (sizeof(EVENTSTREAM_REDIS_PREFIX) + EVENTSTREAM_CHANNEL_NAME_SIZE + 3)
+
+typedef struct eventstream_frame {
+    unsigned long long id;
+    char* data;
+    size_t size;
+} eventstream_frame_t;
+
+typedef struct eventstream_channel {
+    char name[EVENTSTREAM_CHANNEL_NAME_SIZE];
+    // Frames with ids first_id .. last_id, the frame of an id is at id % EVENTSTREAM_RING_SIZE
+    eventstream_frame_t ring[EVENTSTREAM_RING_SIZE];
+    unsigned long long first_id;
+    unsigned long long last_id;
+    pthread_rwlock_t lock;
+} eventstream_channel_t;
+
+static eventstream_channel_t __channels[EVENTSTREAM_CHANNELS_MAX];
+static atomic_int __channels_count = 0;
+static pthread_mutex_t __channels_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Assigns the id and stores the frame in one step, so readers never see a later id before an earlier one
+static const char* __publish_script =
+    "local id = redis.call('INCR', KEYS[2]) "
+    "redis.call('ZADD', KEYS[1], id, 'id: ' .. id .. '\\n' .. ARGV[1]) "
+    "redis.call('ZREMRANGEBYSCORE', KEYS[1], '-inf', id - tonumber(ARGV[2])) "
+    "return id";
+
+static eventstream_channel_t* __channel_find(const char* channel);
+static eventstream_channel_t* __channel_get(const char* channel);
+static char* __frame(unsigned long long id, const char* event, const char* data, size_t size, size_t* frame_size);
+static int __redis_keys(const char* channel, char* key, char* id_key);
+static unsigned long long __redis_publish(redisconn_t* conn, const char* channel, const char* event, const char* data, size_t size);
+static int __redis_stream(redisconn_t* conn, const char* channel, const char* last_event_id, str_t* body);
+static int __redis_replay(redisconn_t* conn, const char* key, str_t* body);
+static int __frames_append(const redisreply_t* reply, str_t* body);
+static int __score(const redisreply_t* reply, unsigned long long* id);
+
+unsigned long long eventstream_publish(const char* channel, const char* event, const char* data, size_t size) {
+    if (channel == NULL || (data == NULL && size > 0)) return 0;
+    if (event != NULL && strpbrk(event, "\r\n") != NULL) return 0;
+
+    redisconn_t* conn = redisconn_default();
+    if (conn != NULL)
+        return __redis_publish(conn, channel, event, data, size);
+
+    eventstream_channel_t* entry = __channel_get(channel);
+    if (entry == NULL) return 0;
+
+    pthread_rwlock_wrlock(&entry->lock);
+
+    const unsigned long long id = entry->last_id + 1;
+
+    // Encoded once here, every client gets a copy of the same bytes
+    size_t frame_size = 0;
+    char* frame = __frame(id, event, data, size, &frame_size);
+    if (frame == NULL) {
+        pthread_rwlock_unlock(&entry->lock);
+        log_error("eventstream_publish: out of memory\n");
+        return 0;
+    }
+
+    eventstream_frame_t* slot = &entry->ring[id % EVENTSTREAM_RING_SIZE];
+    free(slot->data);
+    slot->id = id;
+    slot->data = frame;
+    slot->size = frame_size;
+
+    entry->last_id = id;
+    if (entry->first_id == 0)
+        entry->first_id = id;
+    else if (id - entry->first_id >= EVENTSTREAM_RING_SIZE)
+        entry->first_id = id - EVENTSTREAM_RING_SIZE + 1;
+
+    pthread_rwlock_unlock(&entry->lock);
+
+    return id;
+}
+
+str_t* eventstream_stream(const char* channel, const char* last_event_id) {
+    if (channel == NULL) return NULL;
+
+    str_t* body = str_create_empty(256);
+    if (body == NULL) return NULL;
+
+    char line[64];
+    int size = snprintf(line, sizeof(line), "retry: %d\n\n", EVENTSTREAM_RETRY);
+    if (!str_append(body, line, size)) goto failed;
+
+    redisconn_t* conn = redisconn_default();
+    if (conn != NULL) {
+        if (!__redis_stream(conn, channel, last_event_id, body)) goto failed;
+
+        return body;
+    }
+
+    eventstream_channel_t* entry = __channel_find(channel);
+    if (entry == NULL) return body;
+
+    char* end = NULL;
+    unsigned long long last = 0;
+    if (last_event_id != NULL && last_event_id[0] != 0)
+        last = strtoull(last_event_id, &end, 10);
+
+    pthread_rwlock_rdlock(&entry->lock);
+
+    if (entry->last_id == 0) {
+        pthread_rwlock_unlock(&entry->lock);
+        return body;
+    }
+
+    unsigned long long from = 0;
+    if (last_event_id == NULL || last_event_id[0] == 0) {
+        // A frame with only an id sets the last event id of the client and dispatches nothing
+        size = snprintf(line, sizeof(line), "id: %llu\n\n", entry->last_id);
+        if (!str_append(body, line, size)) goto unlock_failed;
+
+        pthread_rwlock_unlock(&entry->lock);
+        return body;
+    }
+
+    if (*end != 0 || last > entry->last_id || last + 1 < entry->first_id)
+        from = entry->first_id;
+    else
+        from = last + 1;
+
+    for (unsigned long long id = from; id <= entry->last_id; id++) {
+        const eventstream_frame_t* frame = &entry->ring[id % EVENTSTREAM_RING_SIZE];
+        if (!str_append(body, frame->data, frame->size)) goto unlock_failed;
+    }
+
+    pthread_rwlock_unlock(&entry->lock);
+
+    return body;
+
+    unlock_failed:
+
+    pthread_rwlock_unlock(&entry->lock);
+
+    failed:
+
+    str_free(body);
+
+    return NULL;
+}
+
+eventstream_channel_t* __channel_find(const char* channel) {
+    const int count = atomic_load(&__channels_count);
+    for (int i = 0; i < count; i++)
+        if (strcmp(__channels[i].name, channel) == 0)
+            return &__channels[i];
+
+    return NULL;
+}
+
+eventstream_channel_t* __channel_get(const char* channel) {
+    eventstream_channel_t* entry = __channel_find(channel);
+    if (entry != NULL) return entry;
+
+    if (strlen(channel) >= EVENTSTREAM_CHANNEL_NAME_SIZE) return NULL;
+
+    pthread_mutex_lock(&__channels_mutex);
+
+    entry = __channel_find(channel);
+    if (entry != NULL) goto done;
+
+    const int count = atomic_load(&__channels_count);
+    if (count == EVENTSTREAM_CHANNELS_MAX) {
+        log_error("eventstream: too many channels\n");
+        goto done;
+    }
+
+    entry = &__channels[count];
+    memset(entry, 0, sizeof * entry);
+    strcpy(entry->name, channel);
+    pthread_rwlock_init(&entry->lock, NULL);
+
+    // Readers walk the table without the mutex up to the published count
+    atomic_store(&__channels_count, count + 1);
+
+    done:
+
+    pthread_mutex_unlock(&__channels_mutex);
+
+    return entry;
+}
+
+/**
+ * @brief Encodes "id:", "event:" and one "data:" line per line of data, ended by an empty line.
+ * Id 0 leaves out the "id:" line, the publish script of Redis prepends it.
+ */
+char* __frame(unsigned long long id, const char* event, const char* data, size_t size, size_t* frame_size) {
+    size_t lines = 1;
+    for (size_t i = 0; i < size; i++)
+        if (data[i] == '\n')
+            lines++;
+
+    const size_t event_size = event != NULL ? strlen(event) : 0;
+    const size_t capacity = 32 + (event_size > 0 ? 8 + event_size : 0) + size + lines * 7 + 2;
+
+    char* frame = malloc(capacity);
+    if (frame == NULL) return NULL;
+
+    size_t length = 0;
+    if (id > 0)
+        length = snprintf(frame, capacity, "id: %llu\n", id);
+
+    if (event_size > 0)
+        length += snprintf(frame + length, capacity - length, "event: %s\n", event);
+
+    size_t start = 0;
+    for (size_t i = 0; i <= size; i++) {
+        if (i < size && data[i] != '\n') continue;
+
+        // A CRLF line break keeps no CR in the data
+        size_t end = i;
+        if (end > start && data[end - 1] == '\r')
+            end--;
+
+        memcpy(frame + length, "data: ", 6);
+        length += 6;
+        memcpy(frame + length, data + start, end - start);
+        length += end - start;
+        frame[length++] = '\n';
+
+        start = i + 1;
+    }
+
+    frame[length++] = '\n';
+    *frame_size = length;
+
+    return frame;
+}
+
+int __redis_keys(const char* channel, char* key, char* id_key) {
+    if (strlen(channel) >= EVENTSTREAM_CHANNEL_NAME_SIZE) return 0;
+
+    snprintf(key, EVENTSTREAM_KEY_SIZE, "%s%s", EVENTSTREAM_REDIS_PREFIX, channel);
+    snprintf(id_key, EVENTSTREAM_KEY_SIZE, "%s%s:id", EVENTSTREAM_REDIS_PREFIX, channel);
+
+    return 1;
+}
+
+/**
+ * @brief The ring is a sorted set of frames scored by id, the id counter is a key of its own.
+ */
+unsigned long long __redis_publish(redisconn_t* conn, const char* channel, const char* event, const char* data, size_t size) {
+    char key[EVENTSTREAM_KEY_SIZE];
+    char id_key[EVENTSTREAM_KEY_SIZE];
+    if (!__redis_keys(channel, key, id_key)) return 0;
+
+    size_t frame_size = 0;
+    char* frame = __frame(0, event, data, size, &frame_size);
+    if (frame == NULL) {
+        log_error("eventstream_publish: out of memory\n");
+        return 0;
+    }
+
+    char ring_size[16];
+    snprintf(ring_size, sizeof(ring_size), "%d", EVENTSTREAM_RING_SIZE);
+
+    const char* argv[] = {"EVAL", __publish_script, "2", key, id_key, frame, ring_size};
+    size_t argvlen[sizeof(argv) / sizeof(argv[0])];
+    // The frame is not null-terminated
+    for (size_t i = 0; i < sizeof(argv) / sizeof(argv[0]); i++)
+        argvlen[i] = argv[i] == frame ? frame_size : strlen(argv[i]);
+
+    unsigned long long id = 0;
+
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) goto failed;
+
+    if (!redispipe_commandv(pipe, sizeof(argv) / sizeof(argv[0]), argv, argvlen)) goto failed;
+
+    if (!redispipe_exec(conn, pipe)) {
+        log_error("eventstream_publish: %s\n", redispipe_error(pipe));
+        goto failed;
+    }
+
+    const redisreply_t* reply = redispipe_reply(pipe, 0);
+    if (reply != NULL && reply->type == REDISREPLY_INTEGER && reply->integer > 0)
+        id = reply->integer;
+    else if (reply != NULL && reply->type == REDISREPLY_ERROR)
+        log_error("eventstream_publish: %s\n", reply->str);
+
+    failed:
+
+    redispipe_free(pipe);
+    free(frame);
+
+    return id;
+}
+
+/**
+ * @brief Reads the oldest and the newest id with the frames after last_event_id in one transaction.
+ * Falls back to the whole ring, as the memory ring does, if the id is unknown or pushed out.
+ */
+int __redis_stream(redisconn_t* conn, const char* channel, const char* last_event_id, str_t* body) {
+    char key[EVENTSTREAM_KEY_SIZE];
+    char id_key[EVENTSTREAM_KEY_SIZE];
+    if (!__redis_keys(channel, key, id_key)) return 1;
+
+    const int resume = last_event_id != NULL && last_event_id[0] != 0;
+
+    char* end = NULL;
+    unsigned long long last = 0;
+    if (resume)
+        last = strtoull(last_event_id, &end, 10);
+
+    const int valid = resume && *end == 0;
+
+    char from[32] = "-inf";
+    if (valid)
+        snprintf(from, sizeof(from), "(%llu", last);
+
+    int result = 0;
+
+    redispipe_t* pipe = redispipe_create_transaction();
+    if (pipe == NULL) return 0;
+
+    const char* first_argv[] = {"ZRANGE", key, "0", "0", "WITHSCORES"};
+    const char* last_argv[] = {"ZRANGE", key, "-1", "-1", "WITHSCORES"};
+    const char* frames_argv[] = {"ZRANGEBYSCORE", key, from, "+inf"};
+    size_t argvlen[5];
+    for (size_t i = 0; i < 5; i++)
+        argvlen[i] = strlen(first_argv[i]);
+
+    if (!redispipe_commandv(pipe, 5, first_argv, argvlen)) goto failed;
+
+    for (size_t i = 0; i < 5; i++)
+        argvlen[i] = strlen(last_argv[i]);
+
+    if (!redispipe_commandv(pipe, 5, last_argv, argvlen)) goto failed;
+
+    for (size_t i = 0; i < 4; i++)
+        argvlen[i] = strlen(frames_argv[i]);
+
+    if (resume && !redispipe_commandv(pipe, 4, frames_argv, argvlen)) goto failed;
+
+    if (!redispipe_exec(conn, pipe)) {
+        log_error("eventstream_stream: %s\n", redispipe_error(pipe));
+        goto failed;
+    }
+
+    unsigned long long first_id = 0;
+    unsigned long long last_id = 0;
+    const int first_ok = __score(redispipe_reply(pipe, 0), &first_id);
+    const int last_ok = __score(redispipe_reply(pipe, 1), &last_id);
+    if (first_ok < 0 || last_ok < 0) goto failed;
+
+    // An empty ring
+    if (!first_ok || !last_ok) {
+        result = 1;
+        goto failed;
+    }
+
+    if (!resume) {
+        // A frame with only an id sets the last event id of the client and dispatches nothing
+        char line[64];
+        const int size = snprintf(line, sizeof(line), "id: %llu\n\n", last_id);
+        result = str_append(body, line, size);
+        goto failed;
+    }
+
+    if (valid && (last > last_id || last + 1 < first_id))
+        result = __redis_replay(conn, key, body);
+    else
+        result = __frames_append(redispipe_reply(pipe, 2), body);
+
+    failed:
+
+    redispipe_free(pipe);
+
+    return result;
+}
+
+int __redis_replay(redisconn_t* conn, const char* key, str_t* body) {
+    const char* argv[] = {"ZRANGE", key, "0", "-1"};
+    size_t argvlen[sizeof(argv) / sizeof(argv[0])];
+    for (size_t i = 0; i < sizeof(argv) / sizeof(argv[0]); i++)
+        argvlen[i] = strlen(argv[i]);
+
+    int result = 0;
+
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) return 0;
+
+    if (!redispipe_commandv(pipe, sizeof(argv) / sizeof(argv[0]), argv, argvlen)) goto failed;
+
+    if (!redispipe_exec(conn, pipe)) {
+        log_error("eventstream_stream: %s\n", redispipe_error(pipe));
+        goto failed;
+    }
+
+    result = __frames_append(redispipe_reply(pipe, 0), body);
+
+    failed:
+
+    redispipe_free(pipe);
+
+    return result;
+}
+
+int __frames_append(const redisreply_t* reply, str_t* body) {
+    if (reply == NULL || reply->type != REDISREPLY_ARRAY) return 0;
+
+    for (size_t i = 0; i < reply->elements; i++) {
+        const redisreply_t* frame = &reply->element[i];
+        if (frame->type != REDISREPLY_STRING) return 0;
+        if (!str_append(body, frame->str, frame->len)) return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Id of the single member of a ZRANGE ... WITHSCORES reply.
+ * @return 1 with the id, 0 if the ring is empty, -1 on an unexpected reply
+ */
+int __score(const redisreply_t* reply, unsigned long long* id) {
+    if (reply == NULL || reply->type != REDISREPLY_ARRAY) return -1;
+    if (reply->elements == 0) return 0;
+    if (reply->elements != 2 || reply->element[1].type != REDISREPLY_STRING) return -1;
+
+    char* end = NULL;
+    *id = strtoull(reply->element[1].str, &end, 10);
+
+    return *end == 0 ? 1 : -1;
+}
@@ -0,0 +1,40 @@
+#ifndef __EVENTSTREAM__
+#define __EVENTSTREAM__
+
+#include <stddef.h>
+
+#include "str.h"
+
+#define EVENTSTREAM_CHANNELS_MAX 64
+#define EVENTSTREAM_CHANNEL_NAME_SIZE 64
+// Encoded events kept per channel for Last-Event-ID replay
+#define EVENTSTREAM_RING_SIZE 256
+// Milliseconds the client waits before reconnecting, sent as "retry:"
+#define EVENTSTREAM_RETRY 1000
+// Keys of the rings when Redis is configured: "<prefix><channel>" and "<prefix><channel>:id"
+#define EVENTSTREAM_REDIS_PREFIX "eventstream:"
+
+/**
+ * Encodes the event once as an event-stream frame and appends it to the ring of the channel,
+ * pushing out the oldest event when the ring is full. The channel is created on first use.
+ * With the redispipe_* keys of main.env the ring is kept in Redis and shared by all nodes,
+ * otherwise it lives in the memory of the process and is shared by all handler libraries.
+ * @param channel  Channel name
+ * @param event    Event type or NULL for "message"
+ * @param data     Event data, split into "data:" lines at line breaks
+ * @param size     Data size
+ * @return Id of the event, 0 on failure
+ */
+unsigned long long eventstream_publish(const char* channel, const char* event, const char* data, size_t size);
+
+/**
+ * Builds a text/event-stream body: "retry:" and the events of the channel after last_event_id.
+ * A client without an id gets only the id of the newest event, so that its next request continues from it.
+ * An id that is unknown, e.g. issued before a restart, or already pushed out of the ring, replays the whole ring.
+ * @param channel        Channel name
+ * @param last_event_id  Value of the Last-Event-ID header or NULL
+ * @return Body, release with str_free. NULL on failure, also if Redis is configured and unavailable
+ */
+str_t* eventstream_stream(const char* channel, const char* last_event_id);
+
+#endif
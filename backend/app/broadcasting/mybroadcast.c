@@ -1,7 +1,18 @@
+#include <stddef.h>
+#include <pthread.h>
+
 #include "websockets.h"
 #include "mybroadcast.h"
+#include "broadcastbridge.h"
+#include "broadcastindex.h"
+
+static pthread_once_t __bridge_once = PTHREAD_ONCE_INIT;
+
+static void __bridge_register(void);
 
 mybroadcast_id_t* mybroadcast_id_create() {
+    pthread_once(&__bridge_once, __bridge_register);
+
     mybroadcast_id_t* st = malloc(sizeof * st);
     if (st == NULL) return NULL;
 
@@ -13,6 +24,8 @@ mybroadcast_id_t* mybroadcast_id_create() {
 }
 
 mybroadcast_id_t* mybroadcast_compare_id_create() {
+    pthread_once(&__bridge_once, __bridge_register);
+
     mybroadcast_id_t* st = malloc(sizeof * st);
     if (st == NULL) return NULL;
 
@@ -43,4 +56,21 @@ int mybroadcast_compare(void* sourceStruct, void* targetStruct) {
     mybroadcast_id_t* td = targetStruct;
 
     return sd->user_id == td->user_id;
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief Registers the filter for other nodes and the index keys of MYBROADCAST_CHANNEL
+ * once per process, before the first id is sent or subscribed.
+ */
+void __bridge_register(void) {
+    const size_t fields[] = {
+        offsetof(mybroadcast_id_t, user_id),
+        offsetof(mybroadcast_id_t, project_id)
+    };
+
+    broadcast_bridge_filter_register("mybroadcast", mybroadcast_compare, sizeof(mybroadcast_id_t), mybroadcast_id_free, fields, 2);
+
+    broadcast_index_register(MYBROADCAST_CHANNEL, "user_id", offsetof(mybroadcast_id_t, user_id));
+    broadcast_index_register(MYBROADCAST_CHANNEL, "project_id", offsetof(mybroadcast_id_t, project_id));
+}
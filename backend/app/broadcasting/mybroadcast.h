@@ -3,6 +3,9 @@
 
 #include "broadcast.h"
 
+// Channel whose subscribers are indexed by user_id and project_id
+#define MYBROADCAST_CHANNEL "my_broadcast_name"
+
 typedef struct mybroadcast_id {
     broadcast_id_t base;
     int user_id;
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "db.h"
+#include "user.h"
+#include "rbac.h"
+#include "principalcache.h"
+
+typedef struct principalcache_entry {
+    struct principalcache_entry* hash_next;
+    struct principalcache_entry* prev;
+    struct principalcache_entry* next;
+    principal_t* principal;
+} principalcache_entry_t;
+
+static const char* __dbid = "postgresql";
+
+static principalcache_entry_t* __buckets[PRINCIPALCACHE_BUCKETS];
+static principalcache_entry_t* __head = NULL;
+static principalcache_entry_t* __tail = NULL;
+static size_t __count = 0;
+static uint64_t __generation = 0;
+static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long __now(void);
+static principalcache_entry_t** __bucket(int user_id);
+static principalcache_entry_t* __find(int user_id);
+static void __lru_unlink(principalcache_entry_t* entry);
+static void __lru_push(principalcache_entry_t* entry);
+static void __remove(principalcache_entry_t* entry);
+static principal_t* __load(int user_id);
+static int __load_roles(int user_id, int** roles, int* roles_count);
+static void __store(principal_t* principal, uint64_t generation);
+
+principal_t* principalcache_get(int user_id) {
+    if (user_id < 1) return NULL;
+
+    pthread_mutex_lock(&__mutex);
+
+    principalcache_entry_t* entry = __find(user_id);
+    if (entry != NULL && entry->principal->expires_at > __now()) {
+        principal_t* principal = principal_retain(entry->principal);
+
+        __lru_unlink(entry);
+        __lru_push(entry);
+        pthread_mutex_unlock(&__mutex);
+
+        return principal;
+    }
+
+    if (entry != NULL)
+        __remove(entry);
+
+    const uint64_t generation = __generation;
+
+    pthread_mutex_unlock(&__mutex);
+
+    principal_t* principal = __load(user_id);
+    if (principal == NULL) return NULL;
+
+    __store(principal, generation);
+
+    return principal;
+}
+
+void principalcache_invalidate(int user_id) {
+    pthread_mutex_lock(&__mutex);
+
+    __generation++;
+
+    principalcache_entry_t* entry = __find(user_id);
+    if (entry != NULL)
+        __remove(entry);
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+void principalcache_invalidate_role(int role_id) {
+    pthread_mutex_lock(&__mutex);
+
+    __generation++;
+
+    principalcache_entry_t* entry = __head;
+    while (entry != NULL) {
+        principalcache_entry_t* next = entry->next;
+
+        for (int i = 0; i < entry->principal->roles_count; i++)
+            if (entry->principal->roles[i] == role_id) {
+                __remove(entry);
+                break;
+            }
+
+        entry = next;
+    }
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+void principalcache_invalidate_all(void) {
+    pthread_mutex_lock(&__mutex);
+
+    __generation++;
+
+    while (__head != NULL)
+        __remove(__head);
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+principal_t* principal_retain(principal_t* principal) {
+    if (principal != NULL)
+        atomic_fetch_add(&principal->refs, 1);
+
+    return principal;
+}
+
+void principal_release(principal_t* principal) {
+    if (principal == NULL) return;
+
+    if (atomic_fetch_sub(&principal->refs, 1) == 1) {
+        rbac_bitset_free(&principal->permissions);
+        free(principal);
+    }
+}
+
+int principal_has_permission(const principal_t* principal, int permission) {
+    if (principal == NULL) return 0;
+
+    return rbac_bitset_has(&principal->permissions, permission);
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+principalcache_entry_t** __bucket(int user_id) {
+    return &__buckets[(unsigned int)user_id % PRINCIPALCACHE_BUCKETS];
+}
+
+principalcache_entry_t* __find(int user_id) {
+    for (principalcache_entry_t* entry = *__bucket(user_id); entry; entry = entry->hash_next)
+        if (entry->principal->id == user_id)
+            return entry;
+
+    return NULL;
+}
+
+void __lru_unlink(principalcache_entry_t* entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else __head = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+    else __tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+void __lru_push(principalcache_entry_t* entry) {
+    entry->prev = NULL;
+    entry->next = __head;
+
+    if (__head) __head->prev = entry;
+    else __tail = entry;
+
+    __head = entry;
+}
+
+void __remove(principalcache_entry_t* entry) {
+    principalcache_entry_t** link = __bucket(entry->principal->id);
+    while (*link != entry)
+        link = &(*link)->hash_next;
+
+    *link = entry->hash_next;
+
+    __lru_unlink(entry);
+    __count--;
+
+    // Requests still holding the principal keep it alive
+    principal_release(entry->principal);
+    free(entry);
+}
+
+principal_t* __load(int user_id) {
+    principal_t* principal = NULL;
+    int* roles = NULL;
+    int roles_count = 0;
+
+    array_t* params = array_create();
+    if (params == NULL) return NULL;
+
+    mparams_fill_array(params,
+        mparam_int(id, user_id)
+    );
+    user_t* user = user_get(params);
+    array_free(params);
+
+    if (user == NULL) return NULL;
+
+    if (!__load_roles(user_id, &roles, &roles_count)) goto failed;
+
+    const char* email = user_email(user);
+    const char* name = user_name(user);
+    const size_t roles_size = roles_count * sizeof(int);
+    const size_t email_size = email ? strlen(email) + 1 : 1;
+    const size_t name_size = name ? strlen(name) + 1 : 1;
+
+    principal = calloc(1, sizeof * principal + roles_size + email_size + name_size);
+    if (principal == NULL) goto failed;
+
+    // Role ids go first, the buffer follows a pointer and is aligned for them
+    char* buffer = principal->buffer;
+    if (roles_size > 0)
+        memcpy(buffer, roles, roles_size);
+    memcpy(buffer + roles_size, email ? email : "", email_size);
+    memcpy(buffer + roles_size + email_size, name ? name : "", name_size);
+
+    atomic_init(&principal->refs, 1);
+    principal->expires_at = __now() + PRINCIPALCACHE_TTL * 1000LL;
+    principal->id = user_id;
+    principal->roles = (const int*)buffer;
+    principal->roles_count = roles_count;
+    principal->email = buffer + roles_size;
+    principal->name = buffer + roles_size + email_size;
+
+    for (int i = 0; i < roles_count; i++)
+        if (!rbac_role_permissions(roles[i], &principal->permissions)) {
+            principal_release(principal);
+            principal = NULL;
+            break;
+        }
+
+    failed:
+
+    free(roles);
+    user_free(user);
+
+    return principal;
+}
+
+/**
+ * @brief Reads the role ids of the user, permissions come from the rbac tables.
+ */
+int __load_roles(int user_id, int** roles, int* roles_count) {
+    array_t* params = array_create();
+    if (params == NULL) return 0;
+
+    mparams_fill_array(params,
+        mparam_int(user_id, user_id)
+    );
+
+    dbresult_t* result = dbquery(__dbid, "SELECT role_id FROM user_role WHERE user_id = :user_id", params);
+    array_free(params);
+
+    int ok = result != NULL && dbresult_ok(result);
+    if (!ok) {
+        log_error("principalcache: %s\n", result ? dbresult_error(result) : "out of memory");
+        goto failed;
+    }
+
+    const int rows = dbresult_query_rows(result);
+    if (rows == 0) goto failed;
+
+    *roles = malloc(rows * sizeof(int));
+    if (*roles == NULL) {
+        ok = 0;
+        goto failed;
+    }
+
+    for (int row = 0; row < rows; row++) {
+        const db_table_cell_t* cell = dbresult_cell(result, row, 0);
+        if (cell == NULL || cell->value == NULL) continue;
+
+        (*roles)[(*roles_count)++] = atoi(cell->value);
+    }
+
+    failed:
+
+    if (result != NULL) dbresult_free(result);
+
+    return ok;
+}
+
+void __store(principal_t* principal, uint64_t generation) {
+    principalcache_entry_t* entry = malloc(sizeof * entry);
+    if (entry == NULL) return;
+
+    pthread_mutex_lock(&__mutex);
+
+    // An invalidation during the load makes the snapshot possibly stale: hand it out, don't keep it
+    if (generation != __generation) {
+        pthread_mutex_unlock(&__mutex);
+        free(entry);
+        return;
+    }
+
+    principalcache_entry_t* existing = __find(principal->id);
+    if (existing != NULL)
+        __remove(existing);
+
+    while (__count >= PRINCIPALCACHE_CAPACITY && __tail != NULL)
+        __remove(__tail);
+
+    entry->principal = principal_retain(principal);
+
+    principalcache_entry_t** bucket = __bucket(principal->id);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    __lru_push(entry);
+    __count++;
+
+    pthread_mutex_unlock(&__mutex);
+}
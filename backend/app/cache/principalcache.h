@@ -0,0 +1,64 @@
+#ifndef __PRINCIPALCACHE__
+#define __PRINCIPALCACHE__
+
+#include <stdatomic.h>
+
+#include "rbac.h"
+
+#define PRINCIPALCACHE_TTL 30
+#define PRINCIPALCACHE_BUCKETS 1024
+#define PRINCIPALCACHE_CAPACITY 4096
+
+/**
+ * Immutable snapshot of an authenticated user.
+ * Shared between requests: take a reference with principal_retain,
+ * give it back with principal_release. Never modify the fields.
+ */
+typedef struct principal {
+    atomic_int refs;
+    long long expires_at;
+    int id;
+    const char* email;
+    const char* name;
+    // Union of the permissions of the user's roles, indexed by rbac_permission()
+    rbac_bitset_t permissions;
+    const int* roles;
+    int roles_count;
+    char buffer[];
+} principal_t;
+
+/**
+ * Returns the principal of the user, loading the user and its permissions on a miss.
+ * @param user_id  User id
+ * @return Principal with a reference owned by the caller, NULL if the user is not found
+ */
+principal_t* principalcache_get(int user_id);
+
+/**
+ * Drops the cached principal, called after user_update/user_delete and user_role changes.
+ * @param user_id  User id
+ */
+void principalcache_invalidate(int user_id);
+
+/**
+ * Drops principals of the users that have the role, called by the rbac updates.
+ * @param role_id  Role id
+ */
+void principalcache_invalidate_role(int role_id);
+
+/**
+ * Drops every cached principal.
+ */
+void principalcache_invalidate_all(void);
+
+principal_t* principal_retain(principal_t* principal);
+void principal_release(principal_t* principal);
+
+/**
+ * Single bit test, see middleware_http_permission.
+ * @param permission  Index returned by rbac_permission
+ * @return 1 if any role of the user grants the permission, 0 otherwise
+ */
+int principal_has_permission(const principal_t* principal, int permission);
+
+#endif
@@ -0,0 +1,904 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "querycache.h"
+#include "base64.h"
+#include "appconfig.h"
+#include "log.h"
+#include "redispipe.h"
+
+#define QUERYCACHE_NULL_CELL UINT32_MAX
+
+struct qcresult {
+    atomic_int refs;
+    int rows;
+    int cols;
+    size_t size;
+    char** names;
+    db_table_cell_t* cells;
+};
+
+typedef struct {
+    int slot;
+    unsigned long gen;
+} qctagref_t;
+
+typedef struct qcentry {
+    struct qcentry* chain;
+    struct qcentry* prev;
+    struct qcentry* next;
+    uint64_t hash;
+    char* key;
+    size_t key_size;
+    long long expires_at;
+    size_t bytes;
+    int tags_count;
+    qctagref_t tags[QUERYCACHE_MAX_TAGS];
+    // Tag generations in Redis when the entry was built, other nodes bump them
+    int shared;
+    unsigned long long gens[QUERYCACHE_MAX_TAGS];
+    qcresult_t* result;
+} qcentry_t;
+
+typedef struct {
+    char name[64];
+    unsigned long gen;
+} qctag_t;
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} qcbuf_t;
+
+static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
+static qcentry_t* __buckets[QUERYCACHE_BUCKETS];
+static qcentry_t* __lru_head = NULL;
+static qcentry_t* __lru_tail = NULL;
+static size_t __bytes = 0;
+static qctag_t __tags[QUERYCACHE_TAGS_CAPACITY];
+static char* __redis = NULL;
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+
+static long long __now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void __init(void) {
+    const char* redis = env_get_string(QUERYCACHE_REDIS_ENV, NULL);
+    if (redis != NULL && redis[0] != 0)
+        __redis = strdup(redis);
+}
+
+static uint64_t __hash(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static int __buf_append(qcbuf_t* buf, const void* data, size_t size) {
+    if (buf->size + size > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 256;
+        while (capacity < buf->size + size)
+            capacity *= 2;
+
+        char* tmp = realloc(buf->data, capacity);
+        if (tmp == NULL) return 0;
+
+        buf->data = tmp;
+        buf->capacity = capacity;
+    }
+
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+
+    return 1;
+}
+
+static int __buf_append_u32(qcbuf_t* buf, uint32_t value) {
+    return __buf_append(buf, &value, sizeof(value));
+}
+
+static int __key_create(qcbuf_t* key, const char* dbid, const char* sql, array_t* params) {
+    if (!__buf_append(key, dbid, strlen(dbid) + 1)) return 0;
+    if (!__buf_append(key, sql, strlen(sql) + 1)) return 0;
+
+    if (params == NULL) return 1;
+
+    for (size_t i = 0; i < array_size(params); i++) {
+        mfield_t* field = (mfield_t*)array_get(params, i);
+        if (field == NULL || field->name == NULL) continue;
+
+        if (!__buf_append(key, field->name, strlen(field->name) + 1)) return 0;
+
+        // A type tag and a length prefix, so no string can look like NULL or like two values
+        str_t* value = model_field_to_string(field);
+        if (value == NULL) {
+            if (!__buf_append(key, "N", 1)) return 0;
+            continue;
+        }
+
+        const char* string = str_get(value);
+        const size_t length = strlen(string);
+        const int ok = __buf_append(key, "S", 1) && __buf_append_u32(key, length) && __buf_append(key, string, length);
+        str_free(value);
+
+        if (!ok) return 0;
+    }
+
+    return 1;
+}
+
+static int __tag_normalize(const char* table, char* name, size_t size) {
+    const char* start = strrchr(table, '.');
+    start = start != NULL ? start + 1 : table;
+
+    size_t length = 0;
+    for (const char* p = start; *p != 0 && length + 1 < size; p++) {
+        if (*p == '"' || *p == '`') continue;
+        name[length++] = *p;
+    }
+    name[length] = 0;
+
+    return length > 0;
+}
+
+// Must be called under __mutex
+static int __tag_slot(const char* name) {
+    const uint64_t hash = __hash(name, strlen(name));
+
+    for (int i = 0; i < QUERYCACHE_TAGS_CAPACITY; i++) {
+        const int slot = (hash + i) % QUERYCACHE_TAGS_CAPACITY;
+        qctag_t* tag = &__tags[slot];
+
+        if (tag->name[0] == 0) {
+            strcpy(tag->name, name);
+            tag->gen = 0;
+            return slot;
+        }
+
+        if (strcmp(tag->name, name) == 0)
+            return slot;
+    }
+
+    return -1;
+}
+
+static int __tags_snapshot(const char** tags, qctagref_t* refs) {
+    int count = 0;
+    char name[sizeof(__tags[0].name)];
+
+    pthread_mutex_lock(&__mutex);
+
+    for (; tags != NULL && tags[count] != NULL; count++) {
+        if (count == QUERYCACHE_MAX_TAGS || !__tag_normalize(tags[count], name, sizeof(name))) {
+            count = -1;
+            break;
+        }
+
+        refs[count].slot = __tag_slot(name);
+        if (refs[count].slot < 0) {
+            count = -1;
+            break;
+        }
+
+        refs[count].gen = __tags[refs[count].slot].gen;
+    }
+
+    pthread_mutex_unlock(&__mutex);
+
+    return count;
+}
+
+static qcresult_t* __result_alloc(int rows, int cols, size_t strings_size) {
+    const size_t size = sizeof(qcresult_t)
+        + sizeof(char*) * cols
+        + sizeof(db_table_cell_t) * rows * cols
+        + strings_size;
+
+    qcresult_t* result = malloc(size);
+    if (result == NULL) return NULL;
+
+    atomic_init(&result->refs, 1);
+    result->rows = rows;
+    result->cols = cols;
+    result->size = size;
+    result->names = (char**)(result + 1);
+    result->cells = (db_table_cell_t*)(result->names + cols);
+
+    return result;
+}
+
+static char* __result_strings(qcresult_t* result) {
+    return (char*)(result->cells + result->rows * result->cols);
+}
+
+static qcresult_t* __result_from_dbresult(dbresult_t* dbresult) {
+    const int rows = dbresult_query_rows(dbresult);
+    const int cols = dbresult_query_cols(dbresult);
+
+    size_t strings_size = 0;
+    for (int col = 0; col < cols; col++)
+        strings_size += strlen(dbresult_col_name(dbresult, col)) + 1;
+
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            const db_table_cell_t* cell = dbresult_cell(dbresult, row, col);
+            if (cell != NULL && cell->value != NULL)
+                strings_size += cell->length + 1;
+        }
+    }
+
+    qcresult_t* result = __result_alloc(rows, cols, strings_size);
+    if (result == NULL) return NULL;
+
+    char* data = __result_strings(result);
+    for (int col = 0; col < cols; col++) {
+        const char* name = dbresult_col_name(dbresult, col);
+        const size_t length = strlen(name) + 1;
+
+        memcpy(data, name, length);
+        result->names[col] = data;
+        data += length;
+    }
+
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            const db_table_cell_t* cell = dbresult_cell(dbresult, row, col);
+            db_table_cell_t* target = &result->cells[row * cols + col];
+
+            if (cell == NULL || cell->value == NULL) {
+                target->length = 0;
+                target->value = NULL;
+                continue;
+            }
+
+            memcpy(data, cell->value, cell->length);
+            data[cell->length] = 0;
+            target->length = cell->length;
+            target->value = data;
+            data += cell->length + 1;
+        }
+    }
+
+    return result;
+}
+
+static int __result_serialize(qcbuf_t* buf, qcresult_t* result) {
+    if (!__buf_append_u32(buf, result->rows)) return 0;
+    if (!__buf_append_u32(buf, result->cols)) return 0;
+
+    for (int col = 0; col < result->cols; col++) {
+        const size_t length = strlen(result->names[col]);
+        if (!__buf_append_u32(buf, length)) return 0;
+        if (!__buf_append(buf, result->names[col], length)) return 0;
+    }
+
+    for (int i = 0; i < result->rows * result->cols; i++) {
+        const db_table_cell_t* cell = &result->cells[i];
+        if (cell->value == NULL) {
+            if (!__buf_append_u32(buf, QUERYCACHE_NULL_CELL)) return 0;
+            continue;
+        }
+
+        if (!__buf_append_u32(buf, cell->length)) return 0;
+        if (!__buf_append(buf, cell->value, cell->length)) return 0;
+    }
+
+    return 1;
+}
+
+static int __read_u32(const char** data, const char* end, uint32_t* value) {
+    if (end - *data < (long)sizeof(*value)) return 0;
+
+    memcpy(value, *data, sizeof(*value));
+    *data += sizeof(*value);
+
+    return 1;
+}
+
+static qcresult_t* __result_deserialize(const char* data, const char* end) {
+    uint32_t rows = 0, cols = 0, length = 0;
+    if (!__read_u32(&data, end, &rows)) return NULL;
+    if (!__read_u32(&data, end, &cols)) return NULL;
+
+    const char* begin = data;
+    size_t strings_size = 0;
+    for (uint64_t i = 0; i < cols + (uint64_t)rows * cols; i++) {
+        if (!__read_u32(&data, end, &length)) return NULL;
+        if (length == QUERYCACHE_NULL_CELL && i >= cols) continue;
+        if ((size_t)(end - data) < length) return NULL;
+
+        data += length;
+        strings_size += length + 1;
+    }
+
+    qcresult_t* result = __result_alloc(rows, cols, strings_size);
+    if (result == NULL) return NULL;
+
+    char* strings = __result_strings(result);
+    data = begin;
+    for (uint64_t i = 0; i < cols + (uint64_t)rows * cols; i++) {
+        __read_u32(&data, end, &length);
+
+        char* value = NULL;
+        if (length != QUERYCACHE_NULL_CELL || i < cols) {
+            memcpy(strings, data, length);
+            strings[length] = 0;
+            value = strings;
+            strings += length + 1;
+            data += length;
+        }
+
+        if (i < cols) {
+            result->names[i] = value;
+            continue;
+        }
+
+        db_table_cell_t* cell = &result->cells[i - cols];
+        cell->value = value;
+        cell->length = value != NULL ? length : 0;
+    }
+
+    return result;
+}
+
+// Must be called under __mutex
+static void __lru_unlink(qcentry_t* entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else __lru_head = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+    else __lru_tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+// Must be called under __mutex
+static void __lru_push_front(qcentry_t* entry) {
+    entry->prev = NULL;
+    entry->next = __lru_head;
+
+    if (__lru_head) __lru_head->prev = entry;
+    __lru_head = entry;
+
+    if (__lru_tail == NULL) __lru_tail = entry;
+}
+
+// Must be called under __mutex
+static void __entry_remove(qcentry_t* entry) {
+    qcentry_t** link = &__buckets[entry->hash % QUERYCACHE_BUCKETS];
+    while (*link != NULL && *link != entry)
+        link = &(*link)->chain;
+
+    if (*link == entry)
+        *link = entry->chain;
+
+    __lru_unlink(entry);
+    __bytes -= entry->bytes;
+
+    qcresult_free(entry->result);
+    free(entry->key);
+    free(entry);
+}
+
+// Must be called under __mutex
+static int __entry_valid(qcentry_t* entry, long long now, const unsigned long long* gens) {
+    if (entry->expires_at <= now) return 0;
+
+    for (int i = 0; i < entry->tags_count; i++)
+        if (__tags[entry->tags[i].slot].gen != entry->tags[i].gen)
+            return 0;
+
+    if (gens == NULL) return 1;
+    if (!entry->shared) return 0;
+
+    return memcmp(entry->gens, gens, sizeof(*gens) * entry->tags_count) == 0;
+}
+
+static qcresult_t* __local_get(uint64_t hash, const qcbuf_t* key, const unsigned long long* gens) {
+    qcresult_t* result = NULL;
+
+    pthread_mutex_lock(&__mutex);
+
+    qcentry_t* entry = __buckets[hash % QUERYCACHE_BUCKETS];
+    for (; entry != NULL; entry = entry->chain)
+        if (entry->hash == hash && entry->key_size == key->size && memcmp(entry->key, key->data, key->size) == 0)
+            break;
+
+    if (entry != NULL) {
+        if (__entry_valid(entry, __now_ms(), gens)) {
+            __lru_unlink(entry);
+            __lru_push_front(entry);
+            atomic_fetch_add(&entry->result->refs, 1);
+            result = entry->result;
+        }
+        else {
+            __entry_remove(entry);
+        }
+    }
+
+    pthread_mutex_unlock(&__mutex);
+
+    return result;
+}
+
+static void __local_set(uint64_t hash, const qcbuf_t* key, qcresult_t* result, int ttl, const qctagref_t* tags, int tags_count, const unsigned long long* gens) {
+    const size_t bytes = sizeof(qcentry_t) + key->size + result->size;
+    if (bytes > QUERYCACHE_MAX_BYTES / 16) return;
+
+    qcentry_t* entry = malloc(sizeof * entry);
+    if (entry == NULL) return;
+
+    entry->key = malloc(key->size);
+    if (entry->key == NULL) {
+        free(entry);
+        return;
+    }
+
+    memcpy(entry->key, key->data, key->size);
+    entry->key_size = key->size;
+    entry->hash = hash;
+    entry->expires_at = __now_ms() + (long long)ttl * 1000;
+    entry->bytes = bytes;
+    entry->tags_count = tags_count;
+    memcpy(entry->tags, tags, sizeof(qctagref_t) * tags_count);
+    entry->shared = gens != NULL;
+    if (gens != NULL)
+        memcpy(entry->gens, gens, sizeof(*gens) * tags_count);
+    atomic_fetch_add(&result->refs, 1);
+    entry->result = result;
+
+    pthread_mutex_lock(&__mutex);
+
+    qcentry_t** link = &__buckets[hash % QUERYCACHE_BUCKETS];
+    for (qcentry_t* item = *link; item != NULL; item = item->chain) {
+        if (item->hash == hash && item->key_size == key->size && memcmp(item->key, key->data, key->size) == 0) {
+            __entry_remove(item);
+            break;
+        }
+    }
+
+    entry->chain = *link;
+    *link = entry;
+    __lru_push_front(entry);
+    __bytes += bytes;
+
+    while (__bytes > QUERYCACHE_MAX_BYTES && __lru_tail != NULL)
+        __entry_remove(__lru_tail);
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+/**
+ * @brief Reads a string value. Returns -1 if Redis failed, 0 for a missing key, 1 if found.
+ */
+static int __redis_get_value(const char* command, qcbuf_t* value) {
+    dbresult_t* result = dbquery(__redis, command, NULL);
+    int found = -1;
+
+    if (dbresult_ok(result)) {
+        found = 0;
+
+        const db_table_cell_t* field = dbresult_field(result, NULL);
+        if (field != NULL && field->value != NULL)
+            found = __buf_append(value, field->value, field->length) && __buf_append(value, "", 1) ? 1 : -1;
+    }
+
+    dbresult_free(result);
+
+    return found;
+}
+
+/**
+ * @brief Reads the shared generations of the tags. A missing tag has generation 0.
+ * With the redispipe_* keys of main.env all tags are read by one MGET, otherwise one GET per tag.
+ * @return 0 if Redis failed, then nothing cached may be trusted
+ */
+static int __redis_tag_gens(const char** tags, int tags_count, unsigned long long* gens) {
+    char names[QUERYCACHE_MAX_TAGS][sizeof(__tags[0].name) + sizeof(QUERYCACHE_REDIS_PREFIX) + 4];
+    int named[QUERYCACHE_MAX_TAGS];
+    int names_count = 0;
+
+    for (int i = 0; i < tags_count; i++) {
+        char name[sizeof(__tags[0].name)];
+        gens[i] = 0;
+        named[i] = -1;
+        if (!__tag_normalize(tags[i], name, sizeof(name))) continue;
+
+        snprintf(names[names_count], sizeof(names[0]), "%stag:%s", QUERYCACHE_REDIS_PREFIX, name);
+        named[i] = names_count++;
+    }
+
+    if (names_count == 0) return 1;
+
+    redisconn_t* conn = redisconn_default();
+    if (conn == NULL) {
+        for (int i = 0; i < tags_count; i++) {
+            if (named[i] < 0) continue;
+
+            char command[sizeof(names[0]) + 8];
+            snprintf(command, sizeof(command), "GET %s", names[named[i]]);
+
+            qcbuf_t value = {0};
+            const int found = __redis_get_value(command, &value);
+            if (found == 1)
+                gens[i] = strtoull(value.data, NULL, 10);
+
+            free(value.data);
+
+            if (found < 0) return 0;
+        }
+
+        return 1;
+    }
+
+    const char* argv[QUERYCACHE_MAX_TAGS + 1] = {"MGET"};
+    size_t argvlen[QUERYCACHE_MAX_TAGS + 1] = {4};
+    for (int i = 0; i < names_count; i++) {
+        argv[i + 1] = names[i];
+        argvlen[i + 1] = strlen(names[i]);
+    }
+
+    int result = 0;
+
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) return 0;
+
+    if (!redispipe_commandv(pipe, names_count + 1, argv, argvlen)) goto failed;
+
+    if (!redispipe_exec(conn, pipe)) {
+        log_error("querycache: %s\n", redispipe_error(pipe));
+        goto failed;
+    }
+
+    const redisreply_t* reply = redispipe_reply(pipe, 0);
+    if (reply == NULL || reply->type != REDISREPLY_ARRAY || reply->elements != (size_t)names_count) goto failed;
+
+    for (int i = 0; i < tags_count; i++) {
+        if (named[i] < 0) continue;
+
+        const redisreply_t* value = &reply->element[named[i]];
+        if (value->type == REDISREPLY_STRING)
+            gens[i] = strtoull(value->str, NULL, 10);
+    }
+
+    result = 1;
+
+    failed:
+
+    redispipe_free(pipe);
+
+    return result;
+}
+
+/**
+ * @brief Bumps the shared generation on the server that __redis_tag_gens reads.
+ */
+static int __redis_tag_bump(const char* name) {
+    char key[sizeof(__tags[0].name) + sizeof(QUERYCACHE_REDIS_PREFIX) + 4];
+    snprintf(key, sizeof(key), "%stag:%s", QUERYCACHE_REDIS_PREFIX, name);
+
+    redisconn_t* conn = redisconn_default();
+    if (conn == NULL) {
+        char command[sizeof(key) + 8];
+        snprintf(command, sizeof(command), "INCR %s", key);
+
+        dbresult_t* result = dbquery(__redis, command, NULL);
+        const int ok = dbresult_ok(result);
+        dbresult_free(result);
+
+        return ok;
+    }
+
+    const char* argv[] = {"INCR", key};
+    const size_t argvlen[] = {4, strlen(key)};
+
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) return 0;
+
+    int ok = redispipe_commandv(pipe, 2, argv, argvlen) && redispipe_exec(conn, pipe);
+    const redisreply_t* reply = ok ? redispipe_reply(pipe, 0) : NULL;
+    ok = reply != NULL && reply->type == REDISREPLY_INTEGER;
+
+    redispipe_free(pipe);
+
+    return ok;
+}
+
+static qcresult_t* __redis_get(uint64_t hash, const qcbuf_t* key, const unsigned long long* gens, int tags_count) {
+    char command[64];
+    snprintf(command, sizeof(command), "GET %s%016llx", QUERYCACHE_REDIS_PREFIX, (unsigned long long)hash);
+
+    qcbuf_t encoded = {0};
+    if (__redis_get_value(command, &encoded) != 1) {
+        free(encoded.data);
+        return NULL;
+    }
+
+    qcresult_t* result = NULL;
+    char* decoded = malloc(base64_decode_len(encoded.data));
+    if (decoded == NULL) goto failed;
+
+    const int size = base64_decode(decoded, encoded.data);
+    const char* data = decoded;
+    const char* end = decoded + size;
+
+    uint32_t length = 0;
+    if (!__read_u32(&data, end, &length)) goto failed;
+    if (length != key->size || (size_t)(end - data) < length) goto failed;
+    if (memcmp(data, key->data, length) != 0) goto failed;
+    data += length;
+
+    if (!__read_u32(&data, end, &length)) goto failed;
+    if ((int)length != tags_count) goto failed;
+    if ((size_t)(end - data) < sizeof(*gens) * tags_count) goto failed;
+    if (memcmp(data, gens, sizeof(*gens) * tags_count) != 0) goto failed;
+    data += sizeof(*gens) * tags_count;
+
+    result = __result_deserialize(data, end);
+
+    failed:
+
+    free(decoded);
+    free(encoded.data);
+
+    return result;
+}
+
+static void __redis_set(uint64_t hash, const qcbuf_t* key, const unsigned long long* gens, int tags_count, qcresult_t* result, int ttl) {
+    qcbuf_t buf = {0};
+    char* command = NULL;
+
+    if (!__buf_append_u32(&buf, key->size)) goto failed;
+    if (!__buf_append(&buf, key->data, key->size)) goto failed;
+    if (!__buf_append_u32(&buf, tags_count)) goto failed;
+    if (!__buf_append(&buf, gens, sizeof(*gens) * tags_count)) goto failed;
+    if (!__result_serialize(&buf, result)) goto failed;
+
+    const size_t command_size = base64_encode_len(buf.size) + 64;
+    command = malloc(command_size);
+    if (command == NULL) goto failed;
+
+    int length = snprintf(command, command_size, "SET %s%016llx ", QUERYCACHE_REDIS_PREFIX, (unsigned long long)hash);
+    length += base64_encode(command + length, buf.data, buf.size);
+    snprintf(command + length, command_size - length, " EX %d", ttl);
+
+    dbresult_free(dbquery(__redis, command, NULL));
+
+    failed:
+
+    free(command);
+    free(buf.data);
+}
+
+qcresult_t* querycache_query(const char* dbid, const char* sql, array_t* params, int ttl, const char** tags) {
+    if (dbid == NULL || sql == NULL) return NULL;
+
+    pthread_once(&__once, __init);
+
+    qcresult_t* result = NULL;
+    qcbuf_t key = {0};
+    if (!__key_create(&key, dbid, sql, params)) goto failed;
+
+    const uint64_t hash = __hash(key.data, key.size);
+
+    // Generations are captured before the query runs, so an invalidation
+    // that races with it makes the stored entry stale instead of wrong.
+    qctagref_t refs[QUERYCACHE_MAX_TAGS];
+    const int tags_count = __tags_snapshot(tags, refs);
+    int cacheable = ttl > 0 && tags_count >= 0;
+
+    // With Redis, other nodes invalidate through the shared generations,
+    // so the local level is checked against them as well
+    unsigned long long gens[QUERYCACHE_MAX_TAGS];
+    const int redis = __redis != NULL;
+    if (cacheable && redis && !__redis_tag_gens(tags, tags_count, gens))
+        cacheable = 0;
+
+    if (cacheable) {
+        result = __local_get(hash, &key, redis ? gens : NULL);
+        if (result != NULL) goto failed;
+    }
+
+    if (cacheable && redis) {
+        result = __redis_get(hash, &key, gens, tags_count);
+        if (result != NULL) {
+            __local_set(hash, &key, result, ttl, refs, tags_count, gens);
+            goto failed;
+        }
+    }
+
+    dbresult_t* dbresult = dbquery(dbid, sql, params);
+    if (!dbresult_ok(dbresult)) {
+        dbresult_free(dbresult);
+        goto failed;
+    }
+
+    result = __result_from_dbresult(dbresult);
+    dbresult_free(dbresult);
+
+    if (result == NULL || !cacheable) goto failed;
+
+    __local_set(hash, &key, result, ttl, refs, tags_count, redis ? gens : NULL);
+
+    if (redis)
+        __redis_set(hash, &key, gens, tags_count, result, ttl);
+
+    failed:
+
+    free(key.data);
+
+    return result;
+}
+
+static int __field_set(mfield_t* field, mtype_e type, const db_table_cell_t* cell) {
+    switch (type) {
+    case MODEL_BOOL: return model_set_bool_from_str(field, cell->value);
+    case MODEL_SMALLINT: return model_set_smallint_from_str(field, cell->value);
+    case MODEL_INT: return model_set_int_from_str(field, cell->value);
+    case MODEL_BIGINT: return model_set_bigint_from_str(field, cell->value);
+    case MODEL_FLOAT: return model_set_float_from_str(field, cell->value);
+    case MODEL_DOUBLE: return model_set_double_from_str(field, cell->value);
+    case MODEL_DECIMAL: return model_set_decimal_from_str(field, cell->value);
+    case MODEL_MONEY: return model_set_money_from_str(field, cell->value);
+    case MODEL_DATE: return model_set_date_from_str(field, cell->value);
+    case MODEL_TIME: return model_set_time_from_str(field, cell->value);
+    case MODEL_TIMETZ: return model_set_timetz_from_str(field, cell->value);
+    case MODEL_TIMESTAMP: return model_set_timestamp_from_str(field, cell->value);
+    case MODEL_TIMESTAMPTZ: return model_set_timestamptz_from_str(field, cell->value);
+    case MODEL_JSON: return model_set_json_from_str(field, cell->value);
+    case MODEL_BINARY: return model_set_binary_from_str(field, cell->value, cell->length);
+    case MODEL_VARCHAR: return model_set_varchar_from_str(field, cell->value, cell->length);
+    case MODEL_CHAR: return model_set_char_from_str(field, cell->value, cell->length);
+    case MODEL_TEXT: return model_set_text_from_str(field, cell->value, cell->length);
+    case MODEL_ENUM: return model_set_enum_from_str(field, cell->value, cell->length);
+    case MODEL_ARRAY: return model_set_array_from_str(field, cell->value);
+    }
+
+    return 0;
+}
+
+static void* __model_create(void*(*instance)(void), const mschema_t* schema, qcresult_t* result, int row) {
+    model_t* record = instance();
+    if (record == NULL) return NULL;
+
+    for (int i = 0; i < schema->columns_count; i++) {
+        const db_table_cell_t* cell = qcresult_field(result, row, schema->columns[i].name);
+        if (cell == NULL || cell->value == NULL) continue;
+
+        if (!__field_set(model_field(record, i), schema->columns[i].type, cell)) {
+            model_free(record);
+            return NULL;
+        }
+    }
+
+    return record;
+}
+
+void* querycache_model_one(const char* dbid, void*(*instance)(void), const mschema_t* schema, const char* sql, array_t* params, int ttl, const char** tags) {
+    qcresult_t* result = querycache_query(dbid, sql, params, ttl, tags);
+    if (result == NULL) return NULL;
+
+    void* model = NULL;
+    if (qcresult_rows(result) > 0)
+        model = __model_create(instance, schema, result, 0);
+
+    qcresult_free(result);
+
+    return model;
+}
+
+array_t* querycache_model_list(const char* dbid, void*(*instance)(void), const mschema_t* schema, const char* sql, array_t* params, int ttl, const char** tags) {
+    qcresult_t* result = querycache_query(dbid, sql, params, ttl, tags);
+    if (result == NULL) return NULL;
+
+    array_t* list = array_create();
+    if (list == NULL) goto failed;
+
+    for (int row = 0; row < qcresult_rows(result); row++) {
+        void* model = __model_create(instance, schema, result, row);
+        if (model == NULL) {
+            array_free(list);
+            list = NULL;
+            goto failed;
+        }
+
+        array_push_back(list, array_create_pointer(model, array_nocopy, model_free));
+    }
+
+    failed:
+
+    qcresult_free(result);
+
+    return list;
+}
+
+void querycache_invalidate(const char* table) {
+    if (table == NULL) return;
+
+    pthread_once(&__once, __init);
+
+    char name[sizeof(__tags[0].name)];
+    if (!__tag_normalize(table, name, sizeof(name))) return;
+
+    pthread_mutex_lock(&__mutex);
+    const int slot = __tag_slot(name);
+    if (slot >= 0)
+        __tags[slot].gen++;
+    pthread_mutex_unlock(&__mutex);
+
+    if (__redis == NULL) return;
+
+    if (!__redis_tag_bump(name))
+        log_error("querycache_invalidate: can't bump tag %s in redis\n", name);
+}
+
+void querycache_use_redis(const char* dbid) {
+    pthread_once(&__once, __init);
+
+    // The previous name is not freed, a running query may still hold it
+    __redis = dbid != NULL ? strdup(dbid) : NULL;
+}
+
+void querycache_clear(void) {
+    pthread_mutex_lock(&__mutex);
+
+    while (__lru_tail != NULL)
+        __entry_remove(__lru_tail);
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+int qcresult_rows(qcresult_t* result) {
+    return result != NULL ? result->rows : 0;
+}
+
+int qcresult_cols(qcresult_t* result) {
+    return result != NULL ? result->cols : 0;
+}
+
+const char* qcresult_col_name(qcresult_t* result, int col) {
+    if (result == NULL || col < 0 || col >= result->cols) return NULL;
+
+    return result->names[col];
+}
+
+const db_table_cell_t* qcresult_cell(qcresult_t* result, int row, int col) {
+    if (result == NULL) return NULL;
+    if (row < 0 || row >= result->rows) return NULL;
+    if (col < 0 || col >= result->cols) return NULL;
+
+    return &result->cells[row * result->cols + col];
+}
+
+const db_table_cell_t* qcresult_field(qcresult_t* result, int row, const char* name) {
+    if (result == NULL || name == NULL) return NULL;
+
+    for (int col = 0; col < result->cols; col++)
+        if (strcmp(result->names[col], name) == 0)
+            return qcresult_cell(result, row, col);
+
+    return NULL;
+}
+
+void qcresult_free(qcresult_t* result) {
+    if (result == NULL) return;
+
+    if (atomic_fetch_sub(&result->refs, 1) == 1)
+        free(result);
+}
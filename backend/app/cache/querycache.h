@@ -0,0 +1,76 @@
+#ifndef __QUERYCACHE__
+#define __QUERYCACHE__
+
+#include "db.h"
+
+#define QUERYCACHE_MAX_BYTES (32 * 1024 * 1024)
+#define QUERYCACHE_BUCKETS 4096
+#define QUERYCACHE_MAX_TAGS 8
+#define QUERYCACHE_TAGS_CAPACITY 256
+#define QUERYCACHE_REDIS_PREFIX "qc:"
+// Key of main.env with the Redis dbid of the shared level, e.g. "redis.r1"
+#define QUERYCACHE_REDIS_ENV "querycache_redis"
+
+// Builds a NULL-terminated list of table tags, e.g. cache_tags("role", "user_role")
+#define cache_tags(...) (const char*[]){__VA_ARGS__, NULL}
+
+typedef struct qcresult qcresult_t;
+
+/**
+ * Runs a read query through the cache.
+ * The key is (dbid, sql, bound params). On a miss the query is executed with dbquery,
+ * the first result set is snapshotted and stored for ttl seconds under the given table tags.
+ * Failed queries are never cached.
+ * @param dbid    Database identifier, e.g. "postgresql.p1"
+ * @param sql     Query text
+ * @param params  Bound parameters or NULL
+ * @param ttl     Lifetime of the entry in seconds
+ * @param tags    NULL-terminated list of tables the query reads (see cache_tags)
+ * @return Immutable result, release with qcresult_free. NULL on query error.
+ */
+qcresult_t* querycache_query(const char* dbid, const char* sql, array_t* params, int ttl, const char** tags);
+
+/**
+ * Same as model_one, but served from the cache.
+ * Columns are matched to the schema by name.
+ * @return Model instance owned by the caller or NULL if not found / on error.
+ */
+void* querycache_model_one(const char* dbid, void*(*instance)(void), const mschema_t* schema, const char* sql, array_t* params, int ttl, const char** tags);
+
+/**
+ * Same as model_list, but served from the cache.
+ * @return Array of model instances owned by the caller or NULL on error.
+ */
+array_t* querycache_model_list(const char* dbid, void*(*instance)(void), const mschema_t* schema, const char* sql, array_t* params, int ttl, const char** tags);
+
+/**
+ * Drops every cached entry tagged with the table, on every node when Redis is enabled.
+ * Called by model wrappers after create/update/delete.
+ * Quotes and schema prefix are ignored: "\"user\"", "public.user" and "user" are the same tag.
+ * @param table  Table name
+ */
+void querycache_invalidate(const char* table);
+
+/**
+ * Enables the shared second level in Redis, e.g. querycache_use_redis("redis.r1").
+ * By default it is read from main.env.querycache_redis; call this only at startup.
+ * With Redis every hit, local ones included, is checked against the tag generations
+ * in Redis, so an invalidation on one node is seen by all. The generations of a query
+ * are read by one MGET through the redispipe_* connection of main.env when it is set,
+ * and by one GET per tag through the dbid otherwise. If Redis fails, queries
+ * go to the database uncached.
+ * Pass NULL to keep the cache in-process only, for a single node.
+ * @param dbid  Redis dbid
+ */
+void querycache_use_redis(const char* dbid);
+
+void querycache_clear(void);
+
+int qcresult_rows(qcresult_t* result);
+int qcresult_cols(qcresult_t* result);
+const char* qcresult_col_name(qcresult_t* result, int col);
+const db_table_cell_t* qcresult_cell(qcresult_t* result, int row, int col);
+const db_table_cell_t* qcresult_field(qcresult_t* result, int row, const char* name);
+void qcresult_free(qcresult_t* result);
+
+#endif
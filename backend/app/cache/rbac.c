@@ -0,0 +1,567 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "log.h"
+#include "db.h"
+#include "appconfig.h"
+#include "rbac.h"
+#include "principalcache.h"
+
+typedef struct rbac_permission_entry {
+    struct rbac_permission_entry* name_next;
+    struct rbac_permission_entry* id_next;
+    // Value of permission.id, 0 when the permission no longer exists
+    int id;
+    int index;
+    char name[];
+} rbac_permission_entry_t;
+
+typedef struct rbac_role {
+    struct rbac_role* next;
+    int id;
+    rbac_bitset_t permissions;
+} rbac_role_t;
+
+typedef struct rbac_changes {
+    int* roles;
+    size_t count;
+    size_t capacity;
+    int all;
+} rbac_changes_t;
+
+static const char* __dbid = "postgresql";
+
+static rbac_permission_entry_t* __names[RBAC_BUCKETS];
+static rbac_permission_entry_t* __ids[RBAC_BUCKETS];
+static rbac_permission_entry_t** __interned = NULL;
+static int __interned_count = 0;
+static int __interned_capacity = 0;
+static rbac_role_t* __roles[RBAC_BUCKETS];
+static pthread_rwlock_t __lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t __refresh_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+static char* __redis = NULL;
+// Monotonic milliseconds of the last load, 0 until the first successful one
+static atomic_llong __loaded_at = 0;
+// Monotonic milliseconds of the last check for changes
+static atomic_llong __checked_at = 0;
+// Shared version the tables were loaded at, -1 if unknown
+static atomic_llong __version = -1;
+// Set by rbac_invalidate in this process, the next check waits for the reload
+static atomic_int __stale = 0;
+// Monotonic milliseconds of the last failed load, 0 if the last load succeeded
+static atomic_llong __failed_at = 0;
+// Shared principals version the cached principals are current at, -1 if unknown
+static atomic_llong __principals = -1;
+
+static void __init(void);
+static long long __now(void);
+static void __ensure_loaded(void);
+static int __refresh(void);
+static long long __version_get(const char* key);
+static void __principals_check(void);
+static int __result_ok(dbresult_t* result);
+static int __cell_int(dbresult_t* result, int row, int col);
+static unsigned int __hash(const char* name);
+static rbac_permission_entry_t* __find_name(const char* name);
+static rbac_permission_entry_t* __find_id(int id);
+static rbac_permission_entry_t* __intern(const char* name);
+static void __rebuild_ids(void);
+static int __bitset_set(rbac_bitset_t* bitset, int index);
+static int __bitset_equal(const rbac_bitset_t* a, const rbac_bitset_t* b);
+static rbac_role_t* __role(rbac_role_t** buckets, int role_id, int create);
+static void __roles_free(rbac_role_t** buckets);
+static void __roles_diff(rbac_role_t** from, rbac_role_t** to, rbac_changes_t* changes);
+static void __changes_add(rbac_changes_t* changes, int role_id);
+static void __changes_apply(rbac_changes_t* changes);
+
+int rbac_permission(const char* name) {
+    if (name == NULL) return -1;
+
+    __ensure_loaded();
+
+    pthread_rwlock_rdlock(&__lock);
+
+    rbac_permission_entry_t* entry = __find_name(name);
+    const int index = entry != NULL && entry->id != 0 ? entry->index : -1;
+
+    pthread_rwlock_unlock(&__lock);
+
+    return index;
+}
+
+int rbac_role_permissions(int role_id, rbac_bitset_t* bitset) {
+    __ensure_loaded();
+
+    int result = 1;
+
+    pthread_rwlock_rdlock(&__lock);
+
+    rbac_role_t* role = __role(__roles, role_id, 0);
+    if (role != NULL && role->permissions.words > bitset->words) {
+        uint64_t* bits = realloc(bitset->bits, role->permissions.words * sizeof * bits);
+        if (bits == NULL) {
+            result = 0;
+            goto done;
+        }
+
+        memset(bits + bitset->words, 0, (role->permissions.words - bitset->words) * sizeof * bits);
+        bitset->bits = bits;
+        bitset->words = role->permissions.words;
+    }
+
+    if (role != NULL)
+        for (size_t i = 0; i < role->permissions.words; i++)
+            bitset->bits[i] |= role->permissions.bits[i];
+
+    done:
+
+    pthread_rwlock_unlock(&__lock);
+
+    return result;
+}
+
+int rbac_bitset_has(const rbac_bitset_t* bitset, int permission) {
+    if (bitset == NULL || permission < 0 || (size_t)permission / 64 >= bitset->words)
+        return 0;
+
+    return (bitset->bits[permission / 64] >> (permission % 64)) & 1;
+}
+
+void rbac_bitset_free(rbac_bitset_t* bitset) {
+    if (bitset == NULL) return;
+
+    free(bitset->bits);
+    bitset->bits = NULL;
+    bitset->words = 0;
+}
+
+void rbac_invalidate(void) {
+    pthread_once(&__once, __init);
+
+    atomic_store(&__stale, 1);
+
+    if (__redis == NULL) return;
+
+    dbresult_t* result = dbquery(__redis, "INCR " RBAC_REDIS_VERSION_KEY, NULL);
+    if (!dbresult_ok(result))
+        log_error("rbac: can't bump the shared version\n");
+
+    dbresult_free(result);
+}
+
+void rbac_invalidate_user(int user_id) {
+    pthread_once(&__once, __init);
+
+    if (user_id > 0)
+        principalcache_invalidate(user_id);
+    else
+        principalcache_invalidate_all();
+
+    if (__redis == NULL) return;
+
+    dbresult_t* result = dbquery(__redis, "INCR " RBAC_REDIS_PRINCIPALS_KEY, NULL);
+    if (!dbresult_ok(result)) {
+        log_error("rbac: can't bump the shared principals version\n");
+        dbresult_free(result);
+        return;
+    }
+
+    // The own bump needs no drop here, unless another process bumped in between
+    const db_table_cell_t* field = dbresult_field(result, NULL);
+    if (field != NULL && field->value != NULL) {
+        const long long version = atoll(field->value);
+        long long expected = version - 1;
+        atomic_compare_exchange_strong(&__principals, &expected, version);
+    }
+
+    dbresult_free(result);
+}
+
+int rbac_refresh(void) {
+    pthread_once(&__once, __init);
+
+    pthread_mutex_lock(&__refresh_mutex);
+    const int result = __refresh();
+    pthread_mutex_unlock(&__refresh_mutex);
+
+    return result;
+}
+
+void __init(void) {
+    const char* redis = env_get_string(RBAC_REDIS_ENV, NULL);
+    if (redis != NULL && redis[0] != 0)
+        __redis = strdup(redis);
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Loads the tables on first use and after changes.
+ * The first load and a reload after a change in this process are awaited by every caller.
+ * Changes of other processes are found by the shared version, read by one thread at a time
+ * every RBAC_VERSION_INTERVAL, or without Redis by a reload every RBAC_RELOAD_INTERVAL seconds.
+ * The other threads keep reading the current tables meanwhile.
+ * After a failed load the current tables, or none, are used for RBAC_RETRY_INTERVAL.
+ */
+void __ensure_loaded(void) {
+    pthread_once(&__once, __init);
+
+    if (atomic_load(&__loaded_at) == 0 || atomic_load(&__stale)) {
+        if (__now() - atomic_load(&__failed_at) < RBAC_RETRY_INTERVAL) return;
+
+        pthread_mutex_lock(&__refresh_mutex);
+        if ((atomic_load(&__loaded_at) == 0 || atomic_load(&__stale)) && __now() - atomic_load(&__failed_at) >= RBAC_RETRY_INTERVAL)
+            __refresh();
+        pthread_mutex_unlock(&__refresh_mutex);
+        return;
+    }
+
+    const long long interval = __redis != NULL ? RBAC_VERSION_INTERVAL : RBAC_RELOAD_INTERVAL * 1000LL;
+    if (__now() - atomic_load(&__checked_at) < interval) return;
+
+    if (pthread_mutex_trylock(&__refresh_mutex) != 0) return;
+
+    if (__now() - atomic_load(&__checked_at) >= interval) {
+        atomic_store(&__checked_at, __now());
+
+        if (__redis == NULL)
+            __refresh();
+        else {
+            __principals_check();
+
+            const long long version = __version_get(RBAC_REDIS_VERSION_KEY);
+            // Without an answer from Redis the tables are only reloaded by age
+            if (version >= 0 ? version != atomic_load(&__version) : __now() - atomic_load(&__loaded_at) >= RBAC_RELOAD_INTERVAL * 1000LL)
+                __refresh();
+        }
+    }
+
+    pthread_mutex_unlock(&__refresh_mutex);
+}
+
+/**
+ * @brief Reads both tables outside the lock, then swaps the role bitsets in.
+ * Called with __refresh_mutex held.
+ */
+int __refresh(void) {
+    rbac_role_t* roles[RBAC_BUCKETS] = {0};
+    rbac_changes_t changes = {0};
+    int result = 0;
+
+    // Both are taken before the tables are read: a change committed meanwhile
+    // bumps the version or sets the flag again, and the next check reloads
+    atomic_store(&__stale, 0);
+    const long long version = __redis != NULL ? __version_get(RBAC_REDIS_VERSION_KEY) : -1;
+    if (__redis != NULL && atomic_load(&__principals) < 0)
+        __principals_check();
+
+    dbresult_t* permissions = dbquery(__dbid, "SELECT id, name FROM permission", NULL);
+    dbresult_t* grants = NULL;
+    if (!__result_ok(permissions)) goto failed;
+
+    grants = dbquery(__dbid, "SELECT role_id, permission_id FROM role_permission", NULL);
+    if (!__result_ok(grants)) goto failed;
+
+    pthread_rwlock_wrlock(&__lock);
+
+    for (int i = 0; i < __interned_count; i++)
+        __interned[i]->id = 0;
+
+    for (int row = 0; row < dbresult_query_rows(permissions); row++) {
+        const db_table_cell_t* name = dbresult_cell(permissions, row, 1);
+        if (name == NULL || name->value == NULL) continue;
+
+        rbac_permission_entry_t* entry = __find_name(name->value);
+        if (entry == NULL)
+            entry = __intern(name->value);
+        if (entry != NULL)
+            entry->id = __cell_int(permissions, row, 0);
+    }
+
+    __rebuild_ids();
+
+    for (int row = 0; row < dbresult_query_rows(grants); row++) {
+        rbac_permission_entry_t* permission = __find_id(__cell_int(grants, row, 1));
+        if (permission == NULL) continue;
+
+        rbac_role_t* role = __role(roles, __cell_int(grants, row, 0), 1);
+        if (role == NULL || !__bitset_set(&role->permissions, permission->index)) {
+            pthread_rwlock_unlock(&__lock);
+            log_error("rbac: out of memory\n");
+            __roles_free(roles);
+            goto failed;
+        }
+    }
+
+    // Only a load that replaces earlier tables can make cached principals stale
+    if (atomic_load(&__loaded_at) != 0) {
+        __roles_diff(__roles, roles, &changes);
+        __roles_diff(roles, __roles, &changes);
+    }
+
+    __roles_free(__roles);
+    memcpy(__roles, roles, sizeof(__roles));
+
+    pthread_rwlock_unlock(&__lock);
+
+    atomic_store(&__version, version);
+    atomic_store(&__failed_at, 0);
+    atomic_store(&__loaded_at, __now());
+    atomic_store(&__checked_at, __now());
+    result = 1;
+
+    failed:
+
+    if (!result) {
+        atomic_store(&__stale, 1);
+        atomic_store(&__failed_at, __now());
+    }
+
+    if (permissions != NULL) dbresult_free(permissions);
+    if (grants != NULL) dbresult_free(grants);
+
+    __changes_apply(&changes);
+
+    return result;
+}
+
+/**
+ * @return Shared version, 0 if it was never bumped, -1 if Redis failed
+ */
+long long __version_get(const char* key) {
+    char command[64];
+    snprintf(command, sizeof(command), "GET %s", key);
+
+    dbresult_t* result = dbquery(__redis, command, NULL);
+    long long version = -1;
+
+    if (dbresult_ok(result)) {
+        const db_table_cell_t* field = dbresult_field(result, NULL);
+        version = field != NULL && field->value != NULL ? atoll(field->value) : 0;
+    }
+
+    dbresult_free(result);
+
+    return version;
+}
+
+/**
+ * @brief Drops every cached principal when another process changed user roles.
+ * Called with __refresh_mutex held.
+ */
+void __principals_check(void) {
+    const long long version = __version_get(RBAC_REDIS_PRINCIPALS_KEY);
+    if (version < 0) return;
+
+    const long long known = atomic_exchange(&__principals, version);
+    if (known >= 0 && known != version)
+        principalcache_invalidate_all();
+}
+
+int __result_ok(dbresult_t* result) {
+    if (result != NULL && dbresult_ok(result)) return 1;
+
+    log_error("rbac: %s\n", result ? dbresult_error(result) : "out of memory");
+
+    return 0;
+}
+
+int __cell_int(dbresult_t* result, int row, int col) {
+    const db_table_cell_t* cell = dbresult_cell(result, row, col);
+    if (cell == NULL || cell->value == NULL) return 0;
+
+    return atoi(cell->value);
+}
+
+unsigned int __hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+
+    return hash % RBAC_BUCKETS;
+}
+
+rbac_permission_entry_t* __find_name(const char* name) {
+    for (rbac_permission_entry_t* entry = __names[__hash(name)]; entry; entry = entry->name_next)
+        if (strcmp(entry->name, name) == 0)
+            return entry;
+
+    return NULL;
+}
+
+rbac_permission_entry_t* __find_id(int id) {
+    if (id == 0) return NULL;
+
+    for (rbac_permission_entry_t* entry = __ids[(unsigned int)id % RBAC_BUCKETS]; entry; entry = entry->id_next)
+        if (entry->id == id)
+            return entry;
+
+    return NULL;
+}
+
+rbac_permission_entry_t* __intern(const char* name) {
+    if (__interned_count == __interned_capacity) {
+        const int capacity = __interned_capacity ? __interned_capacity * 2 : 64;
+        rbac_permission_entry_t** interned = realloc(__interned, capacity * sizeof * interned);
+        if (interned == NULL) {
+            log_error("rbac: out of memory\n");
+            return NULL;
+        }
+
+        __interned = interned;
+        __interned_capacity = capacity;
+    }
+
+    const size_t name_size = strlen(name) + 1;
+
+    rbac_permission_entry_t* entry = calloc(1, sizeof * entry + name_size);
+    if (entry == NULL) {
+        log_error("rbac: out of memory\n");
+        return NULL;
+    }
+
+    memcpy(entry->name, name, name_size);
+    entry->index = __interned_count;
+
+    rbac_permission_entry_t** bucket = &__names[__hash(name)];
+    entry->name_next = *bucket;
+    *bucket = entry;
+
+    __interned[__interned_count++] = entry;
+
+    return entry;
+}
+
+void __rebuild_ids(void) {
+    memset(__ids, 0, sizeof(__ids));
+
+    for (int i = 0; i < __interned_count; i++) {
+        rbac_permission_entry_t* entry = __interned[i];
+        entry->id_next = NULL;
+        if (entry->id == 0) continue;
+
+        rbac_permission_entry_t** bucket = &__ids[(unsigned int)entry->id % RBAC_BUCKETS];
+        entry->id_next = *bucket;
+        *bucket = entry;
+    }
+}
+
+int __bitset_set(rbac_bitset_t* bitset, int index) {
+    const size_t word = index / 64;
+    if (word >= bitset->words) {
+        uint64_t* bits = realloc(bitset->bits, (word + 1) * sizeof * bits);
+        if (bits == NULL) return 0;
+
+        memset(bits + bitset->words, 0, (word + 1 - bitset->words) * sizeof * bits);
+        bitset->bits = bits;
+        bitset->words = word + 1;
+    }
+
+    bitset->bits[word] |= 1ULL << (index % 64);
+
+    return 1;
+}
+
+/**
+ * @brief Compares the set bits, a shorter bitset has zeros in the missing words.
+ */
+int __bitset_equal(const rbac_bitset_t* a, const rbac_bitset_t* b) {
+    const size_t words = a->words > b->words ? a->words : b->words;
+    for (size_t i = 0; i < words; i++) {
+        const uint64_t x = i < a->words ? a->bits[i] : 0;
+        const uint64_t y = i < b->words ? b->bits[i] : 0;
+        if (x != y) return 0;
+    }
+
+    return 1;
+}
+
+rbac_role_t* __role(rbac_role_t** buckets, int role_id, int create) {
+    rbac_role_t** bucket = &buckets[(unsigned int)role_id % RBAC_BUCKETS];
+    for (rbac_role_t* role = *bucket; role; role = role->next)
+        if (role->id == role_id)
+            return role;
+
+    if (!create) return NULL;
+
+    rbac_role_t* role = calloc(1, sizeof * role);
+    if (role == NULL) return NULL;
+
+    role->id = role_id;
+    role->next = *bucket;
+    *bucket = role;
+
+    return role;
+}
+
+void __roles_free(rbac_role_t** buckets) {
+    for (int i = 0; i < RBAC_BUCKETS; i++) {
+        rbac_role_t* role = buckets[i];
+        while (role != NULL) {
+            rbac_role_t* next = role->next;
+            rbac_bitset_free(&role->permissions);
+            free(role);
+            role = next;
+        }
+
+        buckets[i] = NULL;
+    }
+}
+
+/**
+ * @brief Records roles of `from` whose permissions differ in `to` or that are missing there.
+ * Roles only present in `to` are found by the call with swapped arguments.
+ */
+void __roles_diff(rbac_role_t** from, rbac_role_t** to, rbac_changes_t* changes) {
+    for (int i = 0; i < RBAC_BUCKETS; i++)
+        for (rbac_role_t* role = from[i]; role; role = role->next) {
+            rbac_role_t* other = __role(to, role->id, 0);
+            if (other == NULL || !__bitset_equal(&role->permissions, &other->permissions))
+                __changes_add(changes, role->id);
+        }
+}
+
+void __changes_add(rbac_changes_t* changes, int role_id) {
+    if (changes->all) return;
+
+    for (size_t i = 0; i < changes->count; i++)
+        if (changes->roles[i] == role_id)
+            return;
+
+    if (changes->count == changes->capacity) {
+        const size_t capacity = changes->capacity ? changes->capacity * 2 : 16;
+        int* roles = realloc(changes->roles, capacity * sizeof * roles);
+        if (roles == NULL) {
+            // Dropping every principal is always correct
+            changes->all = 1;
+            return;
+        }
+
+        changes->roles = roles;
+        changes->capacity = capacity;
+    }
+
+    changes->roles[changes->count++] = role_id;
+}
+
+void __changes_apply(rbac_changes_t* changes) {
+    if (changes->all)
+        principalcache_invalidate_all();
+    else
+        for (size_t i = 0; i < changes->count; i++)
+            principalcache_invalidate_role(changes->roles[i]);
+
+    free(changes->roles);
+}
@@ -0,0 +1,72 @@
+#ifndef __RBAC__
+#define __RBAC__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned permission indexes run from 0 up, the table grows with the permissions
+#define RBAC_BUCKETS 256
+// Without a shared version, changes made by other processes are picked up after this many seconds
+#define RBAC_RELOAD_INTERVAL 60
+// Milliseconds between reads of the shared version
+#define RBAC_VERSION_INTERVAL 1000
+// Milliseconds before a failed load is retried, the current tables are used meanwhile
+#define RBAC_RETRY_INTERVAL 1000
+#define RBAC_REDIS_VERSION_KEY "rbac:version"
+// Bumped on changes of user_role, other processes drop their cached principals
+#define RBAC_REDIS_PRINCIPALS_KEY "rbac:principals"
+// Key of main.env with the Redis dbid of the shared version, e.g. "redis.r1"
+#define RBAC_REDIS_ENV "rbac_redis"
+
+// Bits beyond words * 64 are unset
+typedef struct rbac_bitset {
+    uint64_t* bits;
+    size_t words;
+} rbac_bitset_t;
+
+/**
+ * Resolves a permission name to its interned index.
+ * The index of a name never changes while the process runs.
+ * @param name  Value of permission.name, e.g. "posts.delete"
+ * @return Index for rbac_bitset_has, -1 if the permission does not exist
+ */
+int rbac_permission(const char* name);
+
+/**
+ * Adds the permissions granted to the role to the bitset, growing it as needed.
+ * @param role_id  Value of role.id
+ * @param bitset   Bitset to fill, zero-initialized or filled before, release with rbac_bitset_free
+ * @return 1 on success, 0 if memory ran out
+ */
+int rbac_role_permissions(int role_id, rbac_bitset_t* bitset);
+
+/**
+ * @param permission  Index returned by rbac_permission
+ * @return 1 if the bit is set, 0 otherwise
+ */
+int rbac_bitset_has(const rbac_bitset_t* bitset, int permission);
+void rbac_bitset_free(rbac_bitset_t* bitset);
+
+/**
+ * Marks the tables stale after a change of roles or permissions, called by the models.
+ * Bumps the shared version, so every process reloads on its next check:
+ * this one before the check, the others within RBAC_VERSION_INTERVAL.
+ * Only principals of roles whose permissions differ are dropped by the reload.
+ */
+void rbac_invalidate(void);
+
+/**
+ * Drops the cached principal after a change of the user's roles, called by the models.
+ * Bumps the shared principals version, so other processes drop all their principals
+ * within RBAC_VERSION_INTERVAL; without Redis they keep them up to PRINCIPALCACHE_TTL.
+ * @param user_id  Value of user.id, 0 if unknown: every principal of this process is dropped
+ */
+void rbac_invalidate_user(int user_id);
+
+/**
+ * Reloads roles and permissions from the database now.
+ * @return 1 on success, 0 on database error
+ */
+int rbac_refresh(void);
+
+#endif
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/random.h>
+
+#include "log.h"
+#include "db.h"
+#include "appconfig.h"
+#include "session.h"
+#include "sessioncache.h"
+#include "sessionexpiry.h"
+
+typedef struct sessioncache_entry {
+    struct sessioncache_entry* hash_next;
+    struct sessioncache_entry* prev;
+    struct sessioncache_entry* next;
+    uint64_t hash;
+    long long expires_at;
+    const char* key;
+    const char* session_id;
+    const char* data;
+    size_t data_size;
+    char token[SESSIONCACHE_TOKEN_SIZE];
+    char buffer[];
+} sessioncache_entry_t;
+
+typedef struct sessioncache_shard {
+    pthread_mutex_t mutex;
+    sessioncache_entry_t* buckets[SESSIONCACHE_SHARD_BUCKETS];
+    sessioncache_entry_t* head;
+    sessioncache_entry_t* tail;
+    size_t count;
+    uint64_t generation;
+} sessioncache_shard_t;
+
+static sessioncache_shard_t __shards[SESSIONCACHE_SHARDS];
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+static char* __redis = NULL;
+
+static atomic_ullong __hits = 0;
+static atomic_ullong __misses = 0;
+static atomic_ullong __evictions = 0;
+static atomic_ullong __invalidations = 0;
+static atomic_ullong __nonces = 0;
+
+static void __init(void);
+static int __id_valid(const char* session_id);
+static int __token_get(const char* session_id, char* token);
+static int __token_set(const char* session_id, long long expires, char* token);
+static void __token_delete(const char* session_id);
+static long __token_ttl(const char* token);
+static void __drop(const char* session_id);
+static long long __now(void);
+static uint64_t __hash(const char* session_id);
+static sessioncache_shard_t* __shard(uint64_t hash);
+static sessioncache_entry_t** __bucket(sessioncache_shard_t* shard, uint64_t hash);
+static sessioncache_entry_t* __find(sessioncache_shard_t* shard, uint64_t hash, const char* key, const char* session_id);
+static void __lru_unlink(sessioncache_shard_t* shard, sessioncache_entry_t* entry);
+static void __lru_push(sessioncache_shard_t* shard, sessioncache_entry_t* entry);
+static void __remove(sessioncache_shard_t* shard, sessioncache_entry_t* entry);
+static void __put(const char* key, const char* session_id, const char* data, const char* token, long ttl, const uint64_t* generation);
+
+char* sessioncache_get(const char* key, const char* session_id) {
+    if (key == NULL || session_id == NULL) return NULL;
+
+    pthread_once(&__once, __init);
+
+    if (__redis == NULL || !__id_valid(session_id))
+        return session_get(key, session_id);
+
+    // The token is read before the payload: a change that lands in between replaces it,
+    // and the entry stored below fails the check on its next hit
+    char token[SESSIONCACHE_TOKEN_SIZE];
+    const int found = __token_get(session_id, token);
+
+    const uint64_t hash = __hash(session_id);
+    sessioncache_shard_t* shard = __shard(hash);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    sessioncache_entry_t* entry = __find(shard, hash, key, session_id);
+    if (entry != NULL && found == 1 && entry->expires_at > __now() && strcmp(entry->token, token) == 0) {
+        char* data = malloc(entry->data_size + 1);
+        if (data != NULL)
+            memcpy(data, entry->data, entry->data_size + 1);
+
+        __lru_unlink(shard, entry);
+        __lru_push(shard, entry);
+        pthread_mutex_unlock(&shard->mutex);
+
+        atomic_fetch_add(&__hits, 1);
+
+        return data;
+    }
+
+    if (entry != NULL)
+        __remove(shard, entry);
+
+    // A destroy or update in this process that lands while the driver is read bumps the generation,
+    // the stale payload is then not stored
+    const uint64_t generation = shard->generation;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    atomic_fetch_add(&__misses, 1);
+
+    // Without a token, or when Redis does not answer, there is nothing to check a cached payload against
+    char* data = session_get(key, session_id);
+    if (data != NULL && found == 1)
+        __put(key, session_id, data, token, __token_ttl(token), &generation);
+
+    return data;
+}
+
+char* sessioncache_create(const char* key, const char* data, long duration) {
+    pthread_once(&__once, __init);
+
+    char* session_id = session_create(key, data, duration);
+    if (session_id == NULL) return NULL;
+
+    sessionexpiry_add(key, session_id, duration);
+
+    if (__redis == NULL || data == NULL || !__id_valid(session_id))
+        return session_id;
+
+    char token[SESSIONCACHE_TOKEN_SIZE];
+    if (__token_set(session_id, time(NULL) + duration, token))
+        __put(key, session_id, data, token, __token_ttl(token), NULL);
+
+    return session_id;
+}
+
+int sessioncache_update(const char* key, const char* session_id, const char* data) {
+    // The token is replaced after the driver has the new payload,
+    // so a node that reads the new token also reads the new payload
+    const int result = session_update(key, session_id, data);
+    sessioncache_invalidate(session_id);
+
+    return result;
+}
+
+int sessioncache_destroy(const char* key, const char* session_id) {
+    if (session_id == NULL) return session_destroy(key, session_id);
+
+    pthread_once(&__once, __init);
+
+    if (__redis != NULL && __id_valid(session_id))
+        __token_delete(session_id);
+
+    __drop(session_id);
+
+    return session_destroy(key, session_id);
+}
+
+void sessioncache_invalidate(const char* session_id) {
+    if (session_id == NULL) return;
+
+    pthread_once(&__once, __init);
+
+    char token[SESSIONCACHE_TOKEN_SIZE];
+    if (__redis != NULL && __id_valid(session_id) && __token_get(session_id, token) == 1)
+        if (!__token_set(session_id, strtoll(token, NULL, 10), NULL))
+            __token_delete(session_id);
+
+    __drop(session_id);
+}
+
+sessioncache_stats_t sessioncache_stats(void) {
+    pthread_once(&__once, __init);
+
+    sessioncache_stats_t stats = {
+        .hits = atomic_load(&__hits),
+        .misses = atomic_load(&__misses),
+        .evictions = atomic_load(&__evictions),
+        .invalidations = atomic_load(&__invalidations),
+        .entries = 0
+    };
+
+    for (int i = 0; i < SESSIONCACHE_SHARDS; i++) {
+        pthread_mutex_lock(&__shards[i].mutex);
+        stats.entries += __shards[i].count;
+        pthread_mutex_unlock(&__shards[i].mutex);
+    }
+
+    return stats;
+}
+
+void __init(void) {
+    for (int i = 0; i < SESSIONCACHE_SHARDS; i++)
+        pthread_mutex_init(&__shards[i].mutex, NULL);
+
+    const char* redis = env_get_string(SESSIONCACHE_REDIS_ENV, NULL);
+    if (redis != NULL && redis[0] != 0)
+        __redis = strdup(redis);
+}
+
+/**
+ * @brief Session identifiers go into Redis commands as is, only safe characters are accepted.
+ */
+int __id_valid(const char* session_id) {
+    size_t size = 0;
+    for (const char* p = session_id; *p; p++, size++) {
+        const char c = *p;
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '_'))
+            return 0;
+    }
+
+    return size > 0 && size < 128;
+}
+
+/**
+ * @brief Reads the token of the session, "<expiry in unix seconds>:<nonce>".
+ * @return -1 if Redis failed, 0 if the session has no token, 1 if found
+ */
+int __token_get(const char* session_id, char* token) {
+    char command[160];
+    snprintf(command, sizeof(command), "GET %s%s", SESSIONCACHE_REDIS_PREFIX, session_id);
+
+    dbresult_t* result = dbquery(__redis, command, NULL);
+    int found = -1;
+
+    if (dbresult_ok(result)) {
+        found = 0;
+
+        const db_table_cell_t* field = dbresult_field(result, NULL);
+        if (field != NULL && field->value != NULL && field->length < SESSIONCACHE_TOKEN_SIZE) {
+            memcpy(token, field->value, field->length);
+            token[field->length] = 0;
+            found = 1;
+        }
+    }
+
+    dbresult_free(result);
+
+    return found;
+}
+
+/**
+ * @brief Stores a new token with a fresh nonce, Redis drops it at the expiry.
+ * @return 1 on success, 0 if the session has expired or Redis failed
+ */
+int __token_set(const char* session_id, long long expires, char* token) {
+    const long long ttl = expires - time(NULL);
+    if (ttl <= 0) return 0;
+
+    unsigned long long nonce = 0;
+    if (getrandom(&nonce, sizeof(nonce), 0) != sizeof(nonce))
+        nonce = ((unsigned long long)time(NULL) << 32) ^ atomic_fetch_add(&__nonces, 1);
+
+    char value[SESSIONCACHE_TOKEN_SIZE];
+    snprintf(value, sizeof(value), "%lld:%016llx", expires, nonce);
+
+    char command[256];
+    snprintf(command, sizeof(command), "SET %s%s %s EX %lld", SESSIONCACHE_REDIS_PREFIX, session_id, value, ttl);
+
+    dbresult_t* result = dbquery(__redis, command, NULL);
+    const int ok = dbresult_ok(result);
+    if (!ok)
+        log_error("sessioncache: can't store token\n");
+
+    dbresult_free(result);
+
+    if (ok && token != NULL)
+        strcpy(token, value);
+
+    return ok;
+}
+
+void __token_delete(const char* session_id) {
+    char command[160];
+    snprintf(command, sizeof(command), "DEL %s%s", SESSIONCACHE_REDIS_PREFIX, session_id);
+
+    dbresult_t* result = dbquery(__redis, command, NULL);
+    if (!dbresult_ok(result))
+        log_error("sessioncache: can't delete token\n");
+
+    dbresult_free(result);
+}
+
+/**
+ * @brief SESSIONCACHE_TTL or the remaining lifetime of the session, whichever is shorter.
+ */
+long __token_ttl(const char* token) {
+    const long long remaining = strtoll(token, NULL, 10) - time(NULL);
+
+    return remaining < SESSIONCACHE_TTL ? (long)remaining : SESSIONCACHE_TTL;
+}
+
+/**
+ * @brief Drops the cached payloads of the session in this process, for every configuration.
+ */
+void __drop(const char* session_id) {
+    const uint64_t hash = __hash(session_id);
+    sessioncache_shard_t* shard = __shard(hash);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    shard->generation++;
+
+    sessioncache_entry_t* entry = *__bucket(shard, hash);
+    while (entry != NULL) {
+        sessioncache_entry_t* next = entry->hash_next;
+        if (entry->hash == hash && strcmp(entry->session_id, session_id) == 0) {
+            __remove(shard, entry);
+            atomic_fetch_add(&__invalidations, 1);
+        }
+        entry = next;
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+uint64_t __hash(const char* session_id) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char* p = (const unsigned char*)session_id; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+sessioncache_shard_t* __shard(uint64_t hash) {
+    return &__shards[hash % SESSIONCACHE_SHARDS];
+}
+
+sessioncache_entry_t** __bucket(sessioncache_shard_t* shard, uint64_t hash) {
+    return &shard->buckets[(hash / SESSIONCACHE_SHARDS) % SESSIONCACHE_SHARD_BUCKETS];
+}
+
+sessioncache_entry_t* __find(sessioncache_shard_t* shard, uint64_t hash, const char* key, const char* session_id) {
+    for (sessioncache_entry_t* entry = *__bucket(shard, hash); entry; entry = entry->hash_next)
+        if (entry->hash == hash && strcmp(entry->session_id, session_id) == 0 && strcmp(entry->key, key) == 0)
+            return entry;
+
+    return NULL;
+}
+
+void __lru_unlink(sessioncache_shard_t* shard, sessioncache_entry_t* entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else shard->head = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+    else shard->tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+void __lru_push(sessioncache_shard_t* shard, sessioncache_entry_t* entry) {
+    entry->prev = NULL;
+    entry->next = shard->head;
+
+    if (shard->head) shard->head->prev = entry;
+    else shard->tail = entry;
+
+    shard->head = entry;
+}
+
+void __remove(sessioncache_shard_t* shard, sessioncache_entry_t* entry) {
+    sessioncache_entry_t** link = __bucket(shard, entry->hash);
+    while (*link != entry)
+        link = &(*link)->hash_next;
+
+    *link = entry->hash_next;
+
+    __lru_unlink(shard, entry);
+    shard->count--;
+
+    free(entry);
+}
+
+void __put(const char* key, const char* session_id, const char* data, const char* token, long ttl, const uint64_t* generation) {
+    if (ttl <= 0) return;
+
+    const size_t key_size = strlen(key) + 1;
+    const size_t session_id_size = strlen(session_id) + 1;
+    const size_t data_size = strlen(data);
+
+    sessioncache_entry_t* entry = malloc(sizeof * entry + key_size + session_id_size + data_size + 1);
+    if (entry == NULL) return;
+
+    char* buffer = entry->buffer;
+    memcpy(buffer, key, key_size);
+    memcpy(buffer + key_size, session_id, session_id_size);
+    memcpy(buffer + key_size + session_id_size, data, data_size + 1);
+
+    entry->hash_next = NULL;
+    entry->prev = NULL;
+    entry->next = NULL;
+    entry->hash = __hash(session_id);
+    entry->expires_at = __now() + ttl * 1000LL;
+    entry->key = buffer;
+    entry->session_id = buffer + key_size;
+    entry->data = buffer + key_size + session_id_size;
+    entry->data_size = data_size;
+    strcpy(entry->token, token);
+
+    sessioncache_shard_t* shard = __shard(entry->hash);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    if (generation != NULL && *generation != shard->generation) {
+        pthread_mutex_unlock(&shard->mutex);
+        free(entry);
+        return;
+    }
+
+    sessioncache_entry_t* existing = __find(shard, entry->hash, key, session_id);
+    if (existing != NULL)
+        __remove(shard, existing);
+
+    while (shard->count >= SESSIONCACHE_SHARD_CAPACITY && shard->tail != NULL) {
+        __remove(shard, shard->tail);
+        atomic_fetch_add(&__evictions, 1);
+    }
+
+    sessioncache_entry_t** bucket = __bucket(shard, entry->hash);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    __lru_push(shard, entry);
+    shard->count++;
+
+    pthread_mutex_unlock(&shard->mutex);
+}
@@ -0,0 +1,61 @@
+#ifndef __SESSIONCACHE__
+#define __SESSIONCACHE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SESSIONCACHE_SHARDS 16
+#define SESSIONCACHE_SHARD_BUCKETS 1024
+#define SESSIONCACHE_SHARD_CAPACITY 4096
+// Upper bound in seconds for serving a session without asking the driver.
+// A session is never served past its own expiry.
+#define SESSIONCACHE_TTL 30
+#define SESSIONCACHE_TOKEN_SIZE 48
+#define SESSIONCACHE_REDIS_PREFIX "sc:"
+// Key of main.env with the Redis dbid holding the session tokens, e.g. "redis.r1".
+// Without it nothing is cached and every call goes to the driver.
+#define SESSIONCACHE_REDIS_ENV "sessioncache_redis"
+
+typedef struct sessioncache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    size_t entries;
+} sessioncache_stats_t;
+
+/**
+ * Same as session_get, served from the in-process cache of decrypted payloads.
+ * Every session created through sessioncache_create has a token in Redis: its expiry and
+ * a nonce replaced on every change. A cached payload is served only while its token is
+ * still the one in Redis, so a change on any node or in any library stops it at once.
+ * @param key         Session configuration name from config.json
+ * @param session_id  Session identifier
+ * @return Session data, free with free(). NULL if the session is not found.
+ */
+char* sessioncache_get(const char* key, const char* session_id);
+
+/**
+ * Same as session_create. The new session gets its token and is cached right away.
+ */
+char* sessioncache_create(const char* key, const char* data, long duration);
+
+/**
+ * Same as session_update. The token is replaced, the payload is read again on every node.
+ */
+int sessioncache_update(const char* key, const char* session_id, const char* data);
+
+/**
+ * Same as session_destroy. The token is deleted first, so no node serves the session from then on.
+ */
+int sessioncache_destroy(const char* key, const char* session_id);
+
+/**
+ * Replaces the token of the session, dropping its cached payload on every node.
+ * @param session_id  Session identifier
+ */
+void sessioncache_invalidate(const char* session_id);
+
+sessioncache_stats_t sessioncache_stats(void);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "redispipe.h"
+#include "sessioncache.h"
+#include "sessionexpiry.h"
+
+static char* __member(const char* key, const char* session_id, size_t* size);
+
+void sessionexpiry_add(const char* key, const char* session_id, long duration) {
+    if (key == NULL || session_id == NULL || duration <= 0) return;
+    if (strchr(key, ':') != NULL) return;
+
+    redisconn_t* conn = redisconn_default();
+    if (conn == NULL) return;
+
+    size_t member_size = 0;
+    char* member = __member(key, session_id, &member_size);
+    if (member == NULL) return;
+
+    char score[32];
+    const int score_size = snprintf(score, sizeof(score), "%lld", (long long)time(NULL) + duration);
+
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) goto failed;
+
+    const char* argv[] = {"ZADD", SESSIONEXPIRY_REDIS_KEY, score, member};
+    const size_t argvlen[] = {4, sizeof(SESSIONEXPIRY_REDIS_KEY) - 1, score_size, member_size};
+    if (!redispipe_commandv(pipe, 4, argv, argvlen)) goto failed;
+
+    if (!redispipe_exec(conn, pipe))
+        log_error("sessionexpiry: %s\n", redispipe_error(pipe));
+
+    failed:
+
+    redispipe_free(pipe);
+    free(member);
+}
+
+size_t sessionexpiry_sweep(size_t limit) {
+    if (limit == 0) return 0;
+
+    redisconn_t* conn = redisconn_default();
+    if (conn == NULL) return 0;
+
+    size_t count = 0;
+    redispipe_t* claim = NULL;
+
+    char command[128];
+    snprintf(command, sizeof(command), "ZRANGEBYSCORE %s -inf %lld LIMIT 0 %zu", SESSIONEXPIRY_REDIS_KEY, (long long)time(NULL), limit);
+
+    redispipe_t* range = redispipe_create();
+    if (range == NULL) return 0;
+
+    if (!redispipe_command(range, command) || !redispipe_exec(conn, range)) {
+        log_error("sessionexpiry: %s\n", redispipe_error(range));
+        goto failed;
+    }
+
+    const redisreply_t* members = redispipe_reply(range, 0);
+    if (members == NULL || members->type != REDISREPLY_ARRAY || members->elements == 0) goto failed;
+
+    // Only the ZREM that removes a member claims its session
+    claim = redispipe_create();
+    if (claim == NULL) goto failed;
+
+    for (size_t i = 0; i < members->elements; i++) {
+        const redisreply_t* member = &members->element[i];
+        const char* argv[] = {"ZREM", SESSIONEXPIRY_REDIS_KEY, member->str};
+        const size_t argvlen[] = {4, sizeof(SESSIONEXPIRY_REDIS_KEY) - 1, member->len};
+        if (!redispipe_commandv(claim, 3, argv, argvlen)) goto failed;
+    }
+
+    if (!redispipe_exec(conn, claim)) {
+        log_error("sessionexpiry: %s\n", redispipe_error(claim));
+        goto failed;
+    }
+
+    for (size_t i = 0; i < members->elements; i++) {
+        const redisreply_t* removed = redispipe_reply(claim, i);
+        if (removed == NULL || removed->type != REDISREPLY_INTEGER || removed->integer != 1) continue;
+
+        const redisreply_t* member = &members->element[i];
+        const char* separator = memchr(member->str, ':', member->len);
+        if (separator == NULL) continue;
+
+        char key[128];
+        const size_t key_size = separator - member->str;
+        if (key_size >= sizeof(key)) continue;
+
+        memcpy(key, member->str, key_size);
+        key[key_size] = 0;
+
+        sessioncache_destroy(key, separator + 1);
+        count++;
+    }
+
+    failed:
+
+    redispipe_free(claim);
+    redispipe_free(range);
+
+    return count;
+}
+
+/**
+ * @brief Builds the sorted set member "<key>:<session_id>".
+ */
+char* __member(const char* key, const char* session_id, size_t* size) {
+    const size_t key_size = strlen(key);
+    const size_t session_id_size = strlen(session_id);
+
+    char* member = malloc(key_size + 1 + session_id_size + 1);
+    if (member == NULL) return NULL;
+
+    memcpy(member, key, key_size);
+    member[key_size] = ':';
+    memcpy(member + key_size + 1, session_id, session_id_size + 1);
+
+    *size = key_size + 1 + session_id_size;
+
+    return member;
+}
@@ -0,0 +1,32 @@
+#ifndef __SESSIONEXPIRY__
+#define __SESSIONEXPIRY__
+
+#include <stddef.h>
+
+// Sorted set of "<key>:<session_id>" members scored by the expiry in unix seconds
+#define SESSIONEXPIRY_REDIS_KEY "se:sessions"
+// Sessions destroyed per sweep call at most
+#define SESSIONEXPIRY_SWEEP_LIMIT 1000
+
+/**
+ * Registers the session for destruction after duration seconds.
+ * The index is a Redis sorted set on the server of redisconn_default(), shared by
+ * every library and node and kept across restarts. Called by sessioncache_create,
+ * it adds one ZADD round trip to session creation on top of core's session_create.
+ * @param key         Session configuration name from config.json, without ':'
+ * @param session_id  Session identifier
+ * @param duration    Session lifetime in seconds
+ */
+void sessionexpiry_add(const char* key, const char* session_id, long duration);
+
+/**
+ * Destroys up to limit expired sessions, the earliest first.
+ * A session is destroyed by the caller whose ZREM removed it from the index,
+ * so nodes sweeping at the same time do not destroy it twice.
+ * Run periodically from the task manager.
+ * @param limit  Maximum number of sessions to destroy
+ * @return Number of destroyed sessions
+ */
+size_t sessionexpiry_sweep(size_t limit);
+
+#endif
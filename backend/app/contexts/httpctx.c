@@ -1,8 +1,7 @@
 #include "httpctx.h"
 #include "httprequest.h"
 #include "httpresponse.h"
-#include "model.h"
-#include "user.h"
+#include "principalcache.h"
 
 void httpctx_init(httpctx_t* ctx, void* request, void* response) {
     ctx->request = request;
@@ -10,10 +9,11 @@ void httpctx_init(httpctx_t* ctx, void* request, void* response) {
     ctx->user_data = NULL;
 }
 
-void httpctx_set_user(httpctx_t* ctx, user_t* user) {
-    ctx->user_data = user;
+void httpctx_set_user(httpctx_t* ctx, principal_t* principal) {
+    ctx->user_data = principal;
 }
 
 void httpctx_clear(httpctx_t* ctx) {
-    model_free(ctx->user_data);
+    principal_release(ctx->user_data);
+    ctx->user_data = NULL;
 }
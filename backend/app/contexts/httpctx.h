@@ -2,11 +2,12 @@
 #define __HTTPCTX__
 
 #include "http.h"
-#include "user.h"
+#include "principalcache.h"
 
-// Helper macro for app-level code to access user as typed pointer
-#define httpctx_get_user(ctx) ((user_t*)((ctx)->user_data))
+// Helper macro for app-level code to access the authenticated principal as typed pointer
+#define httpctx_get_user(ctx) ((principal_t*)((ctx)->user_data))
 
-void httpctx_set_user(httpctx_t* ctx, user_t* user);
+// Takes over the caller's reference, released in httpctx_clear
+void httpctx_set_user(httpctx_t* ctx, principal_t* principal);
 
 #endif
\ No newline at end of file
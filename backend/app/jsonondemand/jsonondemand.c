@@ -0,0 +1,544 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "jsonondemand.h"
+
+// Longest number text that is converted, longer numbers are reported as not ok
+#define JSON_OD_NUMBER_MAX 64
+
+static const char* __ws(const char* p, const char* end);
+static int __hex(const char* p, unsigned int* code);
+static const char* __string_end(const char* p, const char* end);
+static const char* __number_end(const char* p, const char* end, int* integer);
+static const char* __literal_end(const char* p, const char* end, const char* literal, size_t size);
+static const char* __skip(const char* p, const char* end);
+static const char* __key(const char* p, const char* end);
+static const char* __value(const char* p, const char* end, json_od_value_t* value);
+static const char* __char(const char* p, char* out, size_t* count);
+static int __key_equals(const char* key, const char* key_end, const char* segment, size_t size);
+static const char* __member(const char* p, const char* end, const char* segment, size_t size);
+static const char* __element(const char* p, const char* end, const char* segment, size_t size);
+static int __number(const json_od_value_t* value, char* buffer, int* integer);
+
+void json_od_init(json_ondemand_t* document, const char* data, size_t size) {
+    if (document == NULL) return;
+
+    document->data = data;
+    document->size = data != NULL ? size : 0;
+}
+
+int json_od_find(const json_ondemand_t* document, const char* path, json_od_value_t* value) {
+    if (document == NULL || document->data == NULL || path == NULL) return 0;
+
+    const char* end = document->data + document->size;
+    const char* p = __ws(document->data, end);
+
+    // Only the members on the way are read, the text after the found value is never touched
+    while (*path != 0 && p != NULL && p < end) {
+        const char* dot = strchr(path, '.');
+        const size_t size = dot != NULL ? (size_t)(dot - path) : strlen(path);
+
+        if (*p == '{')
+            p = __member(p + 1, end, path, size);
+        else if (*p == '[')
+            p = __element(p + 1, end, path, size);
+        else
+            p = NULL;
+
+        path += size;
+        if (*path == '.') path++;
+    }
+
+    if (p == NULL || p >= end) return 0;
+
+    json_od_value_t found;
+    if (__value(p, end, &found) == NULL) return 0;
+
+    if (value != NULL)
+        *value = found;
+
+    return 1;
+}
+
+json_od_type_e json_od_type(const json_ondemand_t* document, const char* path) {
+    json_od_value_t value;
+    if (!json_od_find(document, path, &value)) return JSON_OD_NONE;
+
+    return value.type;
+}
+
+int json_od_get_int(const json_ondemand_t* document, const char* path, int* ok) {
+    json_od_value_t value;
+    if (!json_od_find(document, path, &value)) {
+        if (ok != NULL) *ok = 0;
+        return 0;
+    }
+
+    return json_od_value_int(&value, ok);
+}
+
+long long json_od_get_llong(const json_ondemand_t* document, const char* path, int* ok) {
+    json_od_value_t value;
+    if (!json_od_find(document, path, &value)) {
+        if (ok != NULL) *ok = 0;
+        return 0;
+    }
+
+    return json_od_value_llong(&value, ok);
+}
+
+double json_od_get_double(const json_ondemand_t* document, const char* path, int* ok) {
+    char buffer[JSON_OD_NUMBER_MAX + 1];
+    int integer = 0;
+    json_od_value_t value;
+    const int result_ok = json_od_find(document, path, &value) && __number(&value, buffer, &integer);
+
+    if (ok != NULL) *ok = result_ok;
+
+    return result_ok ? strtod(buffer, NULL) : 0;
+}
+
+int json_od_value_int(const json_od_value_t* value, int* ok) {
+    int result_ok = 0;
+    const long long number = json_od_value_llong(value, &result_ok);
+    if (result_ok && (number < INT_MIN || number > INT_MAX))
+        result_ok = 0;
+
+    if (ok != NULL) *ok = result_ok;
+
+    return result_ok ? (int)number : 0;
+}
+
+long long json_od_value_llong(const json_od_value_t* value, int* ok) {
+    char buffer[JSON_OD_NUMBER_MAX + 1];
+    int integer = 0;
+    long long result = 0;
+    int result_ok = value != NULL && __number(value, buffer, &integer);
+
+    if (result_ok && integer) {
+        errno = 0;
+        result = strtoll(buffer, NULL, 10);
+        result_ok = errno == 0;
+    }
+    else if (result_ok) {
+        // 1.0 and 1e3 are integers too
+        const double number = strtod(buffer, NULL);
+        result_ok = number >= (double)LLONG_MIN && number < (double)LLONG_MAX && (double)(long long)number == number;
+        result = result_ok ? (long long)number : 0;
+    }
+
+    if (ok != NULL) *ok = result_ok;
+
+    return result_ok ? result : 0;
+}
+
+int json_od_get_bool(const json_ondemand_t* document, const char* path) {
+    return json_od_type(document, path) == JSON_OD_TRUE;
+}
+
+size_t json_od_get_string(const json_ondemand_t* document, const char* path, char* buffer, size_t size, int* ok) {
+    if (ok != NULL) *ok = 0;
+    if (buffer == NULL || size == 0) return 0;
+
+    buffer[0] = 0;
+
+    json_od_value_t value;
+    if (!json_od_find(document, path, &value) || value.type != JSON_OD_STRING) return 0;
+
+    const char* p = value.data + 1;
+    const char* end = value.data + value.size - 1;
+    size_t length = 0;
+
+    while (p < end) {
+        char decoded[4];
+        size_t count = 0;
+        p = __char(p, decoded, &count);
+
+        if (length + count >= size) {
+            buffer[length] = 0;
+            return length;
+        }
+
+        memcpy(buffer + length, decoded, count);
+        length += count;
+    }
+
+    buffer[length] = 0;
+    if (ok != NULL) *ok = 1;
+
+    return length;
+}
+
+const char* __ws(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+
+    return p;
+}
+
+int __hex(const char* p, unsigned int* code) {
+    unsigned int result = 0;
+
+    for (int i = 0; i < 4; i++) {
+        const char c = p[i];
+        result <<= 4;
+
+        if (c >= '0' && c <= '9') result |= c - '0';
+        else if (c >= 'a' && c <= 'f') result |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') result |= c - 'A' + 10;
+        else return 0;
+    }
+
+    *code = result;
+
+    return 1;
+}
+
+/**
+ * @brief Validates the string at p (the opening quote) and returns the position after the closing quote.
+ */
+const char* __string_end(const char* p, const char* end) {
+    unsigned int code = 0;
+
+    for (p++; p < end; p++) {
+        const unsigned char c = *p;
+
+        if (c == '"') return p + 1;
+        if (c < 0x20) return NULL;
+        if (c != '\\') continue;
+
+        if (++p >= end) return NULL;
+
+        switch (*p) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            break;
+        case 'u':
+            if (end - p < 5 || !__hex(p + 1, &code)) return NULL;
+            p += 4;
+            break;
+        default:
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+const char* __number_end(const char* p, const char* end, int* integer) {
+    *integer = 1;
+
+    if (p < end && *p == '-') p++;
+    if (p >= end) return NULL;
+
+    if (*p == '0')
+        p++;
+    else if (*p >= '1' && *p <= '9')
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    else
+        return NULL;
+
+    if (p < end && *p == '.') {
+        *integer = 0;
+        if (++p >= end || *p < '0' || *p > '9') return NULL;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        *integer = 0;
+        if (++p < end && (*p == '+' || *p == '-')) p++;
+        if (p >= end || *p < '0' || *p > '9') return NULL;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+
+    return p;
+}
+
+const char* __literal_end(const char* p, const char* end, const char* literal, size_t size) {
+    if ((size_t)(end - p) < size || memcmp(p, literal, size) != 0) return NULL;
+
+    return p + size;
+}
+
+/**
+ * @brief Finds the end of the container at p and validates it: members are "key": value pairs,
+ * values are separated by commas, brackets match. Nesting is kept on a stack instead of recursion.
+ */
+const char* __skip(const char* p, const char* end) {
+    // Closing bracket of every open container
+    char stack[JSON_OD_DEPTH_MAX];
+    int depth = 0;
+
+    // Each round reads one value, then the commas and the closing brackets after it
+    for (;;) {
+        p = __ws(p, end);
+        if (p >= end) return NULL;
+
+        if (*p == '{' || *p == '[') {
+            if (depth == JSON_OD_DEPTH_MAX) return NULL;
+
+            stack[depth++] = *p == '{' ? '}' : ']';
+            p = __ws(p + 1, end);
+
+            if (p >= end || *p != stack[depth - 1]) {
+                if (stack[depth - 1] == '}') {
+                    p = __key(p, end);
+                    if (p == NULL) return NULL;
+                }
+
+                continue;
+            }
+
+            // An empty container is a complete value
+            depth--;
+            p++;
+        }
+        else {
+            p = __value(p, end, NULL);
+            if (p == NULL) return NULL;
+        }
+
+        for (;;) {
+            if (depth == 0) return p;
+
+            p = __ws(p, end);
+            if (p >= end) return NULL;
+
+            if (*p == stack[depth - 1]) {
+                depth--;
+                p++;
+                continue;
+            }
+
+            if (*p != ',') return NULL;
+
+            p++;
+            if (stack[depth - 1] == '}') {
+                p = __key(p, end);
+                if (p == NULL) return NULL;
+            }
+
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Validates a member key and its colon, returns the position after the colon.
+ */
+const char* __key(const char* p, const char* end) {
+    p = __ws(p, end);
+    if (p >= end || *p != '"') return NULL;
+
+    p = __string_end(p, end);
+    if (p == NULL) return NULL;
+
+    p = __ws(p, end);
+    if (p >= end || *p != ':') return NULL;
+
+    return p + 1;
+}
+
+const char* __value(const char* p, const char* end, json_od_value_t* value) {
+    if (p >= end) return NULL;
+
+    json_od_type_e type = JSON_OD_NONE;
+    const char* value_end = NULL;
+    int integer = 0;
+
+    switch (*p) {
+    case '{':
+        type = JSON_OD_OBJECT;
+        value_end = __skip(p, end);
+        break;
+    case '[':
+        type = JSON_OD_ARRAY;
+        value_end = __skip(p, end);
+        break;
+    case '"':
+        type = JSON_OD_STRING;
+        value_end = __string_end(p, end);
+        break;
+    case 't':
+        type = JSON_OD_TRUE;
+        value_end = __literal_end(p, end, "true", 4);
+        break;
+    case 'f':
+        type = JSON_OD_FALSE;
+        value_end = __literal_end(p, end, "false", 5);
+        break;
+    case 'n':
+        type = JSON_OD_NULL;
+        value_end = __literal_end(p, end, "null", 4);
+        break;
+    default:
+        type = JSON_OD_NUMBER;
+        value_end = __number_end(p, end, &integer);
+    }
+
+    if (value_end == NULL) return NULL;
+
+    if (value != NULL) {
+        value->type = type;
+        value->data = p;
+        value->size = value_end - p;
+    }
+
+    return value_end;
+}
+
+/**
+ * @brief Decodes one character of a validated string into UTF-8.
+ */
+const char* __char(const char* p, char* out, size_t* count) {
+    if (*p != '\\') {
+        out[0] = *p;
+        *count = 1;
+        return p + 1;
+    }
+
+    p++;
+    *count = 1;
+
+    switch (*p) {
+    case 'b': out[0] = '\b'; return p + 1;
+    case 'f': out[0] = '\f'; return p + 1;
+    case 'n': out[0] = '\n'; return p + 1;
+    case 'r': out[0] = '\r'; return p + 1;
+    case 't': out[0] = '\t'; return p + 1;
+    case 'u': break;
+    default: out[0] = *p; return p + 1;
+    }
+
+    unsigned int code = 0;
+    __hex(p + 1, &code);
+    p += 5;
+
+    // A high surrogate followed by an escaped low surrogate is one code point
+    unsigned int low = 0;
+    if (code >= 0xD800 && code <= 0xDBFF && p[0] == '\\' && p[1] == 'u' && __hex(p + 2, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        p += 6;
+    }
+    else if (code >= 0xD800 && code <= 0xDFFF)
+        code = 0xFFFD;
+
+    if (code < 0x80) {
+        out[0] = code;
+    }
+    else if (code < 0x800) {
+        out[0] = 0xC0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3F);
+        *count = 2;
+    }
+    else if (code < 0x10000) {
+        out[0] = 0xE0 | (code >> 12);
+        out[1] = 0x80 | ((code >> 6) & 0x3F);
+        out[2] = 0x80 | (code & 0x3F);
+        *count = 3;
+    }
+    else {
+        out[0] = 0xF0 | (code >> 18);
+        out[1] = 0x80 | ((code >> 12) & 0x3F);
+        out[2] = 0x80 | ((code >> 6) & 0x3F);
+        out[3] = 0x80 | (code & 0x3F);
+        *count = 4;
+    }
+
+    return p;
+}
+
+int __key_equals(const char* key, const char* key_end, const char* segment, size_t size) {
+    // Keys without escapes, the usual case, are compared as is
+    if ((size_t)(key_end - key) == size && memchr(key, '\\', size) == NULL)
+        return memcmp(key, segment, size) == 0;
+
+    size_t offset = 0;
+    while (key < key_end) {
+        char decoded[4];
+        size_t count = 0;
+        key = __char(key, decoded, &count);
+
+        if (offset + count > size || memcmp(segment + offset, decoded, count) != 0) return 0;
+        offset += count;
+    }
+
+    return offset == size;
+}
+
+/**
+ * @brief Scans the members of the object after its '{' and returns the start of the value of the key.
+ */
+const char* __member(const char* p, const char* end, const char* segment, size_t size) {
+    p = __ws(p, end);
+    if (p < end && *p == '}') return NULL;
+
+    while (p < end) {
+        if (*p != '"') return NULL;
+
+        const char* key_end = __string_end(p, end);
+        if (key_end == NULL) return NULL;
+
+        const int found = __key_equals(p + 1, key_end - 1, segment, size);
+
+        p = __ws(key_end, end);
+        if (p >= end || *p != ':') return NULL;
+
+        p = __ws(p + 1, end);
+        if (found) return p;
+
+        p = __value(p, end, NULL);
+        if (p == NULL) return NULL;
+
+        p = __ws(p, end);
+        if (p >= end || *p != ',') return NULL;
+
+        p = __ws(p + 1, end);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Scans the elements of the array after its '[' and returns the start of the element with the index.
+ */
+const char* __element(const char* p, const char* end, const char* segment, size_t size) {
+    if (size == 0 || size > 9) return NULL;
+
+    size_t index = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (segment[i] < '0' || segment[i] > '9') return NULL;
+        index = index * 10 + (segment[i] - '0');
+    }
+
+    p = __ws(p, end);
+    if (p < end && *p == ']') return NULL;
+
+    for (size_t i = 0; p < end; i++) {
+        if (i == index) return p;
+
+        p = __value(p, end, NULL);
+        if (p == NULL) return NULL;
+
+        p = __ws(p, end);
+        if (p >= end || *p != ',') return NULL;
+
+        p = __ws(p + 1, end);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Copies the number into the buffer for strtoll/strtod.
+ */
+int __number(const json_od_value_t* value, char* buffer, int* integer) {
+    if (value->type != JSON_OD_NUMBER || value->size > JSON_OD_NUMBER_MAX) return 0;
+
+    __number_end(value->data, value->data + value->size, integer);
+    memcpy(buffer, value->data, value->size);
+    buffer[value->size] = 0;
+
+    return 1;
+}
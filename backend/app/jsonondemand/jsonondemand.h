@@ -0,0 +1,97 @@
+#ifndef __JSONONDEMAND__
+#define __JSONONDEMAND__
+
+#include <stddef.h>
+
+// Nesting of skipped containers
+#define JSON_OD_DEPTH_MAX 128
+
+typedef enum {
+    JSON_OD_NONE = 0,
+    JSON_OD_OBJECT,
+    JSON_OD_ARRAY,
+    JSON_OD_STRING,
+    JSON_OD_NUMBER,
+    JSON_OD_TRUE,
+    JSON_OD_FALSE,
+    JSON_OD_NULL
+} json_od_type_e;
+
+// A document is only a view of the text, nothing is parsed until a field is read
+typedef struct json_ondemand {
+    const char* data;
+    size_t size;
+} json_ondemand_t;
+
+typedef struct json_od_value {
+    json_od_type_e type;
+    // Raw text of the value, strings include the quotes
+    const char* data;
+    size_t size;
+} json_od_value_t;
+
+/**
+ * Wraps JSON text without copying it. The text must outlive the document.
+ * @param document  Document
+ * @param data      JSON text
+ * @param size      Text size
+ */
+void json_od_init(json_ondemand_t* document, const char* data, size_t size);
+
+/**
+ * Finds a value by path. Segments are separated by dots, an array element is addressed by its index,
+ * e.g. "user.roles.0". An empty path is the root.
+ * Values on the way to the path and the found value are validated, the text after the found value
+ * is not read, so a document that is broken after it still gives the value.
+ * @param document  Document
+ * @param path      Path
+ * @param value     Found value
+ * @return 1 if found, 0 if there is no such value or the text is invalid
+ */
+int json_od_find(const json_ondemand_t* document, const char* path, json_od_value_t* value);
+
+/**
+ * Type of the value at the path.
+ * @return Type, JSON_OD_NONE if not found
+ */
+json_od_type_e json_od_type(const json_ondemand_t* document, const char* path);
+
+/**
+ * Same as json_int of the token at the path.
+ * @param ok  Set to 1 if the value is a number in the range of int, 0 otherwise
+ */
+int json_od_get_int(const json_ondemand_t* document, const char* path, int* ok);
+
+/**
+ * Same as json_llong of the token at the path.
+ */
+long long json_od_get_llong(const json_ondemand_t* document, const char* path, int* ok);
+
+/**
+ * Same as json_double of the token at the path.
+ */
+double json_od_get_double(const json_ondemand_t* document, const char* path, int* ok);
+
+/**
+ * Same as json_od_get_int for a value found by json_od_find, the text is not scanned again.
+ * @param ok  Set to 1 if the value is a number in the range of int, 0 otherwise
+ */
+int json_od_value_int(const json_od_value_t* value, int* ok);
+long long json_od_value_llong(const json_od_value_t* value, int* ok);
+
+/**
+ * Boolean at the path.
+ * @return 1 for true, 0 for false or if the value is not a boolean
+ */
+int json_od_get_bool(const json_ondemand_t* document, const char* path);
+
+/**
+ * Copies the unescaped string at the path into the buffer, null-terminated.
+ * @param buffer  Output buffer
+ * @param size    Buffer size
+ * @param ok      Set to 1 if the value is a string that fits the buffer, 0 otherwise
+ * @return Length of the string
+ */
+size_t json_od_get_string(const json_ondemand_t* document, const char* path, char* buffer, size_t size, int* ok);
+
+#endif
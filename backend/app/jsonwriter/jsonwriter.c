@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "jsonwriter.h"
+
+// Character after the backslash, 'u' for \u00XX, 0 if the byte is written as is
+static const char __escapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"',
+    ['\\'] = '\\',
+};
+
+static const char __digits[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static int __reserve(json_writer_t* writer, size_t size);
+static void __append(json_writer_t* writer, const char* data, size_t size);
+static int __value_begin(json_writer_t* writer);
+static int __separator(json_writer_t* writer);
+static void __begin(json_writer_t* writer, char c, int object);
+static void __string(json_writer_t* writer, const char* value, size_t size);
+static void __ullong(json_writer_t* writer, unsigned long long value, int negative);
+
+void json_writer_init(json_writer_t* writer) {
+    writer->data = writer->buffer;
+    writer->size = 0;
+    writer->capacity = JSON_WRITER_BUFFER_SIZE;
+    writer->depth = 0;
+    writer->first[0] = 1;
+    writer->objects[0] = 0;
+    writer->key = 0;
+    writer->failed = 0;
+    writer->buffer[0] = 0;
+}
+
+void json_writer_free(json_writer_t* writer) {
+    if (writer == NULL) return;
+
+    if (writer->data != writer->buffer)
+        free(writer->data);
+
+    json_writer_init(writer);
+}
+
+void json_writer_begin_object(json_writer_t* writer) {
+    __begin(writer, '{', 1);
+}
+
+void json_writer_begin_array(json_writer_t* writer) {
+    __begin(writer, '[', 0);
+}
+
+void json_writer_end(json_writer_t* writer) {
+    if (writer->failed) return;
+
+    // A key without a value leaves the object invalid
+    if (writer->depth == 0 || writer->key) {
+        writer->failed = 1;
+        return;
+    }
+
+    const char c = writer->objects[writer->depth] ? '}' : ']';
+    writer->depth--;
+    __append(writer, &c, 1);
+}
+
+void json_writer_key(json_writer_t* writer, const char* key) {
+    if (writer->failed) return;
+
+    if (key == NULL || !writer->objects[writer->depth] || writer->key) {
+        writer->failed = 1;
+        return;
+    }
+
+    if (!__separator(writer)) return;
+
+    __string(writer, key, strlen(key));
+    __append(writer, ":", 1);
+
+    writer->key = 1;
+}
+
+void json_writer_string(json_writer_t* writer, const char* value) {
+    if (value == NULL) {
+        json_writer_null(writer);
+        return;
+    }
+
+    json_writer_stringn(writer, value, strlen(value));
+}
+
+void json_writer_stringn(json_writer_t* writer, const char* value, size_t size) {
+    if (!__value_begin(writer)) return;
+
+    __string(writer, value, size);
+}
+
+void json_writer_int(json_writer_t* writer, int value) {
+    json_writer_llong(writer, value);
+}
+
+void json_writer_llong(json_writer_t* writer, long long value) {
+    if (!__value_begin(writer)) return;
+
+    // Negated in unsigned arithmetic, so LLONG_MIN does not overflow
+    if (value < 0)
+        __ullong(writer, 0ULL - (unsigned long long)value, 1);
+    else
+        __ullong(writer, (unsigned long long)value, 0);
+}
+
+void json_writer_double(json_writer_t* writer, double value) {
+    if (!isfinite(value)) {
+        json_writer_null(writer);
+        return;
+    }
+
+    if (!__value_begin(writer)) return;
+
+    // The fewest significant digits that read back exactly, 17 always do
+    char number[32];
+    int size = 0;
+    for (int precision = 15; precision <= 17; precision++) {
+        size = snprintf(number, sizeof(number), "%.*g", precision, value);
+        if (strtod(number, NULL) == value) break;
+    }
+
+    __append(writer, number, size);
+}
+
+void json_writer_bool(json_writer_t* writer, int value) {
+    if (!__value_begin(writer)) return;
+
+    if (value)
+        __append(writer, "true", 4);
+    else
+        __append(writer, "false", 5);
+}
+
+void json_writer_null(json_writer_t* writer) {
+    if (!__value_begin(writer)) return;
+
+    __append(writer, "null", 4);
+}
+
+void json_writer_raw(json_writer_t* writer, const char* value, size_t size) {
+    if (value == NULL || size == 0) {
+        json_writer_null(writer);
+        return;
+    }
+
+    if (!__value_begin(writer)) return;
+
+    __append(writer, value, size);
+}
+
+const char* json_writer_data(json_writer_t* writer) {
+    if (writer->failed || writer->depth != 0 || writer->size == 0) return NULL;
+
+    return writer->data;
+}
+
+size_t json_writer_size(json_writer_t* writer) {
+    return writer->size;
+}
+
+/**
+ * @brief Makes room for size more bytes and the null terminator.
+ */
+int __reserve(json_writer_t* writer, size_t size) {
+    if (writer->failed) return 0;
+    if (writer->size + size < writer->capacity) return 1;
+
+    size_t capacity = writer->capacity * 2;
+    while (writer->size + size >= capacity)
+        capacity *= 2;
+
+    char* data = NULL;
+    if (writer->data == writer->buffer) {
+        data = malloc(capacity);
+        if (data != NULL)
+            memcpy(data, writer->buffer, writer->size + 1);
+    }
+    else
+        data = realloc(writer->data, capacity);
+
+    if (data == NULL) {
+        writer->failed = 1;
+        return 0;
+    }
+
+    writer->data = data;
+    writer->capacity = capacity;
+
+    return 1;
+}
+
+void __append(json_writer_t* writer, const char* data, size_t size) {
+    if (!__reserve(writer, size)) return;
+
+    memcpy(writer->data + writer->size, data, size);
+    writer->size += size;
+    writer->data[writer->size] = 0;
+}
+
+/**
+ * @brief Checks that a value is allowed here: after a key in an object, anywhere in an array, once at the root.
+ */
+int __value_begin(json_writer_t* writer) {
+    if (writer->failed) return 0;
+
+    if (writer->objects[writer->depth]) {
+        if (!writer->key) {
+            writer->failed = 1;
+            return 0;
+        }
+
+        writer->key = 0;
+        return 1;
+    }
+
+    if (writer->depth == 0 && writer->size > 0) {
+        writer->failed = 1;
+        return 0;
+    }
+
+    return __separator(writer);
+}
+
+/**
+ * @brief Writes the comma before an element or a key that is not the first one in its container.
+ */
+int __separator(json_writer_t* writer) {
+    if (!writer->first[writer->depth])
+        __append(writer, ",", 1);
+
+    writer->first[writer->depth] = 0;
+
+    return !writer->failed;
+}
+
+void __begin(json_writer_t* writer, char c, int object) {
+    if (!__value_begin(writer)) return;
+
+    if (writer->depth == JSON_WRITER_DEPTH_MAX) {
+        writer->failed = 1;
+        return;
+    }
+
+    writer->depth++;
+    writer->first[writer->depth] = 1;
+    writer->objects[writer->depth] = object;
+
+    __append(writer, &c, 1);
+}
+
+void __string(json_writer_t* writer, const char* value, size_t size) {
+    __append(writer, "\"", 1);
+
+    // Runs of bytes that need no escaping are copied at once
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++) {
+        const char escape = __escapes[(unsigned char)value[i]];
+        if (escape == 0) continue;
+
+        __append(writer, value + start, i - start);
+        start = i + 1;
+
+        if (escape == 'u') {
+            char sequence[7];
+            snprintf(sequence, sizeof(sequence), "\\u%04x", (unsigned char)value[i]);
+            __append(writer, sequence, 6);
+        }
+        else {
+            const char sequence[2] = { '\\', escape };
+            __append(writer, sequence, 2);
+        }
+    }
+
+    __append(writer, value + start, size - start);
+    __append(writer, "\"", 1);
+}
+
+/**
+ * @brief Formats two digits per step from the digit pair table.
+ */
+void __ullong(json_writer_t* writer, unsigned long long value, int negative) {
+    char number[21];
+    char* p = number + sizeof(number);
+
+    while (value >= 100) {
+        const unsigned int pair = (value % 100) * 2;
+        value /= 100;
+        *--p = __digits[pair + 1];
+        *--p = __digits[pair];
+    }
+
+    if (value >= 10) {
+        *--p = __digits[value * 2 + 1];
+        *--p = __digits[value * 2];
+    }
+    else
+        *--p = '0' + value;
+
+    if (negative)
+        *--p = '-';
+
+    __append(writer, p, number + sizeof(number) - p);
+}
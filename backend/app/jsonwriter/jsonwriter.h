@@ -0,0 +1,94 @@
+#ifndef __JSONWRITER__
+#define __JSONWRITER__
+
+#include <stddef.h>
+
+// Output up to this size stays in the writer itself, larger output moves to the heap
+#define JSON_WRITER_BUFFER_SIZE 4096
+// Nesting of objects and arrays
+#define JSON_WRITER_DEPTH_MAX 64
+
+// Writes JSON text straight into a buffer, no token tree is built
+typedef struct json_writer {
+    char* data;
+    size_t size;
+    size_t capacity;
+    int depth;
+    // Set while the container has no values yet
+    unsigned char first[JSON_WRITER_DEPTH_MAX + 1];
+    unsigned char objects[JSON_WRITER_DEPTH_MAX + 1];
+    // Set after a key until its value is written
+    int key;
+    int failed;
+    char buffer[JSON_WRITER_BUFFER_SIZE];
+} json_writer_t;
+
+/**
+ * Prepares the writer. The writer is usually placed on the stack.
+ * @param writer  Writer
+ */
+void json_writer_init(json_writer_t* writer);
+
+/**
+ * Frees the heap buffer, if the output has outgrown the writer.
+ * @param writer  Writer
+ */
+void json_writer_free(json_writer_t* writer);
+
+void json_writer_begin_object(json_writer_t* writer);
+void json_writer_begin_array(json_writer_t* writer);
+
+/**
+ * Closes the innermost object or array.
+ * @param writer  Writer
+ */
+void json_writer_end(json_writer_t* writer);
+
+/**
+ * Writes an object key. The next call writes its value.
+ * @param writer  Writer
+ * @param key     Key, escaped as a string
+ */
+void json_writer_key(json_writer_t* writer, const char* key);
+
+/**
+ * Writes an escaped string, NULL is written as null.
+ * @param writer  Writer
+ * @param value   String
+ */
+void json_writer_string(json_writer_t* writer, const char* value);
+void json_writer_stringn(json_writer_t* writer, const char* value, size_t size);
+void json_writer_int(json_writer_t* writer, int value);
+void json_writer_llong(json_writer_t* writer, long long value);
+
+/**
+ * Writes the shortest representation that reads back as the same double.
+ * NaN and infinity have no JSON form and are written as null.
+ * @param writer  Writer
+ * @param value   Number
+ */
+void json_writer_double(json_writer_t* writer, double value);
+void json_writer_bool(json_writer_t* writer, int value);
+void json_writer_null(json_writer_t* writer);
+
+/**
+ * Writes a ready JSON value as is, e.g. the text of json_stringify. The value is not validated.
+ * @param writer  Writer
+ * @param value   JSON text
+ * @param size    Text size
+ */
+void json_writer_raw(json_writer_t* writer, const char* value, size_t size);
+
+/**
+ * Output of the writer, valid until the next write or json_writer_free.
+ * @param writer  Writer
+ * @return Null-terminated JSON text, NULL if memory ran out or a container is still open
+ */
+const char* json_writer_data(json_writer_t* writer);
+
+/**
+ * @return Size of the output without the null terminator
+ */
+size_t json_writer_size(json_writer_t* writer);
+
+#endif
@@ -0,0 +1,170 @@
+#include <string.h>
+
+#include "jsonwritermodel.h"
+
+static int __displayed(const char* name, char** fields);
+static void __field(json_writer_t* writer, mfield_t* field, const mcolumn_t* column);
+static void __str(json_writer_t* writer, str_t* value);
+static void __json(json_writer_t* writer, const json_token_t* token);
+static void __number(json_writer_t* writer, long double value);
+static void __string(json_writer_t* writer, mfield_t* field);
+
+void json_writer_model(json_writer_t* writer, void* model, char** fields) {
+    if (model == NULL) {
+        json_writer_null(writer);
+        return;
+    }
+
+    json_writer_begin_object(writer);
+    json_writer_model_fields(writer, model, fields);
+    json_writer_end(writer);
+}
+
+void json_writer_model_fields(json_writer_t* writer, void* model, char** fields) {
+    if (writer->failed) return;
+
+    // model_t is the first member of every model
+    model_t* record = model;
+    if (record == NULL || record->schema == NULL) {
+        writer->failed = 1;
+        return;
+    }
+
+    const mschema_t* schema = record->schema;
+    for (int i = 0; i < schema->columns_count; i++) {
+        const mcolumn_t* column = &schema->columns[i];
+        if (!__displayed(column->name, fields)) continue;
+
+        json_writer_key(writer, column->name);
+        __field(writer, model_field(record, i), column);
+    }
+}
+
+int __displayed(const char* name, char** fields) {
+    if (fields == NULL) return 1;
+
+    for (char** field = fields; *field != NULL; field++)
+        if (strcmp(*field, name) == 0)
+            return 1;
+
+    return 0;
+}
+
+/**
+ * @brief Numbers and booleans are written as JSON numbers and booleans, JSON columns as is,
+ * the other types as the string of model_field_to_string.
+ */
+void __field(json_writer_t* writer, mfield_t* field, const mcolumn_t* column) {
+    if (field == NULL) {
+        writer->failed = 1;
+        return;
+    }
+
+    // Numeric and temporal columns of a nullable column start as NULL
+    if (column->nullable && field->is_null) {
+        json_writer_null(writer);
+        return;
+    }
+
+    switch (column->type) {
+    case MODEL_BOOL:
+        json_writer_bool(writer, model_bool(field));
+        break;
+    case MODEL_SMALLINT:
+        json_writer_int(writer, model_smallint(field));
+        break;
+    case MODEL_INT:
+        json_writer_int(writer, model_int(field));
+        break;
+    case MODEL_BIGINT:
+        json_writer_llong(writer, model_bigint(field));
+        break;
+    case MODEL_FLOAT:
+        json_writer_double(writer, model_float(field));
+        break;
+    case MODEL_DOUBLE:
+        json_writer_double(writer, model_double(field));
+        break;
+    case MODEL_DECIMAL:
+        json_writer_double(writer, (double)model_decimal(field));
+        break;
+    case MODEL_MONEY:
+        json_writer_double(writer, model_money(field));
+        break;
+    case MODEL_VARCHAR:
+        __str(writer, model_varchar(field));
+        break;
+    case MODEL_CHAR:
+        __str(writer, model_char(field));
+        break;
+    case MODEL_TEXT:
+        __str(writer, model_text(field));
+        break;
+    case MODEL_ENUM:
+        __str(writer, model_enum(field));
+        break;
+    case MODEL_JSON: {
+        json_doc_t* document = model_json(field);
+        __json(writer, document != NULL ? json_root(document) : NULL);
+        break;
+    }
+    default:
+        __string(writer, field);
+    }
+}
+
+void __str(json_writer_t* writer, str_t* value) {
+    if (value == NULL) {
+        json_writer_null(writer);
+        return;
+    }
+
+    json_writer_stringn(writer, str_get(value), str_size(value));
+}
+
+/**
+ * @brief Copies the parsed document token by token, json_stringify would build its text first.
+ */
+void __json(json_writer_t* writer, const json_token_t* token) {
+    if (json_is_object(token)) {
+        json_writer_begin_object(writer);
+        for (json_it_t it = json_init_it(token); !json_end_it(&it); it = json_next_it(&it)) {
+            json_writer_key(writer, json_it_key(&it));
+            __json(writer, json_it_value(&it));
+        }
+        json_writer_end(writer);
+    }
+    else if (json_is_array(token)) {
+        json_writer_begin_array(writer);
+        for (json_it_t it = json_init_it(token); !json_end_it(&it); it = json_next_it(&it))
+            __json(writer, json_it_value(&it));
+        json_writer_end(writer);
+    }
+    else if (json_is_string(token))
+        json_writer_stringn(writer, json_string(token), json_string_size(token));
+    else if (json_is_number(token))
+        __number(writer, json_ldouble(token));
+    else if (json_is_bool(token))
+        json_writer_bool(writer, json_bool(token));
+    else
+        json_writer_null(writer);
+}
+
+/**
+ * @brief Integral values within long long are written without a fraction.
+ */
+void __number(json_writer_t* writer, long double value) {
+    if (value >= -9.2e18L && value <= 9.2e18L && value == (long double)(long long)value)
+        json_writer_llong(writer, (long long)value);
+    else
+        json_writer_double(writer, (double)value);
+}
+
+/**
+ * @brief Temporal, binary and array columns in the text form of model_field_to_string.
+ */
+void __string(json_writer_t* writer, mfield_t* field) {
+    str_t* value = model_field_to_string(field);
+    __str(writer, value);
+    str_free(value);
+}
@@ -0,0 +1,22 @@
+#ifndef __JSONWRITERMODEL__
+#define __JSONWRITERMODEL__
+
+#include "model.h"
+#include "jsonwriter.h"
+
+/**
+ * Writes the model as an object, one member per column of its schema in schema order,
+ * the value written by the MODEL_* type of the column. Same fields as model_stringify.
+ * @param writer  Writer
+ * @param model   Model, NULL is written as null
+ * @param fields  display_fields(...) of the columns to write, NULL for all
+ */
+void json_writer_model(json_writer_t* writer, void* model, char** fields);
+
+/**
+ * Same as json_writer_model without the braces, into an object opened by the caller,
+ * so that more members can follow the columns.
+ */
+void json_writer_model_fields(json_writer_t* writer, void* model, char** fields);
+
+#endif
@@ -1,11 +1,18 @@
 #include <string.h>
+#include <strings.h>
 #include <arpa/inet.h>
 
 #include "httpmiddlewares.h"
 #include "session.h"
+#include "sessioncache.h"
+#include "jwt.h"
+#include "ratelimitprofile.h"
+#include "jsonondemand.h"
 #include "query.h"
 #include "log.h"
 
+static int __ratelimit(httpctx_t* ctx, ratelimit_profile_t* profile, int cluster);
+
 int middleware_http_forbidden(httpctx_t* ctx) {
     ctx->response->send_default(ctx->response, 403);
 
@@ -44,62 +51,122 @@ int middleware_http_auth(httpctx_t *ctx) {
     }
 
     int result = 0;
-    json_doc_t* document = NULL;
-    char* session_data = session_get("backend", session_id);
+    char* session_data = sessioncache_get("backend", session_id);
     if (session_data == NULL) {
         ctx->response->send_data(ctx->response, "Session not found");
         return 0;
     }
 
-    document = json_parse(session_data);
-    if (document == NULL) {
-        ctx->response->send_data(ctx->response, "");
-        goto failed;
-    }
+    // Only user_id is needed, so the session is read in place without building a token tree
+    json_ondemand_t document;
+    json_od_init(&document, session_data, strlen(session_data));
+
+    // A single scan up to user_id, the root is examined again only to choose the error response
+    json_od_value_t value;
+    if (!json_od_find(&document, "user_id", &value) || value.type != JSON_OD_NUMBER) {
+        const json_od_type_e type = json_od_type(&document, "");
+        if (type == JSON_OD_NONE)
+            ctx->response->send_data(ctx->response, "");
+        else if (type != JSON_OD_OBJECT)
+            ctx->response->send_data(ctx->response, "Session data is not object");
+        else
+            ctx->response->send_data(ctx->response, "Session data is not valid");
 
-    json_token_t* object = json_root(document);
-    if (!json_is_object(object)) {
-        ctx->response->send_data(ctx->response, "Session data is not object");
-        goto failed;
-    }
-    json_token_t* token_user_id = json_object_get(object, "user_id");
-    if (!json_is_number(token_user_id)) {
-        ctx->response->send_data(ctx->response, "Session data is not valid");
         goto failed;
     }
 
     int ok = 0;
-    const int user_id = json_int(token_user_id, &ok);
+    const int user_id = json_od_value_int(&value, &ok);
     if (!ok || user_id < 1) {
         ctx->response->send_data(ctx->response, "User is not valid");
         goto failed;
     }
 
-    array_t* params = array_create();
-    if (params == NULL) {
-        ctx->response->send_data(ctx->response, "Error");
-        goto failed;
-    }
-
-    mparams_fill_array(params,
-        mparam_int(id, user_id)
-    );
-    user_t* user = user_get(params);
-    array_free(params);
-
-    if (user == NULL) {
+    principal_t* principal = principalcache_get(user_id);
+    if (principal == NULL) {
         ctx->response->send_data(ctx->response, "User not found");
         goto failed;
     }
 
-    httpctx_set_user(ctx, user);
+    httpctx_set_user(ctx, principal);
 
     result = 1;
 
     failed:
 
     free(session_data);
-    json_free(document);
 
     return result;
 }
+
+int middleware_http_ratelimit_profile(httpctx_t* ctx, const char* name) {
+    return __ratelimit(ctx, ratelimit_profile_get(name), 0);
+}
+
+int middleware_http_ratelimit_cluster_profile(httpctx_t* ctx, const char* name) {
+    return __ratelimit(ctx, ratelimit_profile_get(name), 1);
+}
+
+int middleware_http_jwt(httpctx_t* ctx) {
+    http_header_t* header = ctx->request->get_header(ctx->request, "Authorization");
+    if (header == NULL || header->value_length <= 7 || strncasecmp(header->value, "Bearer ", 7) != 0) {
+        ctx->response->add_header(ctx->response, "WWW-Authenticate", "Bearer");
+        ctx->response->send_default(ctx->response, 401);
+        return 0;
+    }
+
+    jwt_claims_t claims;
+    if (!jwt_verify(header->value + 7, &claims)) {
+        ctx->response->add_header(ctx->response, "WWW-Authenticate", "Bearer error=\"invalid_token\"");
+        ctx->response->send_default(ctx->response, 401);
+        return 0;
+    }
+
+    principal_t* principal = principalcache_get(claims.user_id);
+    if (principal == NULL) {
+        ctx->response->send_default(ctx->response, 401);
+        return 0;
+    }
+
+    httpctx_set_user(ctx, principal);
+
+    return 1;
+}
+
+int middleware_http_permission(httpctx_t* ctx, const char* permission) {
+    const principal_t* principal = httpctx_get_user(ctx);
+    if (principal == NULL) {
+        ctx->response->send_default(ctx->response, 401);
+        return 0;
+    }
+
+    if (!principal_has_permission(principal, rbac_permission(permission))) {
+        ctx->response->send_default(ctx->response, 403);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Requests without a profile are not limited.
+ * A profile that is not a cluster one is limited by every node on its own.
+ */
+int __ratelimit(httpctx_t* ctx, ratelimit_profile_t* profile, int cluster) {
+    if (profile == NULL) return 1;
+
+    const uint64_t key = ctx->request->connection->ip;
+    const int allowed = cluster && profile->cluster != NULL
+        ? clusterlimiter_allow(profile->cluster, key)
+        : ratelimiter_allow(profile->limiter, key);
+
+    if (allowed) return 1;
+
+    // A profile without refill never lets the client in again, there is nothing to wait for
+    if (profile->rate > 0)
+        ctx->response->add_header(ctx->response, "Retry-After", "1");
+
+    ctx->response->send_default(ctx->response, 429);
+
+    return 0;
+}
@@ -34,10 +34,51 @@ int middleware_http_query_param_required(httpctx_t* ctx, char** keys, int size);
  * Authentication middleware.
  * Validates session cookie and loads user data into context.
  * Checks: session_id cookie exists, session is valid, user_id in session, user exists in database.
- * On success, user is available via ctx->user_data (cast to user_t*).
+ * On success, the cached principal is available via httpctx_get_user(ctx).
  * @param ctx  HTTP context
  * @return 1 if authenticated, 0 on auth failure (stops chain)
  */
 int middleware_http_auth(httpctx_t* ctx);
 
+/**
+ * Per-IP rate limit with a named profile of main.env (see ratelimitprofile.h), called in a handler.
+ * The ratelimits of config.json are applied by the server itself, this is for limits of the application,
+ * e.g. by the user after authentication. An unknown profile does not limit.
+ * Responds 429 when the bucket of the client address is empty, with Retry-After if the profile refills.
+ * @param ctx   HTTP context
+ * @param name  Profile name, e.g. "login"
+ * @return 1 if allowed, 0 otherwise (stops chain)
+ */
+int middleware_http_ratelimit_profile(httpctx_t* ctx, const char* name);
+
+/**
+ * middleware_http_ratelimit_profile with buckets shared by all nodes through Redis (see clusterlimiter.h).
+ * Tokens are leased by the lease of the profile, so most requests never reach Redis.
+ * A profile without ratelimit_<name>_cluster is limited by every node on its own.
+ * @param ctx   HTTP context
+ * @param name  Profile name
+ * @return 1 if allowed, 0 otherwise (stops chain)
+ */
+int middleware_http_ratelimit_cluster_profile(httpctx_t* ctx, const char* name);
+
+/**
+ * Bearer token middleware.
+ * Verifies "Authorization: Bearer <token>" as HS256 JWT (see jwt.h) and loads the principal of "sub".
+ * Verified tokens are cached, a repeated token skips HMAC and JSON parsing.
+ * On success, the cached principal is available via httpctx_get_user(ctx).
+ * @param ctx  HTTP context
+ * @return 1 if authenticated, 0 on auth failure (stops chain)
+ */
+int middleware_http_jwt(httpctx_t* ctx);
+
+/**
+ * Permission middleware, goes after middleware_http_auth.
+ * Resolves the name to its interned index and tests one bit of the principal.
+ * Responds 401 without a principal, 403 if no role of the user grants the permission.
+ * @param ctx         HTTP context
+ * @param permission  Permission name, e.g. "posts.delete"
+ * @return 1 if permitted, 0 otherwise (stops chain)
+ */
+int middleware_http_permission(httpctx_t* ctx, const char* permission);
+
 #endif
@@ -28,6 +28,12 @@ int middlewares_init(void) {
         return 0;
     }
 
+    /* Register middleware_http_jwt */
+    if (!middleware_registry_register("middleware_http_jwt", (middleware_fn_p)middleware_http_jwt)) {
+        log_error("middlewares_init: failed to register middleware_http_jwt\n");
+        return 0;
+    }
+
     /* Add more middlewares here as needed:
      * if (!middleware_registry_register("middleware_cors", middleware_cors)) {
      *     log_error("middlewares_init: failed to register middleware_cors\n");
@@ -3,6 +3,8 @@
 
 #include "db.h"
 #include "permission.h"
+#include "querycache.h"
+#include "rbac.h"
 
 static const char* __dbid = "postgresql";
 
@@ -45,15 +47,30 @@ permission_t* permission_get(array_t* params) {
 }
 
 int permission_create(permission_t* permission) {
-    return model_create(__dbid, permission);
+    if (!model_create(__dbid, permission)) return 0;
+
+    querycache_invalidate(__permission_schema.table);
+    rbac_invalidate();
+
+    return 1;
 }
 
 int permission_update(permission_t* permission) {
-    return model_update(__dbid, permission);
+    if (!model_update(__dbid, permission)) return 0;
+
+    querycache_invalidate(__permission_schema.table);
+    rbac_invalidate();
+
+    return 1;
 }
 
 int permission_delete(permission_t* permission) {
-    return model_delete(__dbid, permission);
+    if (!model_delete(__dbid, permission)) return 0;
+
+    querycache_invalidate(__permission_schema.table);
+    rbac_invalidate();
+
+    return 1;
 }
 
 void permission_set_id(permission_t* permission, int id) {
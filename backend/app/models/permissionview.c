@@ -3,8 +3,10 @@
 
 #include "db.h"
 #include "permissionview.h"
+#include "querycache.h"
 
 static const char* __dbid = "postgresql";
+static const int __cache_ttl = 60;
 
 enum permissionview_column {
     PERMISSIONVIEW_COL_ID = 0,
@@ -40,7 +42,7 @@ void* permissionview_instance(void) {
 }
 
 permissionview_t* permissionview_get(array_t* params) {
-    return model_one(__dbid, permissionview_instance,
+    return querycache_model_one(__dbid, permissionview_instance, &__permissionview_schema,
         "SELECT "
             "id, "
             "name "
@@ -50,12 +52,12 @@ permissionview_t* permissionview_get(array_t* params) {
             "id = :id "
         "LIMIT 1"
         ,
-        params
+        params, __cache_ttl, cache_tags("permission")
     );
 }
 
 array_t* permissionview_list(array_t* params) {
-    return model_list(__dbid, permissionview_instance,
+    return querycache_model_list(__dbid, permissionview_instance, &__permissionview_schema,
         "SELECT "
             "permission.id, "
             "permission.name "
@@ -73,7 +75,7 @@ array_t* permissionview_list(array_t* params) {
         "ORDER BY "
             "permission.id ASC "
         ,
-        params
+        params, __cache_ttl, cache_tags("permission", "role_permission")
     );
 }
 
@@ -3,6 +3,8 @@
 
 #include "db.h"
 #include "role.h"
+#include "querycache.h"
+#include "rbac.h"
 
 static const char* __dbid = "postgresql";
 
@@ -45,15 +47,28 @@ role_t* role_get(array_t* params) {
 }
 
 int role_create(role_t* role) {
-    return model_create(__dbid, role);
+    if (!model_create(__dbid, role)) return 0;
+
+    querycache_invalidate(__role_schema.table);
+
+    return 1;
 }
 
 int role_update(role_t* role) {
-    return model_update(__dbid, role);
+    if (!model_update(__dbid, role)) return 0;
+
+    querycache_invalidate(__role_schema.table);
+
+    return 1;
 }
 
 int role_delete(role_t* role) {
-    return model_delete(__dbid, role);
+    if (!model_delete(__dbid, role)) return 0;
+
+    querycache_invalidate(__role_schema.table);
+    rbac_invalidate();
+
+    return 1;
 }
 
 void role_set_id(role_t* role, int id) {
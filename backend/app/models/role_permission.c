@@ -3,6 +3,8 @@
 
 #include "db.h"
 #include "role_permission.h"
+#include "querycache.h"
+#include "rbac.h"
 
 static const char* __dbid = "postgresql";
 
@@ -49,15 +51,30 @@ role_permission_t* role_permission_get(array_t* params) {
 }
 
 int role_permission_create(role_permission_t* role_permission) {
-    return model_create(__dbid, role_permission);
+    if (!model_create(__dbid, role_permission)) return 0;
+
+    querycache_invalidate(__role_permission_schema.table);
+    rbac_invalidate();
+
+    return 1;
 }
 
 int role_permission_update(role_permission_t* role_permission) {
-    return model_update(__dbid, role_permission);
+    if (!model_update(__dbid, role_permission)) return 0;
+
+    querycache_invalidate(__role_permission_schema.table);
+    rbac_invalidate();
+
+    return 1;
 }
 
 int role_permission_delete(role_permission_t* role_permission) {
-    return model_delete(__dbid, role_permission);
+    if (!model_delete(__dbid, role_permission)) return 0;
+
+    querycache_invalidate(__role_permission_schema.table);
+    rbac_invalidate();
+
+    return 1;
 }
 
 void role_permission_set_role_id(role_permission_t* role_permission, int role_id) {
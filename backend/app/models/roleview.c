@@ -3,8 +3,10 @@
 
 #include "db.h"
 #include "roleview.h"
+#include "querycache.h"
 
 static const char* __dbid = "postgresql";
+static const int __cache_ttl = 60;
 
 enum roleview_column {
     ROLEVIEW_COL_ID = 0,
@@ -40,7 +42,7 @@ void* roleview_instance(void) {
 }
 
 roleview_t* roleview_get(array_t* params) {
-    return model_one(__dbid, roleview_instance,
+    return querycache_model_one(__dbid, roleview_instance, &__roleview_schema,
         "SELECT "
             "id, "
             "name "
@@ -50,12 +52,12 @@ roleview_t* roleview_get(array_t* params) {
             "id = :id "
         "LIMIT 1"
         ,
-        params
+        params, __cache_ttl, cache_tags("role")
     );
 }
 
 array_t* roleview_list(array_t* params) {
-    return model_list(__dbid, roleview_instance,
+    return querycache_model_list(__dbid, roleview_instance, &__roleview_schema,
         "SELECT "
             "role.id, "
             "role.name "
@@ -73,7 +75,7 @@ array_t* roleview_list(array_t* params) {
         "ORDER BY "
             "role.id ASC "
         ,
-        params
+        params, __cache_ttl, cache_tags("role", "user_role")
     );
 }
 
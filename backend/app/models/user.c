@@ -4,6 +4,8 @@
 
 #include "db.h"
 #include "user.h"
+#include "querycache.h"
+#include "principalcache.h"
 #include "str.h"
 
 static const char* __dbid = "postgresql.p1";
@@ -73,15 +75,29 @@ user_t* user_get(array_t* params) {
 }
 
 int user_create(user_t* user) {
-    return model_create(__dbid, user);
+    if (!model_create(__dbid, user)) return 0;
+
+    querycache_invalidate(__user_schema.table);
+
+    return 1;
 }
 
 int user_update(user_t* user) {
-    return model_update(__dbid, user);
+    if (!model_update(__dbid, user)) return 0;
+
+    querycache_invalidate(__user_schema.table);
+    principalcache_invalidate(user_id(user));
+
+    return 1;
 }
 
 int user_delete(user_t* user) {
-    return model_delete(__dbid, user);
+    if (!model_delete(__dbid, user)) return 0;
+
+    querycache_invalidate(__user_schema.table);
+    principalcache_invalidate(user_id(user));
+
+    return 1;
 }
 
 void user_free(user_t* user) {
@@ -3,6 +3,8 @@
 
 #include "db.h"
 #include "user_role.h"
+#include "querycache.h"
+#include "rbac.h"
 
 static const char* __dbid = "postgresql";
 
@@ -49,15 +51,31 @@ user_role_t* user_role_get(array_t* params) {
 }
 
 int user_role_create(user_role_t* user_role) {
-    return model_create(__dbid, user_role);
+    if (!model_create(__dbid, user_role)) return 0;
+
+    querycache_invalidate(__user_role_schema.table);
+    rbac_invalidate_user(user_role_user_id(user_role));
+
+    return 1;
 }
 
 int user_role_update(user_role_t* user_role) {
-    return model_update(__dbid, user_role);
+    if (!model_update(__dbid, user_role)) return 0;
+
+    // The previous user_id is unknown here
+    querycache_invalidate(__user_role_schema.table);
+    rbac_invalidate_user(0);
+
+    return 1;
 }
 
 int user_role_delete(user_role_t* user_role) {
-    return model_delete(__dbid, user_role);
+    if (!model_delete(__dbid, user_role)) return 0;
+
+    querycache_invalidate(__user_role_schema.table);
+    rbac_invalidate_user(user_role_user_id(user_role));
+
+    return 1;
 }
 
 void user_role_set_user_id(user_role_t* user_role, int user_id) {
@@ -3,6 +3,9 @@
 
 #include "db.h"
 #include "userview.h"
+#include "querycache.h"
+
+static const int __cache_ttl = 30;
 
 enum userview_column {
     USERVIEW_COL_ID = 0,
@@ -40,7 +43,7 @@ void* userview_instance(void) {
 }
 
 userview_t* userview_get(array_t* params) {
-    return model_one(POSTGRESQL, userview_instance,
+    return querycache_model_one(POSTGRESQL, userview_instance, &__userview_schema,
         "SELECT "
             "id, "
             "name, "
@@ -50,7 +53,7 @@ userview_t* userview_get(array_t* params) {
         "WHERE "
             "id = :id "
         "LIMIT 1",
-        params
+        params, __cache_ttl, cache_tags("user")
     );
 }
 
@@ -80,6 +83,9 @@ int userview_execute(array_t* params) {
         params
     );
 
+    if (result)
+        querycache_invalidate(__userview_schema.table);
+
     return result;
 }
 
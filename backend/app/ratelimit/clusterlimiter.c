@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+
+#include "log.h"
+#include "redispipe.h"
+#include "clusterlimiter.h"
+
+#define CLUSTERLIMITER_TOKENS_MASK 0x7FFFFFULL
+#define CLUSTERLIMITER_DENIED (1ULL << 23)
+#define CLUSTERLIMITER_EXPIRES_SHIFT 24
+
+// Token bucket kept in a hash {t: last refill in ms, n: tokens}, time taken from the Redis server
+// so that clocks of the nodes do not matter. Returns the number of granted tokens.
+static const char* __script =
+    "local burst = tonumber(ARGV[1]) "
+    "local rate = tonumber(ARGV[2]) "
+    "local want = tonumber(ARGV[3]) "
+    "local time = redis.call('TIME') "
+    "local now = tonumber(time[1]) * 1000 + math.floor(tonumber(time[2]) / 1000) "
+    "local state = redis.call('HMGET', KEYS[1], 't', 'n') "
+    "local last = tonumber(state[1]) or now "
+    "local tokens = tonumber(state[2]) or burst "
+    "if rate > 0 and now > last then tokens = math.min(burst, tokens + (now - last) * rate / 1000) end "
+    "local granted = math.min(want, math.floor(tokens)) "
+    "redis.call('HSET', KEYS[1], 't', now, 'n', tokens - granted) "
+    "if rate > 0 then redis.call('PEXPIRE', KEYS[1], math.ceil(burst * 1000 / rate) + 1000) "
+    "else redis.call('PEXPIRE', KEYS[1], 86400000) end "
+    "return granted";
+
+static char __sha[41];
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+
+static void __init(void);
+static long long __now(void);
+static uint64_t __hash(uint64_t key);
+static clusterlimiter_slot_t* __slot(clusterlimiter_t* limiter, uint64_t key);
+static long long __lease(clusterlimiter_t* limiter, uint64_t key);
+static long long __eval(redisconn_t* conn, const char* command, const char* script, const char* key, const char* burst, const char* rate, const char* lease, int* noscript);
+
+clusterlimiter_t* clusterlimiter_create(const char* name, unsigned int burst, unsigned int rate, unsigned int lease, unsigned int tolerance, redisconn_t* conn, size_t sets_count) {
+    clusterlimiter_t* limiter = NULL;
+    if (name == NULL || strlen(name) >= sizeof(limiter->name)) goto invalid;
+    if (burst == 0 || lease == 0 || tolerance < lease || tolerance > CLUSTERLIMITER_TOKENS_MASK || sets_count == 0) goto invalid;
+
+    pthread_once(&__once, __init);
+
+    limiter = calloc(1, sizeof * limiter);
+    if (limiter == NULL) goto invalid;
+
+    strcpy(limiter->name, name);
+    limiter->burst = burst;
+    limiter->rate = rate;
+    limiter->lease = lease < burst ? lease : burst;
+    limiter->tolerance = tolerance;
+    limiter->sets_count = sets_count;
+    limiter->created_at = __now();
+    limiter->conn = conn;
+    limiter->sets = aligned_alloc(_Alignof(clusterlimiter_set_t), sets_count * sizeof(clusterlimiter_set_t));
+    if (limiter->sets == NULL) goto failed;
+
+    memset(limiter->sets, 0, sets_count * sizeof(clusterlimiter_set_t));
+
+    if (CLUSTERLIMITER_FAIL_OPEN) {
+        limiter->fallback = ratelimiter_create(burst, rate, sets_count);
+        if (limiter->fallback == NULL) goto failed;
+    }
+
+    return limiter;
+
+    failed:
+
+    clusterlimiter_free(limiter);
+
+    return NULL;
+
+    invalid:
+
+    redisconn_free(conn);
+
+    return NULL;
+}
+
+void clusterlimiter_free(clusterlimiter_t* limiter) {
+    if (limiter == NULL) return;
+
+    ratelimiter_free(limiter->fallback);
+    redisconn_free(limiter->conn);
+    free(limiter->sets);
+    free(limiter);
+}
+
+int clusterlimiter_allow(clusterlimiter_t* limiter, uint64_t key) {
+    if (limiter == NULL) return 1;
+
+    const uint64_t now = __now() - limiter->created_at;
+    clusterlimiter_slot_t* slot = __slot(limiter, key);
+
+    uint_fast64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+    while ((state >> CLUSTERLIMITER_EXPIRES_SHIFT) > now) {
+        // A flooding client is answered locally until the cluster bucket may have a token again
+        if (state & CLUSTERLIMITER_DENIED) return 0;
+        if ((state & CLUSTERLIMITER_TOKENS_MASK) == 0) break;
+
+        if (atomic_compare_exchange_weak(&slot->state, &state, state - 1))
+            return 1;
+    }
+
+    // Threads that miss the lease together lease together, the surplus stays in the slot
+    const long long granted = __lease(limiter, key);
+    if (granted < 0)
+        return CLUSTERLIMITER_FAIL_OPEN ? ratelimiter_allow(limiter->fallback, key) : 0;
+
+    if (granted == 0) {
+        const uint64_t wait = limiter->rate > 0 ? (1000 + limiter->rate - 1) / limiter->rate : CLUSTERLIMITER_LEASE_TTL;
+        atomic_store(&slot->state, ((now + wait) << CLUSTERLIMITER_EXPIRES_SHIFT) | CLUSTERLIMITER_DENIED);
+        return 0;
+    }
+
+    const uint64_t expires = (now + CLUSTERLIMITER_LEASE_TTL) << CLUSTERLIMITER_EXPIRES_SHIFT;
+
+    state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+    while (1) {
+        uint64_t tokens = (state >> CLUSTERLIMITER_EXPIRES_SHIFT) > now && !(state & CLUSTERLIMITER_DENIED) ? state & CLUSTERLIMITER_TOKENS_MASK : 0;
+        tokens += granted - 1;
+        if (tokens > limiter->tolerance)
+            tokens = limiter->tolerance;
+
+        if (atomic_compare_exchange_weak(&slot->state, &state, expires | tokens))
+            return 1;
+    }
+}
+
+void __init(void) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+
+    if (!EVP_Digest(__script, strlen(__script), digest, &size, EVP_sha1(), NULL)) {
+        log_error("clusterlimiter: can't hash script\n");
+        return;
+    }
+
+    for (unsigned int i = 0; i < size && i * 2 + 1 < sizeof(__sha); i++)
+        sprintf(__sha + i * 2, "%02x", digest[i]);
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+uint64_t __hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+/**
+ * @brief Finds the lease slot of the key, claiming a free one or the one whose lease expires first.
+ */
+clusterlimiter_slot_t* __slot(clusterlimiter_t* limiter, uint64_t key) {
+    clusterlimiter_set_t* set = &limiter->sets[__hash(key) % limiter->sets_count];
+    key++;
+
+    for (int i = 0; i < RATELIMITER_WAYS; i++)
+        if (atomic_load_explicit(&set->slots[i].key, memory_order_acquire) == key)
+            return &set->slots[i];
+
+    for (int i = 0; i < RATELIMITER_WAYS; i++) {
+        uint_fast64_t expected = 0;
+        if (atomic_compare_exchange_strong(&set->slots[i].key, &expected, key) || expected == key)
+            return &set->slots[i];
+    }
+
+    clusterlimiter_slot_t* victim = &set->slots[0];
+    for (int i = 1; i < RATELIMITER_WAYS; i++)
+        if (atomic_load(&set->slots[i].state) >> CLUSTERLIMITER_EXPIRES_SHIFT < atomic_load(&victim->state) >> CLUSTERLIMITER_EXPIRES_SHIFT)
+            victim = &set->slots[i];
+
+    // Leased tokens of an unexpired victim are lost, the cluster under-admits rather than over-admits
+    atomic_store(&victim->key, key);
+    atomic_store(&victim->state, 0);
+
+    return victim;
+}
+
+/**
+ * @brief Leases up to limiter->lease tokens of the key from Redis.
+ * @return Number of granted tokens, -1 if Redis is unreachable
+ */
+long long __lease(clusterlimiter_t* limiter, uint64_t key) {
+    // An unreachable server would cost every request a connect timeout
+    if (__now() < atomic_load(&limiter->unavailable_until)) return -1;
+
+    redisconn_t* conn = limiter->conn != NULL ? limiter->conn : redisconn_default();
+    if (conn == NULL) return -1;
+
+    char redis_key[128];
+    char burst[16];
+    char rate[16];
+    char lease[16];
+
+    snprintf(redis_key, sizeof(redis_key), CLUSTERLIMITER_PREFIX "%s:%llu", limiter->name, (unsigned long long)key);
+    snprintf(burst, sizeof(burst), "%u", limiter->burst);
+    snprintf(rate, sizeof(rate), "%u", limiter->rate);
+    snprintf(lease, sizeof(lease), "%u", limiter->lease);
+
+    int noscript = 0;
+    long long granted = -1;
+    if (__sha[0] != 0)
+        granted = __eval(conn, "EVALSHA", __sha, redis_key, burst, rate, lease, &noscript);
+
+    // The first call on a server, or after SCRIPT FLUSH, sends the body that the server then caches
+    if (__sha[0] == 0 || noscript)
+        granted = __eval(conn, "EVAL", __script, redis_key, burst, rate, lease, &noscript);
+
+    if (granted < 0)
+        atomic_store(&limiter->unavailable_until, __now() + CLUSTERLIMITER_RETRY_INTERVAL);
+
+    return granted;
+}
+
+long long __eval(redisconn_t* conn, const char* command, const char* script, const char* key, const char* burst, const char* rate, const char* lease, int* noscript) {
+    const char* argv[] = {command, script, "1", key, burst, rate, lease};
+    size_t argvlen[sizeof(argv) / sizeof(argv[0])];
+    for (size_t i = 0; i < sizeof(argv) / sizeof(argv[0]); i++)
+        argvlen[i] = strlen(argv[i]);
+
+    long long result = -1;
+    *noscript = 0;
+
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) return -1;
+
+    if (!redispipe_commandv(pipe, sizeof(argv) / sizeof(argv[0]), argv, argvlen)) goto failed;
+
+    if (!redispipe_exec(conn, pipe)) {
+        log_error("clusterlimiter: %s\n", redispipe_error(pipe));
+        goto failed;
+    }
+
+    const redisreply_t* reply = redispipe_reply(pipe, 0);
+    if (reply == NULL) goto failed;
+
+    if (reply->type == REDISREPLY_INTEGER)
+        result = reply->integer;
+    else if (reply->type == REDISREPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0)
+        *noscript = 1;
+    else if (reply->type == REDISREPLY_ERROR)
+        log_error("clusterlimiter: %s\n", reply->str);
+
+    failed:
+
+    redispipe_free(pipe);
+
+    return result;
+}
@@ -0,0 +1,77 @@
+#ifndef __CLUSTERLIMITER__
+#define __CLUSTERLIMITER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "ratelimiter.h"
+#include "redispipe.h"
+
+#define CLUSTERLIMITER_PREFIX "ratelimit:"
+// Defaults of ratelimit_<name>_lease and ratelimit_<name>_tolerance of a main.env profile.
+// Lease is the number of tokens taken from Redis per call, tolerance the most a node
+// keeps unspent, so a client exceeds the cluster burst by at most tolerance per node
+#define CLUSTERLIMITER_LEASE 5
+#define CLUSTERLIMITER_TOLERANCE CLUSTERLIMITER_LEASE
+// Milliseconds after which unspent leased tokens are dropped
+#define CLUSTERLIMITER_LEASE_TTL 1000
+// With Redis unreachable every node falls back to its own buckets of the same profile
+#define CLUSTERLIMITER_FAIL_OPEN 1
+// Milliseconds Redis is left alone after a failed call
+#define CLUSTERLIMITER_RETRY_INTERVAL 1000
+
+typedef struct clusterlimiter_slot {
+    // Key + 1, 0 marks a free slot
+    atomic_uint_fast64_t key;
+    // Lease expiration in milliseconds | denied flag | leased tokens left
+    atomic_uint_fast64_t state;
+} clusterlimiter_slot_t;
+
+typedef struct clusterlimiter_set {
+    _Alignas(64) clusterlimiter_slot_t slots[RATELIMITER_WAYS];
+} clusterlimiter_set_t;
+
+typedef struct clusterlimiter {
+    char name[64];
+    unsigned int burst;
+    unsigned int rate;
+    unsigned int lease;
+    unsigned int tolerance;
+    size_t sets_count;
+    long long created_at;
+    // Monotonic milliseconds until which Redis is not asked after a failure
+    atomic_llong unavailable_until;
+    // NULL means redisconn_default()
+    redisconn_t* conn;
+    clusterlimiter_set_t* sets;
+    ratelimiter_t* fallback;
+} clusterlimiter_t;
+
+/**
+ * Creates a profile whose buckets live in Redis and are shared by all nodes.
+ * Nodes lease tokens in batches, so Redis sees one call per lease, not per request.
+ * @param name        Profile name, part of the Redis keys
+ * @param burst       Bucket size
+ * @param rate        Tokens added per second, 0 means no refill
+ * @param lease       Tokens per lease, at most tolerance
+ * @param tolerance   Unspent tokens a node may hold, a surplus of concurrent leases is dropped
+ * @param conn        Server of the buckets, NULL for redisconn_default(). Owned by the limiter, also on failure
+ * @param sets_count  Number of local lease sets, each holds RATELIMITER_WAYS keys
+ * @return Limiter or NULL on failure
+ */
+clusterlimiter_t* clusterlimiter_create(const char* name, unsigned int burst, unsigned int rate, unsigned int lease, unsigned int tolerance, redisconn_t* conn, size_t sets_count);
+
+/**
+ * Frees the limiter and its connection, if it has one of its own.
+ */
+void clusterlimiter_free(clusterlimiter_t* limiter);
+
+/**
+ * Takes a token of the key from the local lease, leasing a new batch from Redis when it is spent.
+ * @param key  Client key, e.g. IPv4 address
+ * @return 1 if the request is allowed, 0 if the cluster-wide bucket is empty
+ */
+int clusterlimiter_allow(clusterlimiter_t* limiter, uint64_t key);
+
+#endif
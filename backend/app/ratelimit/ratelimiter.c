@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "ratelimiter.h"
+
+#define RATELIMITER_TOKEN 256ULL
+#define RATELIMITER_TOKENS_MASK 0xFFFFFFULL
+#define RATELIMITER_REFERENCED (1ULL << 24)
+#define RATELIMITER_TIME_SHIFT 25
+
+static long long __now(void);
+static uint64_t __hash(uint64_t key, uint64_t seed);
+static uint64_t __refill(const ratelimiter_t* limiter, uint64_t state, uint64_t now);
+static int __take(ratelimiter_t* limiter, ratelimiter_slot_t* slot, uint64_t now);
+static ratelimiter_slot_t* __evict(ratelimiter_t* limiter, ratelimiter_set_t* set, uint64_t key, uint64_t hash, uint64_t now);
+
+ratelimiter_t* ratelimiter_create(unsigned int burst, unsigned int rate, size_t sets_count) {
+    if (burst == 0 || burst > RATELIMITER_BURST_MAX || sets_count == 0) return NULL;
+
+    ratelimiter_t* limiter = malloc(sizeof * limiter);
+    if (limiter == NULL) return NULL;
+
+    limiter->burst = burst;
+    limiter->rate = rate;
+    limiter->sets_count = sets_count;
+    limiter->created_at = __now();
+    if (getrandom(&limiter->seed, sizeof(limiter->seed), 0) != sizeof(limiter->seed))
+        limiter->seed = ((uint64_t)getpid() << 32) ^ (uint64_t)limiter->created_at ^ (uint64_t)(uintptr_t)limiter;
+    limiter->sets = aligned_alloc(_Alignof(ratelimiter_set_t), sets_count * sizeof(ratelimiter_set_t));
+    if (limiter->sets == NULL) {
+        free(limiter);
+        return NULL;
+    }
+
+    memset(limiter->sets, 0, sets_count * sizeof(ratelimiter_set_t));
+
+    return limiter;
+}
+
+void ratelimiter_free(ratelimiter_t* limiter) {
+    if (limiter == NULL) return;
+
+    free(limiter->sets);
+    free(limiter);
+}
+
+int ratelimiter_allow(ratelimiter_t* limiter, uint64_t key) {
+    if (limiter == NULL) return 1;
+
+    // Starts at 1, state 0 is reserved for a bucket that has never been used
+    const uint64_t now = __now() - limiter->created_at + 1;
+    const uint64_t hash = __hash(key, limiter->seed);
+    ratelimiter_set_t* set = &limiter->sets[hash % limiter->sets_count];
+    key++;
+
+    for (int i = 0; i < RATELIMITER_WAYS; i++)
+        if (atomic_load_explicit(&set->slots[i].key, memory_order_acquire) == key)
+            return __take(limiter, &set->slots[i], now);
+
+    for (int i = 0; i < RATELIMITER_WAYS; i++) {
+        uint_fast64_t expected = 0;
+        if (atomic_compare_exchange_strong(&set->slots[i].key, &expected, key))
+            return __take(limiter, &set->slots[i], now);
+
+        // Another thread has just claimed the slot for the same key
+        if (expected == key)
+            return __take(limiter, &set->slots[i], now);
+    }
+
+    return __take(limiter, __evict(limiter, set, key, hash, now), now);
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+uint64_t __hash(uint64_t key, uint64_t seed) {
+    key ^= seed;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+/**
+ * @brief Tokens of the state at the given time, in 1/256 of a token.
+ * State 0 is a bucket that has never been used, it is full.
+ */
+uint64_t __refill(const ratelimiter_t* limiter, uint64_t state, uint64_t now) {
+    const uint64_t capacity = limiter->burst * RATELIMITER_TOKEN;
+    if (state == 0) return capacity;
+
+    const uint64_t tokens = state & RATELIMITER_TOKENS_MASK;
+    const uint64_t last = state >> RATELIMITER_TIME_SHIFT;
+    if (limiter->rate == 0 || now <= last) return tokens;
+
+    const uint64_t elapsed = now - last;
+    // Past this point the bucket is full anyway, the check also keeps the product below from overflowing
+    if (elapsed > (uint64_t)limiter->burst * 1000 / limiter->rate + 1) return capacity;
+
+    const uint64_t refilled = tokens + elapsed * limiter->rate * RATELIMITER_TOKEN / 1000;
+
+    return refilled < capacity ? refilled : capacity;
+}
+
+/**
+ * @brief Lazy refill and take in one CAS.
+ * A denied request leaves the time untouched, so the refill of a flooded bucket does not lose fractions.
+ */
+int __take(ratelimiter_t* limiter, ratelimiter_slot_t* slot, uint64_t now) {
+    uint_fast64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+
+    while (1) {
+        const uint64_t tokens = __refill(limiter, state, now);
+
+        if (tokens < RATELIMITER_TOKEN) {
+            if (state & RATELIMITER_REFERENCED) return 0;
+
+            if (atomic_compare_exchange_weak(&slot->state, &state, state | RATELIMITER_REFERENCED))
+                return 0;
+
+            continue;
+        }
+
+        const uint64_t desired = (now << RATELIMITER_TIME_SHIFT) | RATELIMITER_REFERENCED | (tokens - RATELIMITER_TOKEN);
+        if (atomic_compare_exchange_weak(&slot->state, &state, desired))
+            return 1;
+    }
+}
+
+/**
+ * @brief Chooses a victim in a full set with the CLOCK algorithm.
+ * A bucket that has refilled to the burst is taken first: evicting it loses nothing.
+ * Otherwise the hand, started at a position given by the hash, clears reference bits
+ * until it meets a bucket not used since the previous pass.
+ */
+ratelimiter_slot_t* __evict(ratelimiter_t* limiter, ratelimiter_set_t* set, uint64_t key, uint64_t hash, uint64_t now) {
+    const uint64_t capacity = limiter->burst * RATELIMITER_TOKEN;
+    const int start = (hash >> 32) % RATELIMITER_WAYS;
+    ratelimiter_slot_t* victim = NULL;
+
+    for (int i = 0; i < RATELIMITER_WAYS && victim == NULL; i++) {
+        ratelimiter_slot_t* slot = &set->slots[(start + i) % RATELIMITER_WAYS];
+        if (__refill(limiter, atomic_load(&slot->state), now) == capacity)
+            victim = slot;
+    }
+
+    for (int i = 0; i < RATELIMITER_WAYS * 2 && victim == NULL; i++) {
+        ratelimiter_slot_t* slot = &set->slots[(start + i) % RATELIMITER_WAYS];
+        const uint_fast64_t state = atomic_fetch_and(&slot->state, ~RATELIMITER_REFERENCED);
+        if (!(state & RATELIMITER_REFERENCED))
+            victim = slot;
+    }
+
+    if (victim == NULL)
+        victim = &set->slots[start];
+
+    // Rotating addresses through a full set must not buy a fresh burst each time,
+    // so the new key starts with the one token of this request and refills from now.
+    // A request of the previous key racing with the switch may take that token.
+    atomic_store(&victim->key, key);
+    atomic_store(&victim->state, (now << RATELIMITER_TIME_SHIFT) | RATELIMITER_TOKEN);
+
+    return victim;
+}
@@ -0,0 +1,55 @@
+#ifndef __RATELIMITER__
+#define __RATELIMITER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Sets of RATELIMITER_WAYS buckets, the number of tracked keys is bounded by SETS * WAYS
+#define RATELIMITER_SETS 8192
+#define RATELIMITER_WAYS 4
+#define RATELIMITER_BURST_MAX 65535
+
+typedef struct ratelimiter_slot {
+    // Key + 1, 0 marks a free slot
+    atomic_uint_fast64_t key;
+    // Milliseconds of the last take | CLOCK reference bit | tokens in 1/256
+    atomic_uint_fast64_t state;
+} ratelimiter_slot_t;
+
+// One set fills a cache line, threads working on different sets never share one
+typedef struct ratelimiter_set {
+    _Alignas(64) ratelimiter_slot_t slots[RATELIMITER_WAYS];
+} ratelimiter_set_t;
+
+typedef struct ratelimiter {
+    unsigned int burst;
+    unsigned int rate;
+    size_t sets_count;
+    long long created_at;
+    // Random per limiter, clients can't choose addresses that share a set
+    uint64_t seed;
+    ratelimiter_set_t* sets;
+} ratelimiter_t;
+
+/**
+ * Creates a table of token buckets.
+ * @param burst       Bucket size, up to RATELIMITER_BURST_MAX
+ * @param rate        Tokens added per second, 0 means no refill
+ * @param sets_count  Number of sets, each holds RATELIMITER_WAYS keys
+ * @return Limiter or NULL on failure
+ */
+ratelimiter_t* ratelimiter_create(unsigned int burst, unsigned int rate, size_t sets_count);
+
+void ratelimiter_free(ratelimiter_t* limiter);
+
+/**
+ * Takes a token from the bucket of the key. Never blocks, safe from any thread.
+ * When the set of the key is full, an idle bucket is evicted by the CLOCK algorithm
+ * and the key gets a bucket with one token: an evicted client does not come back with a full burst.
+ * @param key  Client key, e.g. IPv4 address
+ * @return 1 if the request is allowed, 0 if the bucket is empty
+ */
+int ratelimiter_allow(ratelimiter_t* limiter, uint64_t key);
+
+#endif
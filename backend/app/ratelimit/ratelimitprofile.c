@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "log.h"
+#include "appconfig.h"
+#include "ratelimitprofile.h"
+
+static ratelimit_profile_t __profiles[RATELIMIT_PROFILES_MAX];
+static atomic_int __profiles_count = 0;
+static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ratelimit_profile_t* __find(const char* name);
+static void __profile_load(ratelimit_profile_t* profile, const char* name);
+static int __env_int(const char* name, const char* option, int value);
+
+ratelimit_profile_t* ratelimit_profile_get(const char* name) {
+    if (name == NULL || strlen(name) >= RATELIMIT_PROFILE_NAME_MAX) return NULL;
+
+    ratelimit_profile_t* profile = __find(name);
+    if (profile != NULL) goto done;
+
+    pthread_mutex_lock(&__mutex);
+
+    profile = __find(name);
+    if (profile == NULL) {
+        const int count = atomic_load(&__profiles_count);
+        if (count == RATELIMIT_PROFILES_MAX) {
+            pthread_mutex_unlock(&__mutex);
+            log_error("ratelimit: too many profiles, \"%s\" is not limited\n", name);
+            return NULL;
+        }
+
+        profile = &__profiles[count];
+        __profile_load(profile, name);
+
+        // Readers walk the profiles without the mutex up to the published count
+        atomic_store(&__profiles_count, count + 1);
+    }
+
+    pthread_mutex_unlock(&__mutex);
+
+    done:
+
+    return profile->limiter != NULL ? profile : NULL;
+}
+
+ratelimit_profile_t* __find(const char* name) {
+    const int count = atomic_load(&__profiles_count);
+    for (int i = 0; i < count; i++)
+        if (strcmp(__profiles[i].name, name) == 0)
+            return &__profiles[i];
+
+    return NULL;
+}
+
+/**
+ * @brief Builds the buckets of the profile from main.env.
+ * A name without a valid burst is kept without a limiter, so main.env is read once per name.
+ */
+void __profile_load(ratelimit_profile_t* profile, const char* name) {
+    strcpy(profile->name, name);
+
+    const int burst = __env_int(name, "burst", 0);
+    const int rate = __env_int(name, "rate", 0);
+    if (burst < 1 || burst > RATELIMITER_BURST_MAX || rate < 0) {
+        log_error("ratelimit: profile \"%s\" needs %s%s_burst from 1 to %d and %s%s_rate >= 0 in main.env\n",
+            name, RATELIMIT_ENV_PREFIX, name, RATELIMITER_BURST_MAX, RATELIMIT_ENV_PREFIX, name);
+        return;
+    }
+
+    profile->burst = burst;
+    profile->rate = rate;
+    profile->limiter = ratelimiter_create(burst, rate, RATELIMITER_SETS);
+    if (profile->limiter == NULL) {
+        log_error("ratelimit: can't create limiter of profile \"%s\"\n", name);
+        return;
+    }
+
+    char key[sizeof(RATELIMIT_ENV_PREFIX) + RATELIMIT_PROFILE_NAME_MAX + 16];
+    snprintf(key, sizeof(key), "%s%s_cluster", RATELIMIT_ENV_PREFIX, name);
+    if (!env_get_bool(key, 0)) return;
+
+    const int lease = __env_int(name, "lease", CLUSTERLIMITER_LEASE);
+    const int tolerance = __env_int(name, "tolerance", lease > CLUSTERLIMITER_TOLERANCE ? lease : CLUSTERLIMITER_TOLERANCE);
+    if (lease < 0 || tolerance < 0) {
+        log_error("ratelimit: profile \"%s\" needs non-negative lease and tolerance, it is limited per node\n", name);
+        return;
+    }
+
+    // The buckets live on the server of the redispipe_* keys of main.env
+    profile->cluster = clusterlimiter_create(name, burst, rate, lease, tolerance, NULL, RATELIMITER_SETS);
+    if (profile->cluster == NULL)
+        log_error("ratelimit: can't create cluster limiter of profile \"%s\", it is limited per node\n", name);
+}
+
+int __env_int(const char* name, const char* option, int value) {
+    char key[sizeof(RATELIMIT_ENV_PREFIX) + RATELIMIT_PROFILE_NAME_MAX + 16];
+    snprintf(key, sizeof(key), "%s%s_%s", RATELIMIT_ENV_PREFIX, name, option);
+
+    return env_get_int(key, value);
+}
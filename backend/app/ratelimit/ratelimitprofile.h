@@ -0,0 +1,33 @@
+#ifndef __RATELIMITPROFILE__
+#define __RATELIMITPROFILE__
+
+#include "ratelimiter.h"
+#include "clusterlimiter.h"
+
+#define RATELIMIT_PROFILE_NAME_MAX 64
+#define RATELIMIT_PROFILES_MAX 32
+// Keys of main.env are RATELIMIT_ENV_PREFIX<name>_burst, _rate, _cluster, _lease and _tolerance
+#define RATELIMIT_ENV_PREFIX "ratelimit_"
+
+// A profile of main.env with its buckets
+typedef struct ratelimit_profile {
+    char name[RATELIMIT_PROFILE_NAME_MAX];
+    unsigned int burst;
+    unsigned int rate;
+    // NULL if main.env has no burst for the name, such a profile does not limit
+    ratelimiter_t* limiter;
+    // Buckets shared by all nodes, NULL if the profile is not a cluster one
+    clusterlimiter_t* cluster;
+} ratelimit_profile_t;
+
+/**
+ * Finds a profile of main.env, e.g. for "login" the keys ratelimit_login_burst (required, >= 1),
+ * ratelimit_login_rate (tokens per second, 0 by default) and, for buckets shared through Redis,
+ * ratelimit_login_cluster (true) with optional ratelimit_login_lease and ratelimit_login_tolerance.
+ * A profile is built on the first request of its name and kept for the life of the process.
+ * @param name  Profile name
+ * @return Profile or NULL if it is not defined
+ */
+ratelimit_profile_t* ratelimit_profile_get(const char* name);
+
+#endif
@@ -0,0 +1,812 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "log.h"
+#include "appconfig.h"
+#include "redispipe.h"
+
+#define REDISPIPE_READ_CHUNK 16384
+#define REDISPIPE_IOV_MAX 64
+#define REDISPIPE_MESSAGE_NODES 8
+
+struct redispipe {
+    struct redispipe* next;
+    char* out;
+    size_t out_size;
+    size_t out_capacity;
+    size_t commands;
+    size_t expected;
+    int transaction;
+    int done;
+    int ok;
+    char* raw;
+    size_t raw_size;
+    size_t nodes;
+    redisreply_t* replies;
+    char error[128];
+};
+
+struct redisconn {
+    char ip[64];
+    char user[64];
+    char password[128];
+    unsigned short port;
+    int dbindex;
+    int fd;
+    char* in;
+    size_t in_size;
+    size_t in_capacity;
+    int busy;
+    atomic_int stop;
+    redispipe_t* head;
+    redispipe_t* tail;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static redisconn_t* __default_conn = NULL;
+static pthread_once_t __default_once = PTHREAD_ONCE_INIT;
+
+static int __out_reserve(redispipe_t* pipe, size_t size);
+static int __out_append(redispipe_t* pipe, const char* data, size_t size);
+static int __encode(redispipe_t* pipe, int argc, const char** argv, const size_t* argvlen);
+static void __pipe_fail(redispipe_t* pipe, const char* error);
+static int __connect(redisconn_t* conn, char* error, size_t error_size);
+static void __disconnect(redisconn_t* conn);
+static int __write_batch(redisconn_t* conn, redispipe_t* batch);
+static int __recv(redisconn_t* conn);
+static int __read_more(redisconn_t* conn);
+static long __frame(const char* data, size_t size, size_t* nodes);
+static const char* __parse(char* data, redisreply_t* reply, redisreply_t** pool);
+static int __read_replies(redisconn_t* conn, redispipe_t* pipe);
+static int __exchange(redisconn_t* conn, redispipe_t* batch);
+static int __subscribe(redisconn_t* conn, const char* pattern);
+static int __listen(redisconn_t* conn, redismessage_fn handler, void* arg);
+static void __default_create(void);
+
+redisconn_t* redisconn_create(const char* ip, unsigned short port, int dbindex, const char* user, const char* password) {
+    redisconn_t* conn = calloc(1, sizeof * conn);
+    if (conn == NULL) return NULL;
+
+    snprintf(conn->ip, sizeof(conn->ip), "%s", ip);
+    snprintf(conn->user, sizeof(conn->user), "%s", user ? user : "");
+    snprintf(conn->password, sizeof(conn->password), "%s", password ? password : "");
+    conn->port = port;
+    conn->dbindex = dbindex;
+    conn->fd = -1;
+    pthread_mutex_init(&conn->mutex, NULL);
+    pthread_cond_init(&conn->cond, NULL);
+
+    return conn;
+}
+
+redisconn_t* redisconn_config(void) {
+    const char* ip = env_get_string(REDISPIPE_IP_ENV, NULL);
+    if (ip == NULL || ip[0] == 0) {
+        log_error("redisconn_config: main.env.%s is not set\n", REDISPIPE_IP_ENV);
+        return NULL;
+    }
+
+    const int port = env_get_int(REDISPIPE_PORT_ENV, REDISPIPE_PORT);
+    if (port <= 0 || port > 65535) {
+        log_error("redisconn_config: main.env.%s is not a port\n", REDISPIPE_PORT_ENV);
+        return NULL;
+    }
+
+    return redisconn_create(
+        ip,
+        port,
+        env_get_int(REDISPIPE_DBINDEX_ENV, 0),
+        env_get_string(REDISPIPE_USER_ENV, NULL),
+        env_get_string(REDISPIPE_PASSWORD_ENV, NULL)
+    );
+}
+
+redisconn_t* redisconn_default(void) {
+    pthread_once(&__default_once, __default_create);
+
+    return __default_conn;
+}
+
+void redisconn_free(redisconn_t* conn) {
+    if (conn == NULL) return;
+
+    __disconnect(conn);
+    pthread_mutex_destroy(&conn->mutex);
+    pthread_cond_destroy(&conn->cond);
+    free(conn->in);
+    free(conn);
+}
+
+int redisconn_psubscribe(redisconn_t* conn, const char* pattern, redismessage_fn handler, void* arg) {
+    if (conn == NULL || pattern == NULL || handler == NULL) return 0;
+
+    atomic_store(&conn->stop, 0);
+
+    while (!atomic_load(&conn->stop)) {
+        if (__subscribe(conn, pattern) && __listen(conn, handler, arg))
+            continue;
+
+        __disconnect(conn);
+        if (!atomic_load(&conn->stop))
+            sleep(1);
+    }
+
+    __disconnect(conn);
+
+    return 1;
+}
+
+void redisconn_unsubscribe(redisconn_t* conn) {
+    if (conn == NULL) return;
+
+    atomic_store(&conn->stop, 1);
+}
+
+redispipe_t* redispipe_create(void) {
+    return calloc(1, sizeof(redispipe_t));
+}
+
+redispipe_t* redispipe_create_transaction(void) {
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) return NULL;
+
+    const char* argv[] = {"MULTI"};
+    const size_t argvlen[] = {5};
+    if (!__encode(pipe, 1, argv, argvlen)) {
+        redispipe_free(pipe);
+        return NULL;
+    }
+
+    pipe->transaction = 1;
+
+    return pipe;
+}
+
+int redispipe_command(redispipe_t* pipe, const char* command) {
+    if (pipe == NULL || command == NULL) return 0;
+
+    const char* argv[64];
+    size_t argvlen[64];
+    int argc = 0;
+
+    const char* p = command;
+    while (*p) {
+        while (*p == ' ') p++;
+        if (*p == 0) break;
+
+        if (argc == 64) {
+            log_error("redispipe_command: too many arguments\n");
+            return 0;
+        }
+
+        const char* start = p;
+        while (*p && *p != ' ') p++;
+
+        argv[argc] = start;
+        argvlen[argc] = p - start;
+        argc++;
+    }
+
+    return redispipe_commandv(pipe, argc, argv, argvlen);
+}
+
+int redispipe_commandv(redispipe_t* pipe, int argc, const char** argv, const size_t* argvlen) {
+    if (pipe == NULL || argc <= 0 || argv == NULL) return 0;
+    if (pipe->expected > 0) {
+        log_error("redispipe_commandv: pipeline already executed\n");
+        return 0;
+    }
+
+    if (!__encode(pipe, argc, argv, argvlen)) return 0;
+
+    pipe->commands++;
+
+    return 1;
+}
+
+int redispipe_exec(redisconn_t* conn, redispipe_t* pipe) {
+    if (pipe == NULL) return 0;
+    if (conn == NULL) {
+        __pipe_fail(pipe, "redis connection is not configured");
+        return 0;
+    }
+    if (pipe->expected > 0) return pipe->ok;
+
+    if (pipe->transaction) {
+        const char* argv[] = {"EXEC"};
+        const size_t argvlen[] = {4};
+        if (!__encode(pipe, 1, argv, argvlen)) return 0;
+
+        pipe->expected = pipe->commands + 2;
+    }
+    else {
+        pipe->expected = pipe->commands;
+    }
+
+    if (pipe->expected == 0) {
+        pipe->ok = 1;
+        return 1;
+    }
+
+    pthread_mutex_lock(&conn->mutex);
+
+    pipe->next = NULL;
+    if (conn->tail) conn->tail->next = pipe;
+    else conn->head = pipe;
+    conn->tail = pipe;
+
+    // The first thread to find the connection idle flushes everything queued so far,
+    // the rest wait for their replies. Requests queued during the exchange form the next batch.
+    while (!pipe->done) {
+        if (conn->busy) {
+            pthread_cond_wait(&conn->cond, &conn->mutex);
+            continue;
+        }
+
+        redispipe_t* batch = conn->head;
+        conn->head = NULL;
+        conn->tail = NULL;
+        conn->busy = 1;
+        pthread_mutex_unlock(&conn->mutex);
+
+        __exchange(conn, batch);
+
+        pthread_mutex_lock(&conn->mutex);
+        for (redispipe_t* item = batch; item; item = item->next)
+            item->done = 1;
+
+        conn->busy = 0;
+        pthread_cond_broadcast(&conn->cond);
+    }
+
+    pthread_mutex_unlock(&conn->mutex);
+
+    return pipe->ok;
+}
+
+size_t redispipe_count(redispipe_t* pipe) {
+    if (pipe == NULL) return 0;
+
+    return pipe->commands;
+}
+
+const redisreply_t* redispipe_reply(redispipe_t* pipe, size_t index) {
+    if (pipe == NULL || !pipe->ok || index >= pipe->commands) return NULL;
+
+    if (!pipe->transaction)
+        return &pipe->replies[index];
+
+    const redisreply_t* exec = &pipe->replies[pipe->commands + 1];
+    if (exec->type != REDISREPLY_ARRAY || index >= exec->elements)
+        return NULL;
+
+    return &exec->element[index];
+}
+
+const char* redispipe_error(redispipe_t* pipe) {
+    if (pipe == NULL) return "pipeline is NULL";
+
+    return pipe->error;
+}
+
+void redispipe_free(redispipe_t* pipe) {
+    if (pipe == NULL) return;
+
+    free(pipe->out);
+    free(pipe->raw);
+    free(pipe->replies);
+    free(pipe);
+}
+
+int __out_reserve(redispipe_t* pipe, size_t size) {
+    if (pipe->out_size + size <= pipe->out_capacity) return 1;
+
+    size_t capacity = pipe->out_capacity ? pipe->out_capacity : 256;
+    while (capacity < pipe->out_size + size)
+        capacity *= 2;
+
+    char* data = realloc(pipe->out, capacity);
+    if (data == NULL) return 0;
+
+    pipe->out = data;
+    pipe->out_capacity = capacity;
+
+    return 1;
+}
+
+int __out_append(redispipe_t* pipe, const char* data, size_t size) {
+    if (!__out_reserve(pipe, size)) return 0;
+
+    memcpy(pipe->out + pipe->out_size, data, size);
+    pipe->out_size += size;
+
+    return 1;
+}
+
+int __encode(redispipe_t* pipe, int argc, const char** argv, const size_t* argvlen) {
+    // A command that does not fit is removed whole, the queued ones stay intact
+    const size_t out_size = pipe->out_size;
+
+    char header[32];
+    int length = snprintf(header, sizeof(header), "*%d\r\n", argc);
+    if (!__out_append(pipe, header, length)) goto failed;
+
+    for (int i = 0; i < argc; i++) {
+        const size_t size = argvlen ? argvlen[i] : strlen(argv[i]);
+
+        length = snprintf(header, sizeof(header), "$%zu\r\n", size);
+        if (!__out_reserve(pipe, length + size + 2)) goto failed;
+
+        __out_append(pipe, header, length);
+        __out_append(pipe, argv[i], size);
+        __out_append(pipe, "\r\n", 2);
+    }
+
+    return 1;
+
+    failed:
+
+    pipe->out_size = out_size;
+
+    return 0;
+}
+
+void __pipe_fail(redispipe_t* pipe, const char* error) {
+    pipe->ok = 0;
+    snprintf(pipe->error, sizeof(pipe->error), "%s", error);
+}
+
+int __connect(redisconn_t* conn, char* error, size_t error_size) {
+    if (conn->fd >= 0) return 1;
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char port[8];
+    snprintf(port, sizeof(port), "%u", conn->port);
+
+    struct addrinfo* result = NULL;
+    if (getaddrinfo(conn->ip, port, &hints, &result) != 0) {
+        snprintf(error, error_size, "can't resolve %s", conn->ip);
+        return 0;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        snprintf(error, error_size, "can't connect to %s:%u", conn->ip, conn->port);
+        return 0;
+    }
+
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    struct timeval timeout = { .tv_sec = REDISPIPE_TIMEOUT, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    conn->fd = fd;
+    conn->in_size = 0;
+
+    if (conn->password[0] == 0 && conn->dbindex == 0) return 1;
+
+    // AUTH and SELECT go through the regular path as a private pipeline
+    redispipe_t* setup = redispipe_create();
+    if (setup == NULL) goto failed;
+
+    if (conn->password[0]) {
+        if (conn->user[0]) {
+            const char* argv[] = {"AUTH", conn->user, conn->password};
+            if (!redispipe_commandv(setup, 3, argv, NULL)) goto failed;
+        }
+        else {
+            const char* argv[] = {"AUTH", conn->password};
+            if (!redispipe_commandv(setup, 2, argv, NULL)) goto failed;
+        }
+    }
+
+    if (conn->dbindex != 0) {
+        char dbindex[16];
+        snprintf(dbindex, sizeof(dbindex), "%d", conn->dbindex);
+
+        const char* argv[] = {"SELECT", dbindex};
+        if (!redispipe_commandv(setup, 2, argv, NULL)) goto failed;
+    }
+
+    setup->expected = setup->commands;
+    if (!__exchange(conn, setup)) goto failed;
+
+    for (size_t i = 0; i < setup->commands; i++) {
+        if (setup->replies[i].type == REDISREPLY_ERROR) {
+            snprintf(error, error_size, "%s", setup->replies[i].str);
+            goto failed;
+        }
+    }
+
+    redispipe_free(setup);
+
+    return 1;
+
+    failed:
+
+    if (setup && error[0] == 0)
+        snprintf(error, error_size, "%s", setup->error);
+
+    redispipe_free(setup);
+    __disconnect(conn);
+
+    return 0;
+}
+
+void __disconnect(redisconn_t* conn) {
+    if (conn->fd >= 0)
+        close(conn->fd);
+
+    conn->fd = -1;
+    conn->in_size = 0;
+}
+
+int __write_batch(redisconn_t* conn, redispipe_t* batch) {
+    struct iovec iov[REDISPIPE_IOV_MAX];
+    redispipe_t* item = batch;
+    size_t offset = 0;
+
+    while (item) {
+        int count = 0;
+        redispipe_t* cursor = item;
+        size_t cursor_offset = offset;
+        for (; cursor && count < REDISPIPE_IOV_MAX; cursor = cursor->next) {
+            iov[count].iov_base = cursor->out + cursor_offset;
+            iov[count].iov_len = cursor->out_size - cursor_offset;
+            cursor_offset = 0;
+            count++;
+        }
+
+        struct msghdr message = {0};
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+
+        const ssize_t written = sendmsg(conn->fd, &message, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+
+        size_t left = written;
+        while (item && left >= item->out_size - offset) {
+            left -= item->out_size - offset;
+            offset = 0;
+            item = item->next;
+        }
+        offset += left;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Reads available data into the connection buffer.
+ * @return 1 if data was read, 0 on receive timeout, -1 on error or closed connection
+ */
+int __recv(redisconn_t* conn) {
+    if (conn->in_capacity - conn->in_size < REDISPIPE_READ_CHUNK) {
+        size_t capacity = conn->in_capacity ? conn->in_capacity * 2 : REDISPIPE_READ_CHUNK * 2;
+        char* data = realloc(conn->in, capacity);
+        if (data == NULL) return -1;
+
+        conn->in = data;
+        conn->in_capacity = capacity;
+    }
+
+    while (1) {
+        const ssize_t readed = recv(conn->fd, conn->in + conn->in_size, conn->in_capacity - conn->in_size, 0);
+        if (readed > 0) {
+            conn->in_size += readed;
+            return 1;
+        }
+        if (readed < 0 && errno == EINTR) continue;
+        if (readed < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+
+        return -1;
+    }
+}
+
+int __read_more(redisconn_t* conn) {
+    return __recv(conn) > 0;
+}
+
+/**
+ * @brief Measures a complete RESP reply without copying it.
+ * @return Reply size in bytes, 0 if more data is needed, -1 on protocol error
+ */
+long __frame(const char* data, size_t size, size_t* nodes) {
+    const char* end = memchr(data, '\n', size);
+    if (end == NULL) return 0;
+    if (end == data || end[-1] != '\r') return -1;
+
+    const size_t line = end - data + 1;
+    (*nodes)++;
+
+    switch (data[0]) {
+    case '+':
+    case '-':
+    case ':':
+        return line;
+    case '$':
+    {
+        const long long length = strtoll(data + 1, NULL, 10);
+        if (length < 0) return line;
+        if (size < line + length + 2) return 0;
+
+        return line + length + 2;
+    }
+    case '*':
+    {
+        const long long count = strtoll(data + 1, NULL, 10);
+        size_t offset = line;
+        for (long long i = 0; i < count; i++) {
+            const long result = __frame(data + offset, size - offset, nodes);
+            if (result <= 0) return result;
+
+            offset += result;
+        }
+
+        return offset;
+    }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Builds a reply tree over a complete, already framed buffer.
+ * String payloads are terminated in place by overwriting the trailing '\r'.
+ * Array elements are taken from the pool as one contiguous block.
+ * @return Pointer past the parsed reply
+ */
+const char* __parse(char* data, redisreply_t* reply, redisreply_t** pool) {
+    char* end = strchr(data, '\r');
+    const char* next = end + 2;
+
+    switch (data[0]) {
+    case '+':
+    case '-':
+        *end = 0;
+        reply->type = data[0] == '+' ? REDISREPLY_STATUS : REDISREPLY_ERROR;
+        reply->str = data + 1;
+        reply->len = end - data - 1;
+        return next;
+    case ':':
+        reply->type = REDISREPLY_INTEGER;
+        reply->integer = strtoll(data + 1, NULL, 10);
+        return next;
+    case '$':
+    {
+        const long long length = strtoll(data + 1, NULL, 10);
+        if (length < 0) {
+            reply->type = REDISREPLY_NIL;
+            return next;
+        }
+
+        char* payload = (char*)next;
+        payload[length] = 0;
+        reply->type = REDISREPLY_STRING;
+        reply->str = payload;
+        reply->len = length;
+        return next + length + 2;
+    }
+    case '*':
+    {
+        const long long count = strtoll(data + 1, NULL, 10);
+        if (count < 0) {
+            reply->type = REDISREPLY_NIL;
+            return next;
+        }
+
+        reply->type = REDISREPLY_ARRAY;
+        reply->elements = count;
+        reply->element = *pool;
+        *pool += count;
+
+        for (long long i = 0; i < count; i++)
+            next = __parse((char*)next, &reply->element[i], pool);
+
+        return next;
+    }
+    }
+
+    return next;
+}
+
+int __read_replies(redisconn_t* conn, redispipe_t* pipe) {
+    // Replies of one pipeline are adjacent in the stream: frame them in the
+    // connection buffer, then move the whole span into the pipeline with one copy.
+    size_t offset = 0;
+    size_t nodes = 0;
+
+    for (size_t i = 0; i < pipe->expected;) {
+        size_t reply_nodes = 0;
+        const long result = __frame(conn->in + offset, conn->in_size - offset, &reply_nodes);
+        if (result < 0) {
+            __pipe_fail(pipe, "protocol error");
+            return 0;
+        }
+        if (result == 0) {
+            if (!__read_more(conn)) {
+                __pipe_fail(pipe, "connection lost");
+                return 0;
+            }
+            continue;
+        }
+
+        offset += result;
+        nodes += reply_nodes;
+        i++;
+    }
+
+    pipe->raw = malloc(offset + 1);
+    pipe->replies = calloc(nodes, sizeof(redisreply_t));
+    if (pipe->raw == NULL || pipe->replies == NULL) {
+        __pipe_fail(pipe, "out of memory");
+        return 0;
+    }
+
+    memcpy(pipe->raw, conn->in, offset);
+    pipe->raw[offset] = 0;
+    pipe->raw_size = offset;
+    pipe->nodes = nodes;
+
+    conn->in_size -= offset;
+    if (conn->in_size > 0)
+        memmove(conn->in, conn->in + offset, conn->in_size);
+
+    redisreply_t* pool = pipe->replies + pipe->expected;
+    const char* cursor = pipe->raw;
+    for (size_t i = 0; i < pipe->expected; i++)
+        cursor = __parse((char*)cursor, &pipe->replies[i], &pool);
+
+    if (pipe->transaction) {
+        const redisreply_t* exec = &pipe->replies[pipe->commands + 1];
+        if (exec->type != REDISREPLY_ARRAY) {
+            __pipe_fail(pipe, exec->type == REDISREPLY_ERROR ? exec->str : "transaction aborted");
+            return 1;
+        }
+    }
+
+    pipe->ok = 1;
+
+    return 1;
+}
+
+int __exchange(redisconn_t* conn, redispipe_t* batch) {
+    char error[128] = {0};
+
+    if (!__connect(conn, error, sizeof(error))) {
+        log_error("redispipe: %s\n", error);
+        for (redispipe_t* item = batch; item; item = item->next)
+            __pipe_fail(item, error);
+
+        return 0;
+    }
+
+    if (!__write_batch(conn, batch)) {
+        log_error("redispipe: write to %s:%u failed\n", conn->ip, conn->port);
+        for (redispipe_t* item = batch; item; item = item->next)
+            __pipe_fail(item, "write failed");
+
+        __disconnect(conn);
+        return 0;
+    }
+
+    for (redispipe_t* item = batch; item; item = item->next) {
+        if (__read_replies(conn, item)) continue;
+
+        // The stream position is unknown after a failed read, drop the connection
+        log_error("redispipe: %s\n", item->error);
+        for (redispipe_t* rest = item->next; rest; rest = rest->next)
+            __pipe_fail(rest, item->error);
+
+        __disconnect(conn);
+        return 0;
+    }
+
+    return 1;
+}
+
+int __subscribe(redisconn_t* conn, const char* pattern) {
+    char error[128] = {0};
+    if (!__connect(conn, error, sizeof(error))) {
+        log_error("redispipe: %s\n", error);
+        return 0;
+    }
+
+    redispipe_t* pipe = redispipe_create();
+    if (pipe == NULL) return 0;
+
+    const char* argv[] = {"PSUBSCRIBE", pattern};
+    int result = redispipe_commandv(pipe, 2, argv, NULL) && __write_batch(conn, pipe);
+
+    redispipe_free(pipe);
+
+    return result;
+}
+
+/**
+ * @brief Delivers Pub/Sub messages straight from the connection buffer.
+ * The subscription confirmation and other non-message replies are skipped.
+ * @return 1 if stopped by redisconn_unsubscribe, 0 on connection or protocol error
+ */
+int __listen(redisconn_t* conn, redismessage_fn handler, void* arg) {
+    size_t offset = 0;
+
+    while (!atomic_load(&conn->stop)) {
+        size_t nodes = 0;
+        const long size = offset < conn->in_size ? __frame(conn->in + offset, conn->in_size - offset, &nodes) : 0;
+        if (size < 0) {
+            log_error("redispipe: protocol error in subscription\n");
+            return 0;
+        }
+        if (size == 0) {
+            conn->in_size -= offset;
+            if (conn->in_size > 0)
+                memmove(conn->in, conn->in + offset, conn->in_size);
+            offset = 0;
+
+            if (__recv(conn) < 0) return 0;
+            continue;
+        }
+
+        char* data = conn->in + offset;
+        offset += size;
+
+        if (nodes > REDISPIPE_MESSAGE_NODES) continue;
+
+        redisreply_t pool[REDISPIPE_MESSAGE_NODES];
+        redisreply_t* next = pool;
+        redisreply_t* reply = next++;
+        memset(pool, 0, sizeof(pool));
+        __parse(data, reply, &next);
+
+        if (reply->type != REDISREPLY_ARRAY || reply->elements != 4) continue;
+
+        const redisreply_t* type = &reply->element[0];
+        const redisreply_t* channel = &reply->element[2];
+        const redisreply_t* message = &reply->element[3];
+        if (type->type != REDISREPLY_STRING || strcmp(type->str, "pmessage") != 0) continue;
+        if (channel->type != REDISREPLY_STRING || message->type != REDISREPLY_STRING) continue;
+
+        handler(channel->str, channel->len, message->str, message->len, arg);
+    }
+
+    return 1;
+}
+
+void __default_create(void) {
+    __default_conn = redisconn_config();
+}
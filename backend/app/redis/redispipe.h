@@ -0,0 +1,116 @@
+#ifndef __REDISPIPE__
+#define __REDISPIPE__
+
+#include <stddef.h>
+
+// Keys of main.env with the server of redisconn_config(), only redispipe_ip is required
+#define REDISPIPE_IP_ENV "redispipe_ip"
+#define REDISPIPE_PORT_ENV "redispipe_port"
+#define REDISPIPE_DBINDEX_ENV "redispipe_dbindex"
+#define REDISPIPE_USER_ENV "redispipe_user"
+#define REDISPIPE_PASSWORD_ENV "redispipe_password"
+#define REDISPIPE_PORT 6379
+#define REDISPIPE_TIMEOUT 3
+
+typedef enum {
+    REDISREPLY_NIL = 0,
+    REDISREPLY_STATUS,
+    REDISREPLY_ERROR,
+    REDISREPLY_INTEGER,
+    REDISREPLY_STRING,
+    REDISREPLY_ARRAY
+} redisreply_type_e;
+
+typedef struct redisreply {
+    redisreply_type_e type;
+    long long integer;
+    const char* str;
+    size_t len;
+    size_t elements;
+    struct redisreply* element;
+} redisreply_t;
+
+typedef struct redisconn redisconn_t;
+typedef struct redispipe redispipe_t;
+
+// Channel and data are null-terminated and valid only during the call
+typedef void(*redismessage_fn)(const char* channel, size_t channel_size, const char* data, size_t size, void* arg);
+
+/**
+ * Creates a connection handle. The socket is opened lazily on first use
+ * and reopened after I/O errors.
+ * The handle is shared between threads: pipelines submitted concurrently
+ * are coalesced into a single write and read on the socket.
+ * @return Connection handle or NULL on allocation failure
+ */
+redisconn_t* redisconn_create(const char* ip, unsigned short port, int dbindex, const char* user, const char* password);
+
+/**
+ * Creates a connection to the server set by the redispipe_* keys of main.env.
+ * Pub/Sub listeners need a connection of their own and take it from here.
+ * @return Connection handle or NULL if redispipe_ip is not set or on allocation failure
+ */
+redisconn_t* redisconn_config(void);
+
+/**
+ * Process-wide connection created once by redisconn_config.
+ * @return Connection handle or NULL if Redis is not configured
+ */
+redisconn_t* redisconn_default(void);
+
+void redisconn_free(redisconn_t* conn);
+
+/**
+ * Switches the connection into Pub/Sub mode with PSUBSCRIBE and delivers
+ * every message to the handler. Blocks the calling thread until
+ * redisconn_unsubscribe, reconnecting after errors.
+ * The connection must not be used for pipelines.
+ * @param pattern  Channel pattern, e.g. "broadcast:*"
+ * @return 1 after redisconn_unsubscribe, 0 on invalid arguments
+ */
+int redisconn_psubscribe(redisconn_t* conn, const char* pattern, redismessage_fn handler, void* arg);
+
+/**
+ * Stops redisconn_psubscribe within REDISPIPE_TIMEOUT seconds.
+ */
+void redisconn_unsubscribe(redisconn_t* conn);
+
+/**
+ * Creates an empty pipeline. Commands are queued with redispipe_command
+ * and sent in one round trip by redispipe_exec.
+ */
+redispipe_t* redispipe_create(void);
+
+/**
+ * Creates a pipeline wrapped in MULTI/EXEC, executed atomically by Redis.
+ * redispipe_reply returns the elements of the EXEC reply.
+ */
+redispipe_t* redispipe_create_transaction(void);
+
+/**
+ * Queues a command written as text, arguments separated by spaces,
+ * e.g. "SET testkey123 123456". Use redispipe_commandv for binary-safe arguments.
+ * @return 1 on success, 0 on error
+ */
+int redispipe_command(redispipe_t* pipe, const char* command);
+int redispipe_commandv(redispipe_t* pipe, int argc, const char** argv, const size_t* argvlen);
+
+/**
+ * Sends all queued commands and waits for their replies.
+ * @return 1 if every reply was received, 0 on connection or protocol error
+ */
+int redispipe_exec(redisconn_t* conn, redispipe_t* pipe);
+
+size_t redispipe_count(redispipe_t* pipe);
+
+/**
+ * Reply of the command with the given index.
+ * Strings point into the pipeline buffer and are null-terminated;
+ * they stay valid until redispipe_free.
+ * @return Reply or NULL if the index is out of range or the pipeline failed
+ */
+const redisreply_t* redispipe_reply(redispipe_t* pipe, size_t index);
+const char* redispipe_error(redispipe_t* pipe);
+void redispipe_free(redispipe_t* pipe);
+
+#endif
@@ -2,6 +2,12 @@
 #include "auth.h"
 #include "appconfig.h"
 #include "httpmiddlewares.h"
+#include "sessioncache.h"
+#include "cryptopool.h"
+#include "jwt.h"
+#include "jsonwriter.h"
+
+static void __send_busy(httpctx_t* ctx);
 
 void login(httpctx_t* ctx) {
     int ok = 0;
@@ -24,18 +30,28 @@ void login(httpctx_t* ctx) {
         return;
     }
 
+    if (!cryptopool_acquire(CRYPTOPOOL_ROUTE_LOGIN)) {
+        __send_busy(ctx);
+        return;
+    }
+
     user_t* user = authenticate(email, password);
+    cryptopool_release(CRYPTOPOOL_ROUTE_LOGIN);
+
     if (user == NULL) {
         ctx->response->send_data(ctx->response, "Can't authenticate user");
         return;
     }
 
-    json_doc_t* doc = json_root_create_object();
-    json_token_t* object = json_root(doc);
-    json_object_set(object, "user_id", json_create_number(user_id(user)));
+    json_writer_t session;
+    json_writer_init(&session);
+    json_writer_begin_object(&session);
+    json_writer_key(&session, "user_id");
+    json_writer_int(&session, user_id(user));
+    json_writer_end(&session);
 
-    char* session_id = session_create("backend", json_stringify(doc), 300);
-    json_free(doc);
+    char* session_id = sessioncache_create("backend", json_writer_data(&session), 300);
+    json_writer_free(&session);
 
     if (session_id == NULL) {
         ctx->response->send_data(ctx->response, "Can't create session");
@@ -60,6 +76,65 @@ void login(httpctx_t* ctx) {
     user_free(user);
 }
 
+void token(httpctx_t* ctx) {
+    int ok = 0;
+    const char* email = query_param_char(ctx->request->query_, "email", &ok);
+    if (!ok) {
+        ctx->response->status_code = 400;
+        ctx->response->send_data(ctx->response, "email invalid in query");
+        return;
+    }
+
+    const char* password = query_param_char(ctx->request->query_, "password", &ok);
+    if (!ok) {
+        ctx->response->status_code = 400;
+        ctx->response->send_data(ctx->response, "password invalid in query");
+        return;
+    }
+
+    if (!validate_email(email)) {
+        ctx->response->status_code = 400;
+        ctx->response->send_data(ctx->response, "Invalid email");
+        return;
+    }
+
+    if (!cryptopool_acquire(CRYPTOPOOL_ROUTE_LOGIN)) {
+        __send_busy(ctx);
+        return;
+    }
+
+    user_t* user = authenticate(email, password);
+    cryptopool_release(CRYPTOPOOL_ROUTE_LOGIN);
+
+    if (user == NULL) {
+        ctx->response->send_data(ctx->response, "Can't authenticate user");
+        return;
+    }
+
+    str_t* jwt = jwt_create(user_id(user), 3600);
+    user_free(user);
+
+    if (jwt == NULL) {
+        ctx->response->status_code = 500;
+        ctx->response->send_data(ctx->response, "Can't create token");
+        return;
+    }
+
+    json_writer_t writer;
+    json_writer_init(&writer);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "token");
+    json_writer_stringn(&writer, str_get(jwt), str_size(jwt));
+    json_writer_key(&writer, "expires_in");
+    json_writer_int(&writer, 3600);
+    json_writer_end(&writer);
+    str_free(jwt);
+
+    ctx->response->add_header(ctx->response, "Content-Type", "application/json");
+    ctx->response->send_datan(ctx->response, json_writer_data(&writer), json_writer_size(&writer));
+    json_writer_free(&writer);
+}
+
 void registration(httpctx_t* ctx) {
     int ok = 0;
     const char* email = query_param_char(ctx->request->query_, "email", &ok);
@@ -109,8 +184,17 @@ void registration(httpctx_t* ctx) {
         return;
     }
 
+    if (!cryptopool_acquire(CRYPTOPOOL_ROUTE_REGISTRATION)) {
+        __send_busy(ctx);
+        user_free(user);
+        return;
+    }
+
     str_t* secret = generate_secret(password);
+    cryptopool_release(CRYPTOPOOL_ROUTE_REGISTRATION);
+
     if (secret == NULL) {
+        ctx->response->status_code = 500;
         ctx->response->send_data(ctx->response, "Can't generate secret");
         user_free(user);
         return;
@@ -139,3 +223,20 @@ void secret_page(httpctx_t* ctx) {
 
     ctx->response->send_data(ctx->response, "done");
 }
+
+void jwt_page(httpctx_t* ctx) {
+    middleware(
+        middleware_http_jwt(ctx)
+    )
+
+    ctx->response->send_data(ctx->response, "done");
+}
+
+/**
+ * @brief Rejects the request while the route waits for too many hashes.
+ */
+void __send_busy(httpctx_t* ctx) {
+    ctx->response->status_code = 503;
+    ctx->response->add_header(ctx->response, "Retry-After", CRYPTOPOOL_RETRY_AFTER);
+    ctx->response->send_data(ctx->response, "Too many requests, try again later");
+}
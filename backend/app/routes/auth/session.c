@@ -3,6 +3,7 @@
 #include "model.h"
 #include "auth.h"
 #include "appconfig.h"
+#include "sessioncache.h"
 
 void session(httpctx_t* ctx) {
     const int user_id = 12;
@@ -11,7 +12,7 @@ void session(httpctx_t* ctx) {
     json_token_t* object = json_root(doc);
     json_object_set(object, "user_id", json_create_number(user_id));
 
-    char* session_id = session_create("backend", json_stringify(doc), 300);
+    char* session_id = sessioncache_create("backend", json_stringify(doc), 300);
     json_free(doc);
 
     if (session_id == NULL) {
@@ -19,7 +20,7 @@ void session(httpctx_t* ctx) {
         return;
     }
 
-    char* session_data = session_get("backend", session_id);
+    char* session_data = sessioncache_get("backend", session_id);
     if (session_data == NULL) {
         free(session_id);
         ctx->response->send_data(ctx->response, "Can't get session data");
@@ -38,11 +39,11 @@ void session(httpctx_t* ctx) {
         .same_site = "Lax"
     });
 
-    if (!session_update("backend", session_id, "data")) {
+    if (!sessioncache_update("backend", session_id, "data")) {
         log_error("Can't update session");
     }
 
-    if (!session_destroy("backend", session_id)) {
+    if (!sessioncache_destroy("backend", session_id)) {
         log_error("Can't destroy session");
     }
 
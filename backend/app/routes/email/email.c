@@ -1,5 +1,5 @@
 #include "http.h"
-#include "mail.h"
+#include "taskmail.h"
 
 void mail_send(httpctx_t* ctx) {
     mail_payload_t payload = {
@@ -9,10 +9,11 @@ void mail_send(httpctx_t* ctx) {
         .subject = "Test mail",
         .body = "Just text"
     };
-    if (!send_mail(&payload)) {
+    // Sent on a pool worker, the request does not wait for the SMTP server
+    if (!taskmail_send(&payload)) {
         ctx->response->send_data(ctx->response, "Error send mail");
         return;
     }
 
-    ctx->response->send_data(ctx->response, "done");
+    ctx->response->send_data(ctx->response, "queued");
 }
\ No newline at end of file
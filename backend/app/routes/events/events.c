@@ -0,0 +1,52 @@
+#include "http.h"
+#include "httpmiddlewares.h"
+#include "eventstream.h"
+
+static const char* channel_name = "events";
+
+void events(httpctx_t* ctx) {
+    char last_event_id[32] = {0};
+
+    http_header_t* header = ctx->request->get_header(ctx->request, "Last-Event-ID");
+    if (header != NULL && header->value_length < sizeof(last_event_id))
+        memcpy(last_event_id, header->value, header->value_length);
+    // No id of ours is this long, an invalid id replays the whole ring
+    else if (header != NULL)
+        strcpy(last_event_id, "-");
+
+    str_t* body = eventstream_stream(channel_name, header != NULL ? last_event_id : NULL);
+    if (body == NULL) {
+        ctx->response->send_default(ctx->response, 500);
+        return;
+    }
+
+    // The response ends after the backlog, EventSource reconnects in EVENTSTREAM_RETRY ms with Last-Event-ID
+    ctx->response->add_header(ctx->response, "Content-Type", "text/event-stream");
+    ctx->response->add_header(ctx->response, "Cache-Control", "no-cache");
+    ctx->response->send_datan(ctx->response, str_get(body), str_size(body));
+
+    str_free(body);
+}
+
+void events_publish(httpctx_t* ctx) {
+    middleware(
+        middleware_http_auth(ctx),
+        middleware_http_permission(ctx, "events.publish")
+    )
+
+    char* data = ctx->request->get_payload(ctx->request);
+    if (data == NULL) {
+        ctx->response->send_data(ctx->response, "empty data");
+        return;
+    }
+
+    const unsigned long long id = eventstream_publish(channel_name, NULL, data, strlen(data));
+    free(data);
+
+    if (id == 0) {
+        ctx->response->send_default(ctx->response, 500);
+        return;
+    }
+
+    ctx->response->send_data(ctx->response, "done");
+}
@@ -4,8 +4,9 @@
 #include "roleview.h"
 #include "permissionview.h"
 #include "str.h"
+#include "jsonwritermodel.h"
 
-char* userview_list_stringify(array_t* users);
+int userview_list_write(json_writer_t* writer, array_t* users);
 
 void userviewget(httpctx_t* ctx) {
     middleware(
@@ -62,36 +63,35 @@ void userviewlist(httpctx_t* ctx) {
         return;
     }
 
-    char* data = userview_list_stringify(users);
-    if (data == NULL) {
+    // The list is written straight into the writer, no token tree is built for it
+    json_writer_t writer;
+    json_writer_init(&writer);
+
+    if (!userview_list_write(&writer, users)) {
         ctx->response->status_code = 500;
         ctx->response->send_data(ctx->response, "error");
+        json_writer_free(&writer);
         array_free(users);
         return;
     }
     ctx->response->add_header(ctx->response, "Content-Type", "application/json");
-    ctx->response->send_data(ctx->response, data);
+    ctx->response->send_datan(ctx->response, json_writer_data(&writer), json_writer_size(&writer));
 
-    free(data);
+    json_writer_free(&writer);
     array_free(users);
 }
 
-char* userview_list_stringify(array_t* users) {
-    if (users == NULL) return NULL;
+int userview_list_write(json_writer_t* writer, array_t* users) {
+    if (users == NULL) return 0;
 
-    json_doc_t* doc = json_root_create_array();
-    if (!doc) return NULL;
-
-    char* data = NULL;
-
-    json_token_t* json_array_users = json_root(doc);
+    json_writer_begin_array(writer);
     for (size_t i = 0; i < array_size(users); i++) {
         userview_t* user = array_get_pointer(users, i);
-        if (user == NULL) return NULL;
+        if (user == NULL) return 0;
 
         array_t* user_roles_params = array_create();
         if (user_roles_params == NULL)
-            return NULL;
+            return 0;
 
         mparams_fill_array(user_roles_params,
             mparam_int(user_id, userview_id(user))
@@ -99,17 +99,24 @@ char* userview_list_stringify(array_t* users) {
         array_t* user_roles = roleview_list(user_roles_params);
         array_free(user_roles_params);
 
-        json_token_t* json_object_user = model_to_json(user, NULL);
+        json_writer_begin_object(writer);
+        json_writer_model_fields(writer, user, NULL);
 
         if (user_roles != NULL) {
-            json_token_t* json_array_roles = json_create_array();
+            json_writer_key(writer, "roles");
+            json_writer_begin_array(writer);
             for (size_t j = 0; j < array_size(user_roles); j++) {
                 roleview_t* role = array_get_pointer(user_roles, j);
-                if (role == NULL) return NULL;
+                if (role == NULL) {
+                    array_free(user_roles);
+                    return 0;
+                }
 
                 array_t* role_permissions_params = array_create();
-                if (role_permissions_params == NULL)
-                    return NULL;
+                if (role_permissions_params == NULL) {
+                    array_free(user_roles);
+                    return 0;
+                }
 
                 mparams_fill_array(role_permissions_params,
                     mparam_int(role_id, roleview_id(role))
@@ -117,37 +124,37 @@ char* userview_list_stringify(array_t* users) {
                 array_t* role_permissions = permissionview_list(role_permissions_params);
                 array_free(role_permissions_params);
 
-                json_token_t* json_object_role = model_to_json(role, NULL);
+                json_writer_begin_object(writer);
+                json_writer_model_fields(writer, role, NULL);
 
                 if (role_permissions != NULL) {
-                    json_token_t* json_array_permissions = json_create_array();
+                    json_writer_key(writer, "permissions");
+                    json_writer_begin_array(writer);
                     for (size_t k = 0; k < array_size(role_permissions); k++) {
                         permissionview_t* permission = array_get_pointer(role_permissions, k);
-                        if (permission == NULL) return NULL;
+                        if (permission == NULL) {
+                            array_free(role_permissions);
+                            array_free(user_roles);
+                            return 0;
+                        }
 
-                        json_token_t* json_object_permission = model_to_json(permission, NULL);
-                        json_array_append(json_array_permissions, json_object_permission);
+                        json_writer_model(writer, permission, NULL);
                     }
+                    json_writer_end(writer);
 
                     array_free(role_permissions);
-
-                    json_object_set(json_object_role, "permissions", json_array_permissions);
                 }
 
-                json_array_append(json_array_roles, json_object_role);
+                json_writer_end(writer);
             }
+            json_writer_end(writer);
 
             array_free(user_roles);
-
-            json_object_set(json_object_user, "roles", json_array_roles);
         }
-        
-        json_array_append(json_array_users, json_object_user);
-    }
-
-    data = json_stringify_detach(doc);
 
-    json_free(doc);
+        json_writer_end(writer);
+    }
+    json_writer_end(writer);
 
-    return data;
+    return json_writer_data(writer) != NULL;
 }
@@ -0,0 +1,10 @@
+#include "log.h"
+#include "sessionexpiry.h"
+
+void sweep_expired_sessions(void* data) {
+    (void)data;
+
+    const size_t count = sessionexpiry_sweep(SESSIONEXPIRY_SWEEP_LIMIT);
+    if (count > 0)
+        log_info("Expired sessions destroyed: %zu\n", count);
+}
@@ -1,23 +1,26 @@
 #include "websockets.h"
 #include "broadcast.h"
 #include "mybroadcast.h"
+#include "broadcastbridge.h"
+#include "broadcastindex.h"
 #include "wsmiddlewares.h"
 
-static const char* broadcast_name = "my_broadcast_name";
+static const char* broadcast_name = MYBROADCAST_CHANNEL;
 
 void echo(wsctx_t* ctx) {
     websockets_protocol_resource_t* protocol = (websockets_protocol_resource_t*)ctx->request->protocol;
 
-    json_doc_t* document = protocol->get_payload_json(protocol);
-    if (document != NULL) {
-        ctx->response->send_text(ctx->response, json_stringify(document));
-        json_free(document);
-        return;
-    }
-
+    // One read of the payload serves both the JSON and the plain text reply
     char* data = protocol->get_payload(protocol);
     if (data) {
-        ctx->response->send_text(ctx->response, data);
+        json_doc_t* document = json_parse(data);
+        if (document != NULL) {
+            ctx->response->send_text(ctx->response, json_stringify(document));
+            json_free(document);
+        }
+        else
+            ctx->response->send_text(ctx->response, data);
+
         free(data);
         return;
     }
@@ -64,12 +67,12 @@ void channel_join(wsctx_t* ctx) {
         return;
     }
 
-    broadcast_add(broadcast_name, ctx->request->connection, id, mybroadcast_send_data);
+    broadcast_index_add(broadcast_name, ctx->request->connection, id, mybroadcast_send_data);
     ctx->response->send_data(ctx, "done");
 }
 
 void channel_leave(wsctx_t* ctx) {
-    broadcast_remove(broadcast_name, ctx->request->connection);
+    broadcast_index_remove(broadcast_name, ctx->request->connection);
     ctx->response->send_data(ctx, "done");
 }
 
@@ -82,15 +85,8 @@ void channel_send(wsctx_t* ctx) {
         return;
     }
 
-    size_t length = strlen(data);
-    mybroadcast_id_t* id = mybroadcast_compare_id_create();
-    if (id == NULL) {
-        ctx->response->send_data(ctx, "out of memory");
-        free(data);
-        return;
-    }
-
-    broadcast_send(broadcast_name, ctx->request->connection, data, length, id, mybroadcast_compare);
+    // Reaches the subscribers with user_id 1 through the index, the others are not compared
+    broadcast_index_send(broadcast_name, ctx->request->connection, data, strlen(data), "user_id", 1);
     free(data);
 
     ctx->response->send_data(ctx, "done");
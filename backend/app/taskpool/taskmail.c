@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "appconfig.h"
+#include "taskpool.h"
+#include "taskscheduler.h"
+#include "taskmail.h"
+
+typedef struct taskmail {
+    mail_payload_t payload;
+    int attempt;
+} taskmail_t;
+
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+
+static void __init(void);
+static void __send(void* data);
+static void __retry(void* data);
+static void __mail_free(void* data);
+static char* __copy(const char* value, int* ok);
+
+int taskmail_send(const mail_payload_t* payload) {
+    if (payload == NULL) return 0;
+
+    pthread_once(&__once, __init);
+
+    taskmail_t* mail = calloc(1, sizeof * mail);
+    if (mail == NULL) goto failed;
+
+    int ok = 1;
+    mail->payload.from = __copy(payload->from, &ok);
+    mail->payload.from_name = __copy(payload->from_name, &ok);
+    mail->payload.to = __copy(payload->to, &ok);
+    mail->payload.subject = __copy(payload->subject, &ok);
+    mail->payload.body = __copy(payload->body, &ok);
+    if (!ok) goto failed;
+
+    // The task owns the mail, it is freed after the last attempt
+    if (!taskpool_submit(TASKMAIL_NAME, TASKPOOL_PRIORITY_LOW, __send, mail, NULL)) {
+        __mail_free(mail);
+        return 0;
+    }
+
+    return 1;
+
+    failed:
+
+    log_error("taskmail_send: out of memory\n");
+    __mail_free(mail);
+
+    return 0;
+}
+
+void __init(void) {
+    const int limit = env_get_int(TASKMAIL_LIMIT_ENV, TASKMAIL_LIMIT);
+    if (limit < 0 || !taskpool_set_limit(TASKMAIL_NAME, limit))
+        log_error("taskmail: can't set the limit of %s, mails are not limited\n", TASKMAIL_NAME);
+}
+
+void __send(void* data) {
+    taskmail_t* mail = data;
+    if (send_mail(&mail->payload)) {
+        __mail_free(mail);
+        return;
+    }
+
+    mail->attempt++;
+    if (mail->attempt < TASKMAIL_ATTEMPTS) {
+        const unsigned int delay = TASKMAIL_RETRY_DELAY << (mail->attempt - 1);
+        if (taskscheduler_delay(delay, __retry, mail)) return;
+    }
+
+    log_error("taskmail: can't send mail to %s, attempts: %d\n", mail->payload.to, mail->attempt);
+    __mail_free(mail);
+}
+
+/**
+ * @brief Delayed tasks have no name, the retry goes back under the name limit.
+ */
+void __retry(void* data) {
+    if (!taskpool_submit(TASKMAIL_NAME, TASKPOOL_PRIORITY_LOW, __send, data, NULL)) {
+        log_error("taskmail: can't queue retry of mail\n");
+        __mail_free(data);
+    }
+}
+
+void __mail_free(void* data) {
+    taskmail_t* mail = data;
+    if (mail == NULL) return;
+
+    free((char*)mail->payload.from);
+    free((char*)mail->payload.from_name);
+    free((char*)mail->payload.to);
+    free((char*)mail->payload.subject);
+    free((char*)mail->payload.body);
+    free(mail);
+}
+
+char* __copy(const char* value, int* ok) {
+    if (value == NULL) return NULL;
+
+    char* copy = strdup(value);
+    if (copy == NULL)
+        *ok = 0;
+
+    return copy;
+}
@@ -0,0 +1,24 @@
+#ifndef __TASKMAIL__
+#define __TASKMAIL__
+
+#include "mail.h"
+
+// Name of the mail tasks in taskpool
+#define TASKMAIL_NAME "send_mail"
+// Key of main.env with the number of mails sent at once, the other workers stay free of slow SMTP servers
+#define TASKMAIL_LIMIT_ENV "taskpool_mail_limit"
+#define TASKMAIL_LIMIT 1
+// Sends of a mail before it is dropped, the retries wait TASKMAIL_RETRY_DELAY ms, doubled every time
+#define TASKMAIL_ATTEMPTS 3
+#define TASKMAIL_RETRY_DELAY 5000
+
+/**
+ * Sends the mail on a taskpool worker, in place of send_mail_async.
+ * The payload is copied, so it may live on the stack of the caller.
+ * A failed send is retried by taskscheduler, errors are logged.
+ * @param payload  Mail
+ * @return 1 if the mail is queued, 0 on invalid arguments or out of memory
+ */
+int taskmail_send(const mail_payload_t* payload);
+
+#endif
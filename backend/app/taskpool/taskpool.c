@@ -0,0 +1,559 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "log.h"
+#include "appconfig.h"
+#include "taskpool.h"
+
+#define TASKPOOL_DEQUE_MASK (TASKPOOL_DEQUE_SIZE - 1)
+
+_Static_assert((TASKPOOL_DEQUE_SIZE & TASKPOOL_DEQUE_MASK) == 0, "TASKPOOL_DEQUE_SIZE must be a power of two");
+
+typedef struct taskpool_name taskpool_name_t;
+
+typedef struct taskpool_task {
+    taskpool_fn run;
+    void* data;
+    taskpool_free_fn free_fn;
+    taskpool_name_t* name;
+    taskpool_priority_e priority;
+    long long submitted_at;
+    struct taskpool_task* next;
+} taskpool_task_t;
+
+typedef struct taskpool_list {
+    taskpool_task_t* head;
+    taskpool_task_t* tail;
+} taskpool_list_t;
+
+struct taskpool_name {
+    char name[TASKPOOL_NAME_SIZE];
+    atomic_int limit;
+    int running;
+    taskpool_list_t pending[TASKPOOL_PRIORITIES];
+    pthread_mutex_t mutex;
+};
+
+// Chase-Lev deque: the owner pushes and pops at the bottom, thieves steal from the top
+typedef struct taskpool_deque {
+    _Alignas(64) atomic_llong top;
+    _Alignas(64) atomic_llong bottom;
+    _Alignas(64) _Atomic(taskpool_task_t*) tasks[TASKPOOL_DEQUE_SIZE];
+} taskpool_deque_t;
+
+typedef struct taskpool_worker {
+    taskpool_deque_t deques[TASKPOOL_PRIORITIES];
+    unsigned int seed;
+} taskpool_worker_t;
+
+static taskpool_worker_t* __workers = NULL;
+// Grows while __init starts the threads, the first workers may already be stealing
+static atomic_int __workers_count = 0;
+static _Thread_local taskpool_worker_t* __self = NULL;
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+
+// Shared queue for tasks submitted outside the workers
+static taskpool_list_t __shared[TASKPOOL_PRIORITIES];
+static atomic_long __shared_count[TASKPOOL_PRIORITIES];
+static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __cond = PTHREAD_COND_INITIALIZER;
+static atomic_int __sleepers = 0;
+
+static taskpool_name_t __names[TASKPOOL_NAMES_MAX];
+static atomic_int __names_count = 0;
+static pthread_mutex_t __names_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_long __queued[TASKPOOL_PRIORITIES];
+static atomic_long __deferred = 0;
+static atomic_long __running = 0;
+static atomic_ullong __submitted = 0;
+static atomic_ullong __completed = 0;
+static atomic_ullong __stolen = 0;
+static atomic_ullong __wait_sum = 0;
+static atomic_ullong __wait_max = 0;
+static atomic_ullong __run_sum = 0;
+static atomic_ullong __run_max = 0;
+
+static void __init(void);
+static void* __worker(void* arg);
+static long long __now(void);
+static void __max(atomic_ullong* max, unsigned long long value);
+static taskpool_name_t* __name_find(const char* name);
+static void __list_push(taskpool_list_t* list, taskpool_task_t* task);
+static taskpool_task_t* __list_pop(taskpool_list_t* list);
+static int __deque_push(taskpool_deque_t* deque, taskpool_task_t* task);
+static taskpool_task_t* __deque_pop(taskpool_deque_t* deque);
+static taskpool_task_t* __deque_steal(taskpool_deque_t* deque);
+static void __enqueue(taskpool_task_t* task);
+static void __shared_push(taskpool_task_t* task);
+static taskpool_task_t* __shared_take(taskpool_worker_t* worker, taskpool_priority_e priority);
+static taskpool_task_t* __steal(taskpool_worker_t* worker, taskpool_priority_e priority);
+static taskpool_task_t* __next(taskpool_worker_t* worker);
+static void __wait(void);
+static int __admit(taskpool_task_t* task);
+static void __release(taskpool_name_t* name);
+static void __run(taskpool_task_t* task);
+
+int taskpool_async(taskpool_fn run, void* data) {
+    return taskpool_submit(NULL, TASKPOOL_PRIORITY_NORMAL, run, data, NULL);
+}
+
+int taskpool_async_with_free(taskpool_fn run, void* data, taskpool_free_fn free_fn) {
+    return taskpool_submit(NULL, TASKPOOL_PRIORITY_NORMAL, run, data, free_fn);
+}
+
+int taskpool_submit(const char* name, taskpool_priority_e priority, taskpool_fn run, void* data, taskpool_free_fn free_fn) {
+    if (run == NULL || priority < 0 || priority >= TASKPOOL_PRIORITIES) return 0;
+
+    pthread_once(&__once, __init);
+
+    // Without workers the caller runs the task by itself
+    if (__workers_count == 0) {
+        atomic_fetch_add(&__submitted, 1);
+        run(data);
+        if (free_fn != NULL)
+            free_fn(data);
+
+        atomic_fetch_add(&__completed, 1);
+        return 1;
+    }
+
+    taskpool_task_t* task = malloc(sizeof * task);
+    if (task == NULL) {
+        log_error("taskpool_submit: out of memory\n");
+        return 0;
+    }
+
+    task->run = run;
+    task->data = data;
+    task->free_fn = free_fn;
+    task->name = name != NULL ? __name_find(name) : NULL;
+    task->priority = priority;
+    task->submitted_at = __now();
+    task->next = NULL;
+
+    atomic_fetch_add(&__submitted, 1);
+    __enqueue(task);
+
+    return 1;
+}
+
+int taskpool_set_limit(const char* name, int limit) {
+    if (name == NULL || strlen(name) >= TASKPOOL_NAME_SIZE || limit < 0) return 0;
+
+    pthread_mutex_lock(&__names_mutex);
+
+    taskpool_name_t* entry = __name_find(name);
+    if (entry == NULL) {
+        const int count = atomic_load(&__names_count);
+        if (count == TASKPOOL_NAMES_MAX) {
+            pthread_mutex_unlock(&__names_mutex);
+            log_error("taskpool_set_limit: too many names\n");
+            return 0;
+        }
+
+        entry = &__names[count];
+        memset(entry, 0, sizeof * entry);
+        strcpy(entry->name, name);
+        pthread_mutex_init(&entry->mutex, NULL);
+        atomic_store(&entry->limit, limit);
+
+        // Readers scan the table without the lock, the entry is complete before it is counted
+        atomic_store_explicit(&__names_count, count + 1, memory_order_release);
+        pthread_mutex_unlock(&__names_mutex);
+
+        return 1;
+    }
+
+    pthread_mutex_unlock(&__names_mutex);
+
+    // Waiting tasks are admitted again under the new limit
+    taskpool_list_t pending[TASKPOOL_PRIORITIES];
+
+    pthread_mutex_lock(&entry->mutex);
+    atomic_store(&entry->limit, limit);
+    memcpy(pending, entry->pending, sizeof(pending));
+    memset(entry->pending, 0, sizeof(entry->pending));
+    pthread_mutex_unlock(&entry->mutex);
+
+    for (int i = 0; i < TASKPOOL_PRIORITIES; i++) {
+        taskpool_task_t* task = NULL;
+        while ((task = __list_pop(&pending[i])) != NULL) {
+            atomic_fetch_sub(&__deferred, 1);
+            __shared_push(task);
+        }
+    }
+
+    return 1;
+}
+
+void taskpool_metrics(taskpool_metrics_t* metrics) {
+    if (metrics == NULL) return;
+
+    memset(metrics, 0, sizeof * metrics);
+
+    for (int i = 0; i < TASKPOOL_PRIORITIES; i++) {
+        const long queued = atomic_load(&__queued[i]);
+        metrics->queued[i] = queued > 0 ? (size_t)queued : 0;
+    }
+
+    metrics->deferred = atomic_load(&__deferred);
+    metrics->running = atomic_load(&__running);
+    metrics->submitted = atomic_load(&__submitted);
+    metrics->completed = atomic_load(&__completed);
+    metrics->stolen = atomic_load(&__stolen);
+    metrics->wait_max = atomic_load(&__wait_max);
+    metrics->run_max = atomic_load(&__run_max);
+
+    if (metrics->completed > 0) {
+        metrics->wait_avg = atomic_load(&__wait_sum) / metrics->completed;
+        metrics->run_avg = atomic_load(&__run_sum) / metrics->completed;
+    }
+}
+
+void __init(void) {
+    const int workers = env_get_int(TASKPOOL_WORKERS_ENV, TASKPOOL_WORKERS);
+    if (workers < 0 || workers > TASKPOOL_WORKERS_MAX) {
+        log_error("taskpool: %s must be from 0 to %d, tasks run in the caller\n", TASKPOOL_WORKERS_ENV, TASKPOOL_WORKERS_MAX);
+        return;
+    }
+
+    if (workers == 0) return;
+
+    __workers = aligned_alloc(_Alignof(taskpool_worker_t), workers * sizeof(taskpool_worker_t));
+    if (__workers == NULL) {
+        log_error("taskpool: out of memory, tasks run in the caller\n");
+        return;
+    }
+
+    memset(__workers, 0, workers * sizeof(taskpool_worker_t));
+
+    for (int i = 0; i < workers; i++) {
+        __workers[i].seed = i + 1;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, __worker, &__workers[i]) != 0) {
+            log_error("taskpool: can't start worker\n");
+            break;
+        }
+
+        pthread_detach(thread);
+        atomic_fetch_add(&__workers_count, 1);
+    }
+}
+
+void* __worker(void* arg) {
+    __self = arg;
+
+    while (1) {
+        taskpool_task_t* task = __next(__self);
+        if (task == NULL) {
+            __wait();
+            continue;
+        }
+
+        atomic_fetch_sub(&__queued[task->priority], 1);
+
+        if (task->name != NULL && !__admit(task))
+            continue;
+
+        __run(task);
+    }
+
+    return NULL;
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void __max(atomic_ullong* max, unsigned long long value) {
+    unsigned long long current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current && !atomic_compare_exchange_weak(max, &current, value));
+}
+
+taskpool_name_t* __name_find(const char* name) {
+    const int count = atomic_load_explicit(&__names_count, memory_order_acquire);
+    for (int i = 0; i < count; i++)
+        if (strcmp(__names[i].name, name) == 0)
+            return &__names[i];
+
+    return NULL;
+}
+
+void __list_push(taskpool_list_t* list, taskpool_task_t* task) {
+    task->next = NULL;
+
+    if (list->tail != NULL)
+        list->tail->next = task;
+    else
+        list->head = task;
+
+    list->tail = task;
+}
+
+taskpool_task_t* __list_pop(taskpool_list_t* list) {
+    taskpool_task_t* task = list->head;
+    if (task == NULL) return NULL;
+
+    list->head = task->next;
+    if (list->head == NULL)
+        list->tail = NULL;
+
+    task->next = NULL;
+
+    return task;
+}
+
+int __deque_push(taskpool_deque_t* deque, taskpool_task_t* task) {
+    const long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    const long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= TASKPOOL_DEQUE_SIZE) return 0;
+
+    atomic_store_explicit(&deque->tasks[bottom & TASKPOOL_DEQUE_MASK], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+    return 1;
+}
+
+taskpool_task_t* __deque_pop(taskpool_deque_t* deque) {
+    const long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    taskpool_task_t* task = atomic_load_explicit(&deque->tasks[bottom & TASKPOOL_DEQUE_MASK], memory_order_relaxed);
+    if (top < bottom) return task;
+
+    // The last task, a thief may be taking it at the same time
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        task = NULL;
+
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+    return task;
+}
+
+taskpool_task_t* __deque_steal(taskpool_deque_t* deque) {
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) return NULL;
+
+    taskpool_task_t* task = atomic_load_explicit(&deque->tasks[top & TASKPOOL_DEQUE_MASK], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+
+    return task;
+}
+
+/**
+ * @brief Puts a new task into the deque of the current worker, or into the shared queue.
+ */
+void __enqueue(taskpool_task_t* task) {
+    if (__self == NULL) {
+        __shared_push(task);
+        return;
+    }
+
+    // Counted before it becomes visible, a worker never sees the counter below the real number
+    atomic_fetch_add(&__queued[task->priority], 1);
+
+    if (!__deque_push(&__self->deques[task->priority], task)) {
+        atomic_fetch_sub(&__queued[task->priority], 1);
+        __shared_push(task);
+        return;
+    }
+
+    // Some other worker may be idle while this one is busy with the task it is running
+    if (atomic_load(&__sleepers) > 0) {
+        pthread_mutex_lock(&__mutex);
+        pthread_cond_signal(&__cond);
+        pthread_mutex_unlock(&__mutex);
+    }
+}
+
+void __shared_push(taskpool_task_t* task) {
+    atomic_fetch_add(&__queued[task->priority], 1);
+
+    pthread_mutex_lock(&__mutex);
+    __list_push(&__shared[task->priority], task);
+    atomic_fetch_add(&__shared_count[task->priority], 1);
+
+    if (atomic_load(&__sleepers) > 0)
+        pthread_cond_signal(&__cond);
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+/**
+ * @brief Takes a task from the shared queue and moves up to TASKPOOL_BATCH - 1 more into the deque of the worker.
+ */
+taskpool_task_t* __shared_take(taskpool_worker_t* worker, taskpool_priority_e priority) {
+    if (atomic_load_explicit(&__shared_count[priority], memory_order_relaxed) == 0) return NULL;
+
+    taskpool_task_t* batch[TASKPOOL_BATCH];
+    int count = 0;
+
+    pthread_mutex_lock(&__mutex);
+
+    while (count < TASKPOOL_BATCH && (batch[count] = __list_pop(&__shared[priority])) != NULL)
+        count++;
+
+    atomic_fetch_sub(&__shared_count[priority], count);
+
+    // Pushed in reverse so that the owner pops them in submission order
+    for (int i = count - 1; i > 0; i--)
+        if (!__deque_push(&worker->deques[priority], batch[i])) {
+            for (int j = 1; j <= i; j++) {
+                __list_push(&__shared[priority], batch[j]);
+                atomic_fetch_add(&__shared_count[priority], 1);
+            }
+            break;
+        }
+
+    if (count > 1 && atomic_load(&__sleepers) > 0)
+        pthread_cond_signal(&__cond);
+
+    pthread_mutex_unlock(&__mutex);
+
+    return count > 0 ? batch[0] : NULL;
+}
+
+taskpool_task_t* __steal(taskpool_worker_t* worker, taskpool_priority_e priority) {
+    const int count = atomic_load(&__workers_count);
+    if (count < 2) return NULL;
+
+    const int start = rand_r(&worker->seed) % count;
+
+    for (int i = 0; i < count; i++) {
+        taskpool_worker_t* victim = &__workers[(start + i) % count];
+        if (victim == worker) continue;
+
+        taskpool_task_t* task = __deque_steal(&victim->deques[priority]);
+        if (task != NULL) {
+            atomic_fetch_add(&__stolen, 1);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Next task by priority: own deque, shared queue, then deques of other workers.
+ */
+taskpool_task_t* __next(taskpool_worker_t* worker) {
+    for (int priority = 0; priority < TASKPOOL_PRIORITIES; priority++) {
+        taskpool_task_t* task = __deque_pop(&worker->deques[priority]);
+        if (task == NULL)
+            task = __shared_take(worker, priority);
+        if (task == NULL)
+            task = __steal(worker, priority);
+        if (task != NULL)
+            return task;
+    }
+
+    return NULL;
+}
+
+void __wait(void) {
+    pthread_mutex_lock(&__mutex);
+
+    // Paired with the check of __sleepers by submitters: either the task is seen here or the signal is sent
+    atomic_fetch_add(&__sleepers, 1);
+
+    long queued = 0;
+    for (int i = 0; i < TASKPOOL_PRIORITIES; i++)
+        queued += atomic_load(&__queued[i]);
+
+    if (queued == 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+
+        pthread_cond_timedwait(&__cond, &__mutex, &deadline);
+    }
+
+    atomic_fetch_sub(&__sleepers, 1);
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+/**
+ * @brief Counts the task against the limit of its name, or parks it until a task of the name finishes.
+ */
+int __admit(taskpool_task_t* task) {
+    taskpool_name_t* name = task->name;
+
+    pthread_mutex_lock(&name->mutex);
+
+    const int limit = atomic_load(&name->limit);
+    if (limit == 0 || name->running < limit) {
+        name->running++;
+        pthread_mutex_unlock(&name->mutex);
+        return 1;
+    }
+
+    __list_push(&name->pending[task->priority], task);
+    atomic_fetch_add(&__deferred, 1);
+
+    pthread_mutex_unlock(&name->mutex);
+
+    return 0;
+}
+
+void __release(taskpool_name_t* name) {
+    taskpool_task_t* task = NULL;
+
+    pthread_mutex_lock(&name->mutex);
+
+    name->running--;
+
+    for (int i = 0; i < TASKPOOL_PRIORITIES && task == NULL; i++)
+        task = __list_pop(&name->pending[i]);
+
+    pthread_mutex_unlock(&name->mutex);
+
+    if (task == NULL) return;
+
+    atomic_fetch_sub(&__deferred, 1);
+    __shared_push(task);
+}
+
+void __run(taskpool_task_t* task) {
+    const long long started_at = __now();
+    const unsigned long long wait = started_at - task->submitted_at;
+
+    atomic_fetch_add(&__wait_sum, wait);
+    __max(&__wait_max, wait);
+    atomic_fetch_add(&__running, 1);
+
+    task->run(task->data);
+    if (task->free_fn != NULL)
+        task->free_fn(task->data);
+
+    const unsigned long long run = __now() - started_at;
+
+    atomic_fetch_add(&__run_sum, run);
+    __max(&__run_max, run);
+    atomic_fetch_sub(&__running, 1);
+    atomic_fetch_add(&__completed, 1);
+
+    if (task->name != NULL)
+        __release(task->name);
+
+    free(task);
+}
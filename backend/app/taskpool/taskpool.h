@@ -0,0 +1,87 @@
+#ifndef __TASKPOOL__
+#define __TASKPOOL__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Key of main.env with the number of worker threads, each with its own deques. 0 runs every task in the caller
+#define TASKPOOL_WORKERS_ENV "taskpool_workers"
+#define TASKPOOL_WORKERS 4
+#define TASKPOOL_WORKERS_MAX 256
+// Capacity of a worker deque of one priority, a power of two. A full deque spills into the shared queue
+#define TASKPOOL_DEQUE_SIZE 1024
+// Tasks a worker moves from the shared queue into its deque at once, so that idle workers can steal them
+#define TASKPOOL_BATCH 16
+// Task names with a concurrency limit
+#define TASKPOOL_NAMES_MAX 64
+#define TASKPOOL_NAME_SIZE 64
+
+typedef enum {
+    TASKPOOL_PRIORITY_HIGH = 0,
+    TASKPOOL_PRIORITY_NORMAL,
+    TASKPOOL_PRIORITY_LOW,
+    TASKPOOL_PRIORITIES
+} taskpool_priority_e;
+
+typedef void(*taskpool_fn)(void* data);
+typedef void(*taskpool_free_fn)(void* data);
+
+typedef struct taskpool_metrics {
+    // Tasks waiting in queues and deques, by priority
+    size_t queued[TASKPOOL_PRIORITIES];
+    // Tasks held back by the limit of their name
+    size_t deferred;
+    size_t running;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t stolen;
+    // Microseconds from submission to start
+    uint64_t wait_avg;
+    uint64_t wait_max;
+    // Microseconds of execution
+    uint64_t run_avg;
+    uint64_t run_max;
+} taskpool_metrics_t;
+
+/**
+ * Runs the function on a pool worker with normal priority. Same contract as taskmanager_async.
+ * @param run   Task function
+ * @param data  Argument of the function
+ * @return 1 on success, 0 if run is NULL or out of memory
+ */
+int taskpool_async(taskpool_fn run, void* data);
+
+/**
+ * Same as taskpool_async, free_fn releases data after the task has run. Same contract as taskmanager_async_with_free.
+ * @param free_fn  Function to free data or NULL
+ */
+int taskpool_async_with_free(taskpool_fn run, void* data, taskpool_free_fn free_fn);
+
+/**
+ * Queues a task. Tasks submitted from a worker go to the deque of that worker,
+ * others to the shared queue. Higher priorities are always taken first.
+ * @param name      Task name for the concurrency limit (see taskpool_set_limit) or NULL
+ * @param priority  Priority
+ * @param run       Task function
+ * @param data      Argument of the function
+ * @param free_fn   Function to free data or NULL
+ * @return 1 on success, 0 on invalid arguments or out of memory
+ */
+int taskpool_submit(const char* name, taskpool_priority_e priority, taskpool_fn run, void* data, taskpool_free_fn free_fn);
+
+/**
+ * Limits how many tasks of the name run at once, e.g. 1 for "send_mail" so a slow SMTP server
+ * occupies a single worker. Tasks over the limit wait and keep their priority.
+ * @param name   Task name
+ * @param limit  Maximum running tasks, 0 removes the limit
+ * @return 1 on success, 0 if the name is too long or TASKPOOL_NAMES_MAX names are taken
+ */
+int taskpool_set_limit(const char* name, int limit);
+
+/**
+ * Fills a snapshot of the pool counters. Counters are read one by one, not atomically as a whole.
+ * @param metrics  Output
+ */
+void taskpool_metrics(taskpool_metrics_t* metrics);
+
+#endif
@@ -0,0 +1,435 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "taskscheduler.h"
+
+// Heap index of an interval timer whose run is in progress, it is back in the heap when the run finishes
+#define TASKSCHEDULER_RUNNING SIZE_MAX
+
+typedef struct taskscheduler_timer {
+    long long due;
+    unsigned int interval;
+    // Position in the heap, kept by the sift functions
+    size_t index;
+    // Empty for a delayed task
+    char name[TASKPOOL_NAME_SIZE];
+    uint64_t hash;
+    taskpool_fn run;
+    void* data;
+    taskpool_free_fn free_fn;
+    int cancelled;
+    struct taskscheduler_timer* hash_next;
+} taskscheduler_timer_t;
+
+// Min-heap by due time
+static taskscheduler_timer_t** __heap = NULL;
+static size_t __heap_count = 0;
+static size_t __heap_capacity = 0;
+// Interval timers by name, in the heap or running, so add and cancel need no scan
+static taskscheduler_timer_t** __names = NULL;
+static size_t __names_count = 0;
+static size_t __names_capacity = 0;
+static int __started = 0;
+static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __cond;
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+
+static void __init(void);
+static void* __scheduler(void* arg);
+static long long __now(void);
+static int __add(taskscheduler_timer_t* timer);
+static int __heap_push(taskscheduler_timer_t* timer);
+static void __heap_remove(size_t index);
+static void __heap_set(size_t index, taskscheduler_timer_t* timer);
+static void __sift_up(size_t index);
+static void __sift_down(size_t index);
+static uint64_t __hash(const char* name);
+static taskscheduler_timer_t* __name_find(const char* name, uint64_t hash);
+static int __name_insert(taskscheduler_timer_t* timer);
+static void __name_remove(taskscheduler_timer_t* timer);
+static void __fire(taskscheduler_timer_t* timer);
+static void __interval_run(void* arg);
+static void __reschedule(taskscheduler_timer_t* timer);
+static void __timer_free(taskscheduler_timer_t* timer);
+
+int taskscheduler_delay(unsigned int ms, taskpool_fn run, void* data) {
+    return taskscheduler_delay_with_free(ms, run, data, NULL);
+}
+
+int taskscheduler_delay_with_free(unsigned int ms, taskpool_fn run, void* data, taskpool_free_fn free_fn) {
+    if (run == NULL) return 0;
+
+    taskscheduler_timer_t* timer = calloc(1, sizeof * timer);
+    if (timer == NULL) {
+        log_error("taskscheduler_delay: out of memory\n");
+        return 0;
+    }
+
+    timer->due = __now() + ms;
+    timer->run = run;
+    timer->data = data;
+    timer->free_fn = free_fn;
+
+    if (!__add(timer)) {
+        free(timer);
+        return 0;
+    }
+
+    return 1;
+}
+
+int taskscheduler_interval(const char* name, unsigned int interval_ms, taskpool_fn run, void* data, taskpool_free_fn free_fn) {
+    if (name == NULL || name[0] == 0 || strlen(name) >= TASKPOOL_NAME_SIZE) return 0;
+    if (interval_ms == 0 || run == NULL) return 0;
+
+    taskscheduler_timer_t* timer = calloc(1, sizeof * timer);
+    if (timer == NULL) {
+        log_error("taskscheduler_interval: out of memory\n");
+        return 0;
+    }
+
+    timer->due = __now() + interval_ms;
+    timer->interval = interval_ms;
+    strcpy(timer->name, name);
+    timer->hash = __hash(name);
+    timer->run = run;
+    timer->data = data;
+    timer->free_fn = free_fn;
+
+    if (!__add(timer)) {
+        free(timer);
+        return 0;
+    }
+
+    return 1;
+}
+
+int taskscheduler_cancel(const char* name) {
+    if (name == NULL || name[0] == 0) return 0;
+
+    taskscheduler_timer_t* removed = NULL;
+
+    pthread_mutex_lock(&__mutex);
+
+    taskscheduler_timer_t* timer = __name_find(name, __hash(name));
+    if (timer != NULL) {
+        __name_remove(timer);
+
+        // A running timer is freed when its run finishes
+        if (timer->index == TASKSCHEDULER_RUNNING)
+            timer->cancelled = 1;
+        else {
+            __heap_remove(timer->index);
+            removed = timer;
+        }
+    }
+
+    pthread_mutex_unlock(&__mutex);
+
+    // The earliest timer may be gone, the thread finds that out on its next wake up
+    __timer_free(removed);
+
+    return timer != NULL;
+}
+
+void __init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&__cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, __scheduler, NULL) != 0) {
+        log_error("taskscheduler: can't start thread\n");
+        return;
+    }
+
+    pthread_detach(thread);
+    __started = 1;
+}
+
+void* __scheduler(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&__mutex);
+
+    while (1) {
+        if (__heap_count == 0) {
+            pthread_cond_wait(&__cond, &__mutex);
+            continue;
+        }
+
+        taskscheduler_timer_t* timer = __heap[0];
+        if (timer->due > __now()) {
+            const struct timespec deadline = {
+                .tv_sec = timer->due / 1000,
+                .tv_nsec = (timer->due % 1000) * 1000000
+            };
+
+            // Wakes at the due time or earlier, when a timer is added in front
+            pthread_cond_timedwait(&__cond, &__mutex, &deadline);
+            continue;
+        }
+
+        __heap_remove(0);
+        timer->index = TASKSCHEDULER_RUNNING;
+
+        pthread_mutex_unlock(&__mutex);
+        __fire(timer);
+        pthread_mutex_lock(&__mutex);
+    }
+
+    return NULL;
+}
+
+long long __now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Puts the timer into the heap and wakes the thread if it is now the earliest.
+ */
+int __add(taskscheduler_timer_t* timer) {
+    pthread_once(&__once, __init);
+
+    if (!__started) return 0;
+
+    pthread_mutex_lock(&__mutex);
+
+    if (timer->name[0] != 0) {
+        if (__name_find(timer->name, timer->hash) != NULL) goto exists;
+        if (!__name_insert(timer)) goto failed;
+    }
+
+    if (!__heap_push(timer)) {
+        if (timer->name[0] != 0)
+            __name_remove(timer);
+
+        goto failed;
+    }
+
+    if (__heap[0] == timer)
+        pthread_cond_signal(&__cond);
+
+    pthread_mutex_unlock(&__mutex);
+
+    return 1;
+
+    exists:
+
+    pthread_mutex_unlock(&__mutex);
+    log_error("taskscheduler: task %s already exists\n", timer->name);
+
+    return 0;
+
+    failed:
+
+    pthread_mutex_unlock(&__mutex);
+    log_error("taskscheduler: out of memory\n");
+
+    return 0;
+}
+
+int __heap_push(taskscheduler_timer_t* timer) {
+    if (__heap_count == __heap_capacity) {
+        const size_t capacity = __heap_capacity > 0 ? __heap_capacity * 2 : TASKSCHEDULER_HEAP_SIZE;
+        taskscheduler_timer_t** heap = realloc(__heap, capacity * sizeof(taskscheduler_timer_t*));
+        if (heap == NULL) return 0;
+
+        __heap = heap;
+        __heap_capacity = capacity;
+    }
+
+    __heap_set(__heap_count, timer);
+    __heap_count++;
+    __sift_up(__heap_count - 1);
+
+    return 1;
+}
+
+void __heap_remove(size_t index) {
+    __heap_count--;
+    if (index == __heap_count) return;
+
+    __heap_set(index, __heap[__heap_count]);
+    __sift_up(index);
+    __sift_down(index);
+}
+
+void __heap_set(size_t index, taskscheduler_timer_t* timer) {
+    __heap[index] = timer;
+    timer->index = index;
+}
+
+void __sift_up(size_t index) {
+    taskscheduler_timer_t* timer = __heap[index];
+
+    while (index > 0) {
+        const size_t parent = (index - 1) / 2;
+        if (__heap[parent]->due <= timer->due) break;
+
+        __heap_set(index, __heap[parent]);
+        index = parent;
+    }
+
+    __heap_set(index, timer);
+}
+
+void __sift_down(size_t index) {
+    taskscheduler_timer_t* timer = __heap[index];
+
+    while (1) {
+        size_t child = index * 2 + 1;
+        if (child >= __heap_count) break;
+
+        if (child + 1 < __heap_count && __heap[child + 1]->due < __heap[child]->due)
+            child++;
+
+        if (timer->due <= __heap[child]->due) break;
+
+        __heap_set(index, __heap[child]);
+        index = child;
+    }
+
+    __heap_set(index, timer);
+}
+
+uint64_t __hash(const char* name) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const char* c = name; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+taskscheduler_timer_t* __name_find(const char* name, uint64_t hash) {
+    if (__names_capacity == 0) return NULL;
+
+    for (taskscheduler_timer_t* timer = __names[hash % __names_capacity]; timer != NULL; timer = timer->hash_next)
+        if (timer->hash == hash && strcmp(timer->name, name) == 0)
+            return timer;
+
+    return NULL;
+}
+
+/**
+ * @brief Links the timer into its bucket, doubling the buckets when there are as many names.
+ */
+int __name_insert(taskscheduler_timer_t* timer) {
+    if (__names_count >= __names_capacity) {
+        const size_t capacity = __names_capacity > 0 ? __names_capacity * 2 : TASKSCHEDULER_NAMES_SIZE;
+        taskscheduler_timer_t** names = calloc(capacity, sizeof(taskscheduler_timer_t*));
+        if (names == NULL) return 0;
+
+        for (size_t i = 0; i < __names_capacity; i++) {
+            taskscheduler_timer_t* entry = __names[i];
+            while (entry != NULL) {
+                taskscheduler_timer_t* next = entry->hash_next;
+                entry->hash_next = names[entry->hash % capacity];
+                names[entry->hash % capacity] = entry;
+                entry = next;
+            }
+        }
+
+        free(__names);
+        __names = names;
+        __names_capacity = capacity;
+    }
+
+    taskscheduler_timer_t** bucket = &__names[timer->hash % __names_capacity];
+    timer->hash_next = *bucket;
+    *bucket = timer;
+    __names_count++;
+
+    return 1;
+}
+
+void __name_remove(taskscheduler_timer_t* timer) {
+    taskscheduler_timer_t** link = &__names[timer->hash % __names_capacity];
+    while (*link != timer)
+        link = &(*link)->hash_next;
+
+    *link = timer->hash_next;
+    timer->hash_next = NULL;
+    __names_count--;
+}
+
+/**
+ * @brief Hands the due timer to the pool. The scheduler thread never runs tasks itself.
+ */
+void __fire(taskscheduler_timer_t* timer) {
+    if (timer->interval > 0) {
+        if (!taskpool_submit(timer->name, TASKPOOL_PRIORITY_NORMAL, __interval_run, timer, NULL)) {
+            log_error("taskscheduler: can't submit %s\n", timer->name);
+            __reschedule(timer);
+        }
+
+        return;
+    }
+
+    if (!taskpool_submit(NULL, TASKPOOL_PRIORITY_NORMAL, timer->run, timer->data, timer->free_fn)) {
+        log_error("taskscheduler: can't submit delayed task\n");
+        if (timer->free_fn != NULL)
+            timer->free_fn(timer->data);
+    }
+
+    free(timer);
+}
+
+void __interval_run(void* arg) {
+    taskscheduler_timer_t* timer = arg;
+
+    timer->run(timer->data);
+
+    __reschedule(timer);
+}
+
+/**
+ * @brief Plans the next run of an interval timer. Runs missed while the task was slow are skipped.
+ */
+void __reschedule(taskscheduler_timer_t* timer) {
+    pthread_mutex_lock(&__mutex);
+
+    if (timer->cancelled) {
+        pthread_mutex_unlock(&__mutex);
+        __timer_free(timer);
+        return;
+    }
+
+    const long long now = __now();
+    timer->due += timer->interval;
+    if (timer->due <= now)
+        timer->due = now + timer->interval;
+
+    if (!__heap_push(timer)) {
+        __name_remove(timer);
+        pthread_mutex_unlock(&__mutex);
+        log_error("taskscheduler: out of memory, %s is dropped\n", timer->name);
+        __timer_free(timer);
+        return;
+    }
+
+    if (__heap[0] == timer)
+        pthread_cond_signal(&__cond);
+
+    pthread_mutex_unlock(&__mutex);
+}
+
+void __timer_free(taskscheduler_timer_t* timer) {
+    if (timer == NULL) return;
+
+    if (timer->free_fn != NULL)
+        timer->free_fn(timer->data);
+
+    free(timer);
+}
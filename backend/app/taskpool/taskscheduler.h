@@ -0,0 +1,47 @@
+#ifndef __TASKSCHEDULER__
+#define __TASKSCHEDULER__
+
+#include "taskpool.h"
+
+// Initial capacity of the timer heap, it grows by doubling
+#define TASKSCHEDULER_HEAP_SIZE 64
+// Initial buckets of the name index of interval tasks, it grows by doubling
+#define TASKSCHEDULER_NAMES_SIZE 64
+
+/**
+ * Runs the task on the pool once, after the delay.
+ * The scheduler thread sleeps until the earliest timer and is woken when an earlier one is added.
+ * @param ms    Delay in milliseconds
+ * @param run   Task function
+ * @param data  Argument of the function
+ * @return 1 on success, 0 if run is NULL or out of memory
+ */
+int taskscheduler_delay(unsigned int ms, taskpool_fn run, void* data);
+
+/**
+ * Same as taskscheduler_delay, free_fn releases data after the task has run.
+ * @param free_fn  Function to free data or NULL
+ */
+int taskscheduler_delay_with_free(unsigned int ms, taskpool_fn run, void* data, taskpool_free_fn free_fn);
+
+/**
+ * Runs the task on the pool every interval, first after one interval.
+ * The next run is planned when the previous one finishes, so runs of the task never overlap.
+ * The name is also the taskpool name, taskpool_set_limit applies to it.
+ * @param name         Unique task name
+ * @param interval_ms  Interval in milliseconds, at least 1
+ * @param run          Task function
+ * @param data         Argument of the function, kept for all runs
+ * @param free_fn      Function to free data on taskscheduler_cancel or NULL
+ * @return 1 on success, 0 on invalid arguments, a taken name or out of memory
+ */
+int taskscheduler_interval(const char* name, unsigned int interval_ms, taskpool_fn run, void* data, taskpool_free_fn free_fn);
+
+/**
+ * Removes an interval task. A run in progress completes, the task is not planned again.
+ * @param name  Task name
+ * @return 1 if the task was found, 0 otherwise
+ */
+int taskscheduler_cancel(const char* name);
+
+#endif
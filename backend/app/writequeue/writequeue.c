@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "writequeue.h"
+
+typedef struct writequeue_job {
+    struct writequeue_job* next;
+    const char* sql;
+    array_t* params;
+    dbresult_t* result;
+    int done;
+} writequeue_job_t;
+
+typedef struct writequeue_writer {
+    char dbid[64];
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+    writequeue_job_t* head;
+    writequeue_job_t* tail;
+    size_t size;
+    // Set while a caller runs a transaction for the queue
+    int committing;
+} writequeue_writer_t;
+
+static writequeue_writer_t* __writers[WRITEQUEUE_WRITERS_MAX];
+static int __writers_count = 0;
+static pthread_mutex_t __writers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static writequeue_writer_t* __writer_get(const char* dbid);
+static writequeue_writer_t* __writer_create(const char* dbid);
+static void __writer_lead(writequeue_writer_t* writer);
+static void __commit(const char* dbid, writequeue_job_t* batch);
+static int __plain(const char* dbid, const char* sql);
+static void __fail(writequeue_job_t* batch);
+
+dbresult_t* writequeue_query(const char* dbid, const char* sql, array_t* params) {
+    if (dbid == NULL || sql == NULL) return NULL;
+
+    writequeue_writer_t* writer = __writer_get(dbid);
+    if (writer == NULL) return NULL;
+
+    writequeue_job_t job = {
+        .next = NULL,
+        .sql = sql,
+        .params = params,
+        .result = NULL,
+        .done = 0
+    };
+
+    pthread_mutex_lock(&writer->mutex);
+
+    while (writer->size >= WRITEQUEUE_QUEUE_MAX)
+        pthread_cond_wait(&writer->done, &writer->mutex);
+
+    if (writer->tail) writer->tail->next = &job;
+    else writer->head = &job;
+    writer->tail = &job;
+    writer->size++;
+
+    // The first caller that finds no transaction running commits the queue on its own thread,
+    // the others wait for it, so statements run on worker threads like any other dbquery
+    while (!job.done) {
+        if (writer->committing)
+            pthread_cond_wait(&writer->done, &writer->mutex);
+        else
+            __writer_lead(writer);
+    }
+
+    pthread_mutex_unlock(&writer->mutex);
+
+    return job.result;
+}
+
+int writequeue_exec(const char* dbid, const char* sql, array_t* params) {
+    dbresult_t* result = writequeue_query(dbid, sql, params);
+    if (result == NULL) return 0;
+
+    const int ok = dbresult_ok(result);
+    dbresult_free(result);
+
+    return ok;
+}
+
+writequeue_writer_t* __writer_get(const char* dbid) {
+    writequeue_writer_t* writer = NULL;
+
+    pthread_mutex_lock(&__writers_mutex);
+
+    for (int i = 0; i < __writers_count; i++) {
+        if (strcmp(__writers[i]->dbid, dbid) == 0) {
+            writer = __writers[i];
+            goto done;
+        }
+    }
+
+    if (__writers_count == WRITEQUEUE_WRITERS_MAX) {
+        log_error("writequeue: too many databases\n");
+        goto done;
+    }
+
+    writer = __writer_create(dbid);
+    if (writer != NULL)
+        __writers[__writers_count++] = writer;
+
+    done:
+
+    pthread_mutex_unlock(&__writers_mutex);
+
+    return writer;
+}
+
+writequeue_writer_t* __writer_create(const char* dbid) {
+    if (strlen(dbid) >= sizeof(((writequeue_writer_t*)0)->dbid)) {
+        log_error("writequeue: dbid is too long\n");
+        return NULL;
+    }
+
+    writequeue_writer_t* writer = calloc(1, sizeof * writer);
+    if (writer == NULL) return NULL;
+
+    strcpy(writer->dbid, dbid);
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->done, NULL);
+
+    return writer;
+}
+
+/**
+ * @brief Commits one batch of the queue. Called and returns with writer->mutex held.
+ */
+void __writer_lead(writequeue_writer_t* writer) {
+    writer->committing = 1;
+
+    // Everything queued while the previous transaction was committing goes into this one
+    writequeue_job_t* batch = writer->head;
+    writequeue_job_t* last = batch;
+    size_t count = 1;
+    while (last->next != NULL && count < WRITEQUEUE_BATCH_MAX) {
+        last = last->next;
+        count++;
+    }
+
+    writer->head = last->next;
+    if (writer->head == NULL) writer->tail = NULL;
+    last->next = NULL;
+
+    pthread_mutex_unlock(&writer->mutex);
+
+    __commit(writer->dbid, batch);
+
+    pthread_mutex_lock(&writer->mutex);
+
+    // Jobs live on the callers' stacks, next must be read before done is set
+    while (batch != NULL) {
+        writequeue_job_t* next = batch->next;
+        batch->done = 1;
+        batch = next;
+    }
+    writer->size -= count;
+    writer->committing = 0;
+
+    pthread_cond_broadcast(&writer->done);
+}
+
+void __commit(const char* dbid, writequeue_job_t* batch) {
+    dbresult_t* result = dbbegin(dbid, READ_COMMITTED);
+    const int began = result != NULL && dbresult_ok(result);
+    if (!began)
+        log_error("writequeue: begin failed: %s\n", result ? dbresult_error(result) : "out of memory");
+
+    if (result != NULL) dbresult_free(result);
+
+    if (!began) return;
+
+    // A single statement needs no savepoint, the transaction itself is enough
+    const int isolate = batch->next != NULL;
+
+    for (writequeue_job_t* job = batch; job; job = job->next) {
+        if (isolate && !__plain(dbid, "SAVEPOINT writequeue")) goto failed;
+
+        job->result = dbquery(dbid, job->sql, job->params);
+
+        if (!isolate) continue;
+
+        if (job->result == NULL || !dbresult_ok(job->result))
+            if (!__plain(dbid, "ROLLBACK TO SAVEPOINT writequeue")) goto failed;
+
+        if (!__plain(dbid, "RELEASE SAVEPOINT writequeue")) goto failed;
+    }
+
+    result = dbcommit(dbid);
+    if (result != NULL && dbresult_ok(result)) {
+        dbresult_free(result);
+        return;
+    }
+
+    log_error("writequeue: commit failed: %s\n", result ? dbresult_error(result) : "out of memory");
+    if (result != NULL) dbresult_free(result);
+
+    failed:
+
+    dbresult_free(dbrollback(dbid));
+    __fail(batch);
+}
+
+int __plain(const char* dbid, const char* sql) {
+    dbresult_t* result = dbquery(dbid, sql, NULL);
+    const int ok = result != NULL && dbresult_ok(result);
+    if (!ok)
+        log_error("writequeue: %s failed: %s\n", sql, result ? dbresult_error(result) : "out of memory");
+
+    if (result != NULL) dbresult_free(result);
+
+    return ok;
+}
+
+void __fail(writequeue_job_t* batch) {
+    for (writequeue_job_t* job = batch; job; job = job->next) {
+        if (job->result != NULL) dbresult_free(job->result);
+        job->result = NULL;
+    }
+}
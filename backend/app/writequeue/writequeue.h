@@ -0,0 +1,31 @@
+#ifndef __WRITEQUEUE__
+#define __WRITEQUEUE__
+
+#include "db.h"
+
+#define WRITEQUEUE_WRITERS_MAX 8
+#define WRITEQUEUE_QUEUE_MAX 4096
+#define WRITEQUEUE_BATCH_MAX 128
+
+/**
+ * Runs a write statement through the write queue of the database, one queue per process.
+ * Statements queued by concurrent callers are committed together in one transaction,
+ * each inside its own savepoint so a failing statement does not affect the others.
+ * The transaction runs on the thread of one of the callers, no extra thread is started.
+ * Intended for SQLite in WAL mode, where writers serialize on the database lock:
+ * reads keep using dbquery on the worker connections.
+ * Blocks until the transaction is committed. params must stay valid until return.
+ * @param dbid    Database identifier, e.g. "sqlite.s1"
+ * @param sql     Statement text
+ * @param params  Bound parameters or NULL
+ * @return Result of the statement, release with dbresult_free. NULL if the transaction failed.
+ */
+dbresult_t* writequeue_query(const char* dbid, const char* sql, array_t* params);
+
+/**
+ * Same as writequeue_query without the result.
+ * @return 1 if the statement succeeded and was committed, 0 otherwise
+ */
+int writequeue_exec(const char* dbid, const char* sql, array_t* params);
+
+#endif